@@ -0,0 +1,386 @@
+/**
+Benchmarks of the BB:: operations, with std::multimap as the baseline (trees keep duplicate keys as it does).
+
+Sweeps max_node_size, key counts, key types and key distributions and prints, per operation,
+ops/sec, p50 and p99 latency and the RSS the structure grew the process by. Run with --help for the options.
+Latencies are taken around every single operation, so ops/sec includes the cost of reading the clock on both sides.
+*/
+#include "btree.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options{
+    std::vector<uint64_t> sizes{1000, 100000, 1000000};
+    std::vector<int> node_sizes{16, 64, 256};
+    std::vector<std::string> types{"int64", "double", "string"};
+    std::vector<std::string> distributions{"sequential", "uniform", "zipfian", "duplicates"};
+    ///cap on timed lookups, range queries and middle keys per configuration
+    uint64_t operations=1000000;
+    bool baseline=true;
+    bool csv=false;
+};
+
+struct Result{
+    std::string structure;
+    std::string operation;
+    uint64_t count=0;
+    double seconds=0;
+    double p50_ns=0;
+    double p99_ns=0;
+    int64_t rss_bytes=-1;
+};
+
+static int64_t residentBytes(){
+    FILE* file=std::fopen("/proc/self/statm", "r");
+    if(!file){
+        return -1;
+    }
+    long size=0;
+    long resident=0;
+    int read=std::fscanf(file, "%ld %ld", &size, &resident);
+    std::fclose(file);
+    return read==2?(int64_t)resident*sysconf(_SC_PAGESIZE):-1;
+}
+
+///times every call of op(i) for i in [0, count)
+template<typename F>
+static Result measure(const std::string& structure,const std::string& operation,uint64_t count,F op){
+    Result result;
+    result.structure=structure;
+    result.operation=operation;
+    result.count=count;
+    std::vector<uint32_t> latencies(count);
+    auto start=Clock::now();
+    for(uint64_t i=0;i<count;i++){
+        auto before=Clock::now();
+        op(i);
+        latencies[i]=(uint32_t)std::min<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()-before).count(), UINT32_MAX);
+    }
+    result.seconds=std::chrono::duration<double>(Clock::now()-start).count();
+    if(count>0){
+        std::sort(latencies.begin(), latencies.end());
+        result.p50_ns=latencies[count/2];
+        result.p99_ns=latencies[std::min<uint64_t>(count-1, count*99/100)];
+    }
+    return result;
+}
+
+/**
+Zipfian ranks in [0, n) with skew theta, drawn in O(1) (Gray et al., "Quickly generating billion-record synthetic databases").
+Rank 0 is the most frequent, ranks are scattered over the key space by the caller.
+*/
+struct Zipfian{
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zeta;
+    double eta;
+    std::uniform_real_distribution<double> uniform{0.0, 1.0};
+
+    Zipfian(uint64_t n,double theta=0.99):n(n),theta(theta){
+        this->zeta=0;
+        for(uint64_t i=1;i<=n;i++){
+            this->zeta+=1.0/std::pow((double)i, theta);
+        }
+        double zeta2=1.0+1.0/std::pow(2.0, theta);
+        this->alpha=1.0/(1.0-theta);
+        this->eta=(1.0-std::pow(2.0/n, 1.0-theta))/(1.0-zeta2/this->zeta);
+    }
+
+    template<typename R>
+    uint64_t operator()(R& random){
+        double u=this->uniform(random);
+        double uz=u*this->zeta;
+        if(uz<1.0){
+            return 0;
+        }
+        if(uz<1.0+std::pow(0.5, this->theta)){
+            return 1;
+        }
+        return std::min<uint64_t>(this->n-1, (uint64_t)(this->n*std::pow(this->eta*u-this->eta+1.0, this->alpha)));
+    }
+};
+
+///n key seeds in insertion order, keys made from equal seeds are equal and order as the seeds do
+static std::vector<uint64_t> keySeeds(const std::string& distribution,uint64_t n,std::mt19937_64& random){
+    std::vector<uint64_t> seeds(n);
+    if(distribution=="sequential"){
+        for(uint64_t i=0;i<n;i++){
+            seeds[i]=i;
+        }
+    }else if(distribution=="uniform"){
+        for(uint64_t i=0;i<n;i++){
+            seeds[i]=random()>>11;
+        }
+    }else if(distribution=="zipfian"){
+        Zipfian zipfian(std::max<uint64_t>(n, 2));
+        for(uint64_t i=0;i<n;i++){
+            //a multiplicative hash spreads the hot ranks over the key space
+            seeds[i]=(zipfian(random)*0x9E3779B97F4A7C15ull)>>11;
+        }
+    }else if(distribution=="duplicates"){
+        //about 100 entries per key
+        uint64_t distinct=std::max<uint64_t>(n/100, 1);
+        for(uint64_t i=0;i<n;i++){
+            seeds[i]=random()%distinct;
+        }
+    }else{
+        throw std::runtime_error("unknown distribution "+distribution);
+    }
+    return seeds;
+}
+
+template<typename K>
+struct KeyMaker;
+
+template<>
+struct KeyMaker<int64_t>{
+    static int64_t make(uint64_t seed){
+        return (int64_t)seed;
+    }
+};
+
+template<>
+struct KeyMaker<double>{
+    static double make(uint64_t seed){
+        return (double)seed;
+    }
+};
+
+template<>
+struct KeyMaker<std::string>{
+    ///zero padded, so strings order as their seeds
+    static std::string make(uint64_t seed){
+        char buffer[24];
+        std::snprintf(buffer, sizeof(buffer), "%020llu", (unsigned long long)seed);
+        return buffer;
+    }
+};
+
+static void print(const Options& options,const std::string& config,const Result& result){
+    double ops=result.seconds>0?result.count/result.seconds:0;
+    if(options.csv){
+        std::printf("%s,%s,%s,%llu,%.0f,%.0f,%.0f,%lld\n", config.c_str(), result.structure.c_str(), result.operation.c_str(),
+            (unsigned long long)result.count, ops, result.p50_ns, result.p99_ns, (long long)result.rss_bytes);
+    }else{
+        std::printf("%-40s %-14s %-34s %12.0f ops/s  p50 %8.0f ns  p99 %9.0f ns", config.c_str(), result.structure.c_str(), result.operation.c_str(),
+            ops, result.p50_ns, result.p99_ns);
+        if(result.rss_bytes>=0){
+            std::printf("  rss %8.1f MB", result.rss_bytes/1048576.0);
+        }
+        std::printf("\n");
+    }
+    std::fflush(stdout);
+}
+
+template<typename K>
+static void runTree(const Options& options,const std::string& config,int node_size,const std::vector<uint64_t>& seeds,const std::vector<uint64_t>& probes){
+    typedef int64_t V;
+    uint64_t n=seeds.size();
+    std::vector<std::shared_ptr<K>> keys(n);
+    for(uint64_t i=0;i<n;i++){
+        keys[i]=std::make_shared<K>(KeyMaker<K>::make(seeds[i]));
+    }
+    std::vector<std::shared_ptr<K>> lookups(probes.size());
+    for(size_t i=0;i<probes.size();i++){
+        lookups[i]=keys[probes[i]];
+    }
+    std::string structure="BPlusTree/"+std::to_string(node_size);
+
+    int64_t rss=residentBytes();
+    auto tree=std::make_shared<BPlusTree<K,V>>(node_size);
+    Result result=measure(structure, "insert", n, [&](uint64_t i){
+        BB::insert(tree, keys[i], (V)i);
+    });
+    result.rss_bytes=residentBytes()-rss;
+    print(options, config, result);
+
+    volatile uint64_t sink=0;
+    print(options, config, measure(structure, "searchForKey", lookups.size(), [&](uint64_t i){
+        sink+=BB::searchForKey(tree, lookups[i])!=NULL;
+    }));
+    print(options, config, measure(structure, "searchForValue", lookups.size(), [&](uint64_t i){
+        sink+=BB::searchForValue(tree, lookups[i]);
+    }));
+    uint64_t ranges=std::min<uint64_t>(lookups.size(), 100000);
+    print(options, config, measure(structure, "searchForRangeWithPagination/100", ranges, [&](uint64_t i){
+        sink+=BB::searchForRangeWithPagination(tree, 0, 100, lookups[i])->size();
+    }));
+    print(options, config, measure(structure, "searchForRangeWithPaginationV/100", ranges, [&](uint64_t i){
+        sink+=BB::searchForRangeWithPaginationV(tree, 0, 100, lookups[i])->size();
+    }));
+    print(options, config, measure(structure, "searchForRangeWithPaginationKV/100", ranges, [&](uint64_t i){
+        sink+=BB::searchForRangeWithPaginationKV(tree, 0, 100, lookups[i])->size();
+    }));
+    //findV scans every leaf after the bookmark, so a handful of scans
+    uint64_t scans=std::max<uint64_t>(1, std::min<uint64_t>(20, 10000000/std::max<uint64_t>(n, 1)));
+    print(options, config, measure(structure, "findV/1%", scans, [&](uint64_t i){
+        K low=*lookups[i%lookups.size()];
+        sink+=BB::findV(tree, [&low](const K& k1,const K&){
+            return k1<low?-1:0;
+        }, std::shared_ptr<K>(), false, (uint)std::max<uint64_t>(n/100, 1))->size();
+    }));
+    print(options, config, measure(structure, "getMiddleKey", std::min<uint64_t>(lookups.size(), 100000), [&](uint64_t){
+        sink+=BB::getMiddleKey(tree)!=NULL;
+    }));
+    print(options, config, measure(structure, "deleteKey", n, [&](uint64_t i){
+        sink+=BB::deleteKey(tree, keys[n-1-i])!=NULL;
+    }));
+}
+
+template<typename K>
+static void runMap(const Options& options,const std::string& config,const std::vector<uint64_t>& seeds,const std::vector<uint64_t>& probes){
+    typedef int64_t V;
+    uint64_t n=seeds.size();
+    std::vector<K> keys(n);
+    for(uint64_t i=0;i<n;i++){
+        keys[i]=KeyMaker<K>::make(seeds[i]);
+    }
+    std::string structure="std::multimap";
+
+    int64_t rss=residentBytes();
+    std::multimap<K,V> map;
+    Result result=measure(structure, "insert", n, [&](uint64_t i){
+        map.emplace(keys[i], (V)i);
+    });
+    result.rss_bytes=residentBytes()-rss;
+    print(options, config, result);
+
+    volatile uint64_t sink=0;
+    print(options, config, measure(structure, "find", probes.size(), [&](uint64_t i){
+        sink+=map.find(keys[probes[i]])!=map.end();
+    }));
+    uint64_t ranges=std::min<uint64_t>(probes.size(), 100000);
+    print(options, config, measure(structure, "lower_bound+100", ranges, [&](uint64_t i){
+        std::vector<V> values;
+        auto it=map.lower_bound(keys[probes[i]]);
+        for(int j=0;j<100 && it!=map.end();j++,it++){
+            values.push_back(it->second);
+        }
+        sink+=values.size();
+    }));
+    uint64_t scans=std::max<uint64_t>(1, std::min<uint64_t>(20, 10000000/std::max<uint64_t>(n, 1)));
+    print(options, config, measure(structure, "scan/1%", scans, [&](uint64_t i){
+        const K& low=keys[probes[i%probes.size()]];
+        std::vector<V> values;
+        uint64_t limit=std::max<uint64_t>(n/100, 1);
+        for(auto it=map.lower_bound(low);it!=map.end() && values.size()<limit;it++){
+            values.push_back(it->second);
+        }
+        sink+=values.size();
+    }));
+    //std::map has no order statistics, the middle is a walk over half the map
+    print(options, config, measure(structure, "middle", std::min<uint64_t>(probes.size(), std::max<uint64_t>(1, 100000000/std::max<uint64_t>(n, 1))), [&](uint64_t){
+        sink+=map.empty()?0:(uint64_t)std::next(map.begin(), map.size()/2)->second;
+    }));
+    //deleteKey removes a key with all its duplicates, so the map erases every entry of the key as well
+    print(options, config, measure(structure, "erase", n, [&](uint64_t i){
+        sink+=map.erase(keys[n-1-i])>0;
+    }));
+}
+
+template<typename K>
+static void runType(const Options& options,const std::string& type){
+    for(const std::string& distribution : options.distributions){
+        for(uint64_t n : options.sizes){
+            std::mt19937_64 random(n*31+distribution.size());
+            std::vector<uint64_t> seeds=keySeeds(distribution, n, random);
+            //lookups hit inserted keys in random order
+            std::vector<uint64_t> probes(std::min(n, options.operations));
+            for(size_t i=0;i<probes.size();i++){
+                probes[i]=random()%n;
+            }
+            std::ostringstream config;
+            config<<type<<"/"<<distribution<<"/"<<n;
+            if(options.baseline){
+                runMap<K>(options, config.str(), seeds, probes);
+            }
+            for(int node_size : options.node_sizes){
+                runTree<K>(options, config.str(), node_size, seeds, probes);
+            }
+        }
+    }
+}
+
+template<typename T>
+static std::vector<T> parseList(const std::string& text){
+    std::vector<T> list;
+    std::istringstream stream(text);
+    std::string item;
+    while(std::getline(stream, item, ',')){
+        std::istringstream value(item);
+        T parsed;
+        value>>parsed;
+        list.push_back(parsed);
+    }
+    return list;
+}
+
+static void usage(const char* program){
+    std::printf(
+        "usage: %s [options]\n"
+        "  --sizes 1000,100000       key counts (up to 100000000, memory permitting)\n"
+        "  --node-sizes 16,64,256    max_node_size values\n"
+        "  --types int64,double,string\n"
+        "  --distributions sequential,uniform,zipfian,duplicates\n"
+        "  --operations N            cap on timed lookups per configuration (default 1000000)\n"
+        "  --no-baseline             skip std::multimap\n"
+        "  --csv                     config,structure,operation,count,ops_per_sec,p50_ns,p99_ns,rss_bytes\n",
+        program);
+}
+
+int main(int argc,char** argv){
+    Options options;
+    for(int i=1;i<argc;i++){
+        std::string arg=argv[i];
+        bool hasValue=i+1<argc;
+        if(arg=="--sizes" && hasValue){
+            options.sizes=parseList<uint64_t>(argv[++i]);
+        }else if(arg=="--node-sizes" && hasValue){
+            options.node_sizes=parseList<int>(argv[++i]);
+        }else if(arg=="--types" && hasValue){
+            options.types=parseList<std::string>(argv[++i]);
+        }else if(arg=="--distributions" && hasValue){
+            options.distributions=parseList<std::string>(argv[++i]);
+        }else if(arg=="--operations" && hasValue){
+            options.operations=std::strtoull(argv[++i], NULL, 10);
+        }else if(arg=="--no-baseline"){
+            options.baseline=false;
+        }else if(arg=="--csv"){
+            options.csv=true;
+        }else{
+            usage(argv[0]);
+            return arg=="--help"?0:1;
+        }
+    }
+    if(options.csv){
+        std::printf("config,structure,operation,count,ops_per_sec,p50_ns,p99_ns,rss_bytes\n");
+    }
+    try{
+        for(const std::string& type : options.types){
+            if(type=="int64"){
+                runType<int64_t>(options, type);
+            }else if(type=="double"){
+                runType<double>(options, type);
+            }else if(type=="string"){
+                runType<std::string>(options, type);
+            }else{
+                throw std::runtime_error("unknown key type "+type);
+            }
+        }
+    }catch(const char* error){
+        std::fprintf(stderr, "%s\n", error);
+        return 1;
+    }catch(const std::exception& error){
+        std::fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+    return 0;
+}
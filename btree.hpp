@@ -1,1321 +1,6602 @@
-
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
 #include <exception>
+#include <fcntl.h>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <unistd.h>
 #include <functional>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #ifndef BTREE
 #define BTREE
 
 template<typename K>
 using ComparatorFunction = std::function<int(std::shared_ptr<K> k1,std::shared_ptr<K> k2)>;
 
+/**
+Returns a shared_ptr which points to item but does not own it (it has no control block).
+Copying it costs no reference counting, so its only meant to be handed to comparators for the duration of a call.
+*/
+template<typename T>
+static std::shared_ptr<T> borrowPointer(const T& item){
+    return std::shared_ptr<T>(std::shared_ptr<T>(), const_cast<T*>(&item));
+}
 
-template<typename K>
-struct LinkedNode{
-  std::shared_ptr<LinkedNode<K>> rightSibling;  
-  std::shared_ptr<LinkedNode<K>> leftSibling;  
+#ifdef BTREE_STATS
+///operations with their own latency histogram in BPlusCounters
+enum BPlusOperation{
+    OP_INSERT,
+    OP_DELETE,
+    OP_SEARCH,
+    OP_RANGE,
+    OP_FIND,
+    OP_RANK,
+    OP_SELECT,
+    OP_COUNT_RANGE,
+    OP_MIDDLE_KEY,
+    OP_BULK_LOAD,
+    OP_INSERT_BATCH,
+    OP_DELETE_BATCH,
+    OPERATION_COUNT
+};
+
+///latency bucket i counts operations which took [2^i, 2^(i+1)) nanoseconds, the last one also counts all slower ones
+static const int BPLUS_LATENCY_BUCKETS=40;
+///one per BB::BalanceCase
+static const int BPLUS_BALANCE_CASES=7;
+
+/**
+Counters of a tree, kept only when compiled with BTREE_STATS: without it trees carry no counters and the counting compiles to nothing.
+Trees hold them as atomics, BB::counters copies them out as plain numbers. Counters only grow.
+*/
+template<typename T>
+struct BPlusCounters{
+    ///calls of ThreeWayCompare and of the comparator adapters, keys looked at by vector searches included
+    T comparisons;
+    ///nodes visited by descents from the root, leaves included
+    T node_visits;
+    ///leaves walked by range scans, find and findV
+    T leaves_scanned;
+    ///indexed by BB::BalanceCase
+    T balance_cases[BPLUS_BALANCE_CASES];
+    T operations[OPERATION_COUNT];
+    T latency[OPERATION_COUNT][BPLUS_LATENCY_BUCKETS];
+};
+
+/**
+Counts of the BB operation running on this thread, added to the counters of its tree when the operation ends,
+so hot paths only bump thread local numbers.
+*/
+struct BPlusStatsScope{
+    BPlusCounters<std::atomic<uint64_t>>* counters;
+    BPlusOperation operation;
+    std::chrono::steady_clock::time_point start;
+    BPlusStatsScope* outer;
+    uint64_t comparisons=0;
+    uint64_t node_visits=0;
+    uint64_t leaves_scanned=0;
+
+    static BPlusStatsScope*& current(){
+        static thread_local BPlusStatsScope* scope=NULL;
+        return scope;
+    }
 
-  int duplicate_count=0;
-  std::shared_ptr<K> key;
+    BPlusStatsScope(BPlusCounters<std::atomic<uint64_t>>* counters,BPlusOperation operation):counters(counters),operation(operation),
+        start(std::chrono::steady_clock::now()),outer(current()){
+        current()=this;
+    }
 
-  LinkedNode(std::shared_ptr<K> key):key(key){
+    BPlusStatsScope(const BPlusStatsScope&)=delete;
+    BPlusStatsScope& operator=(const BPlusStatsScope&)=delete;
 
-  }
+    ~BPlusStatsScope(){
+        uint64_t nanoseconds=(uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-this->start).count();
+        int bucket=0;
+        while(bucket<BPLUS_LATENCY_BUCKETS-1 && (nanoseconds>>(bucket+1))>0){
+            bucket++;
+        }
+        this->counters->comparisons.fetch_add(this->comparisons, std::memory_order_relaxed);
+        this->counters->node_visits.fetch_add(this->node_visits, std::memory_order_relaxed);
+        this->counters->leaves_scanned.fetch_add(this->leaves_scanned, std::memory_order_relaxed);
+        this->counters->operations[this->operation].fetch_add(1, std::memory_order_relaxed);
+        this->counters->latency[this->operation][bucket].fetch_add(1, std::memory_order_relaxed);
+        current()=this->outer;
+    }
 };
 
+#define BTREE_STATS_COUNT(field,n) do{ if(BPlusStatsScope* _scope=BPlusStatsScope::current()){ _scope->field+=(n); } }while(0)
+#define BTREE_STATS_OPERATION(tree,operation) BPlusStatsScope _statsScope(&(tree)->counters, operation)
+#define BTREE_STATS_BALANCE(tree,balanceCase) (tree)->counters.balance_cases[balanceCase].fetch_add(1, std::memory_order_relaxed)
+#else
+#define BTREE_STATS_COUNT(field,n) do{ }while(0)
+#define BTREE_STATS_OPERATION(tree,operation) do{ }while(0)
+#define BTREE_STATS_BALANCE(tree,balanceCase) do{ }while(0)
+#endif
+
+/**
+Default comparator policy of a tree: three way compare of keys with operator<.
+Comparator policies are called as compare(k1, k2) on const K& and return negative, 0 or positive like ComparatorFunction does.
+*/
 template<typename K>
-struct SortedLinkedList{
-    std::shared_ptr<LinkedNode<K>> min;
-    std::shared_ptr<LinkedNode<K>> max;
-    int count=0;
+struct ThreeWayCompare{
+    int operator()(const K& k1,const K& k2) const{
+        BTREE_STATS_COUNT(comparisons, 1);
+        return k1<k2?-1:(k2<k1?1:0);
+    }
 };
 
-template<typename K>
-struct BPlusTree;
+template<>
+struct ThreeWayCompare<std::string>{
+    int operator()(const std::string& k1,const std::string& k2) const{
+        BTREE_STATS_COUNT(comparisons, 1);
+        return k1.compare(k2);
+    }
+};
 
-template<typename K>
-struct BPlusCell;
+/**
+Three way compare of strings, which also gives the shortest separator between two leaves (suffix truncation),
+so internal nodes hold short keys, often short enough to be kept inline by std::string, instead of whole copies of leaf keys.
+Separators need not be keys of the tree, so every comparator used with such a tree must order strings bytewise as this one does.
+Leaves keep whole keys, for leaves which store the common prefix of their keys once see PrefixCompressingCompare.
+*/
+struct SuffixTruncatingCompare : ThreeWayCompare<std::string>{
+    ///shortest string s with leftMax <= s < rightMin, given leftMax < rightMin
+    std::string separator(const std::string& leftMax,const std::string& rightMin) const{
+        size_t common=0;
+        size_t limit=std::min(leftMax.size(), rightMin.size());
+        while(common<limit && leftMax[common]==rightMin[common]){
+            common++;
+        }
+        //rightMin cut right after the first byte which differs is greater than leftMax, and lesser than rightMin unless its all of it
+        if(common+1<leftMax.size() && common+1<rightMin.size()){
+            return rightMin.substr(0, common+1);
+        }
+        return leftMax;
+    }
+};
 
-template<typename K>
-struct BPlusNode{
-    std::weak_ptr<BPlusCell<K>> parent_cell;
+/**
+String key which is prefix followed by suffix, where prefix may be shared with other keys.
+Trees ordering these with PrefixCompressingCompare point the keys of a leaf at one copy of their common prefix and keep only the suffixes per key.
+A key is always whole by itself, sharing a prefix only saves memory, so keys can be copied out of a leaf and compared like any other.
+*/
+struct BPlusPrefixedString{
+    std::shared_ptr<const std::string> prefix;
+    std::string suffix;
 
-    std::weak_ptr<BPlusNode<K>> rightSibling;
-    std::weak_ptr<BPlusNode<K>> leftSibling;
+    BPlusPrefixedString(){
 
-    std::weak_ptr<BPlusNode<K>> parent_node;
+    }
 
-    std::shared_ptr<SortedLinkedList<BPlusCell<K>>> cellsList;
+    BPlusPrefixedString(std::string value):suffix(std::move(value)){
 
-    std::weak_ptr<BPlusTree<K>>parent_tree;
+    }
 
-    std::shared_ptr<BPlusNode<K>> left_most_child;
+    BPlusPrefixedString(const char* value):suffix(value){
 
-    bool isLeftMostNode(){
-        //there is no parent cell for left most node
-        return this->parent_cell.lock()==NULL;
     }
 
-    bool isRoot(){
-        return this->parent_node.lock()==NULL;
+    size_t prefixSize() const{
+        return this->prefix?this->prefix->size():0;
     }
 
-    int size(){
-        return this->cellsList->count;
+    size_t size() const{
+        return this->prefixSize()+this->suffix.size();
     }
 
-    bool isLeaf;
-
-
-    
+    char operator[](size_t i) const{
+        size_t prefixSize=this->prefixSize();
+        return i<prefixSize?(*this->prefix)[i]:this->suffix[i-prefixSize];
+    }
 
-};
+    std::string str() const{
+        return this->prefix?*this->prefix+this->suffix:this->suffix;
+    }
 
-template<typename K>
-static void setAsCellsList(std::shared_ptr<BPlusNode<K>> node,std::shared_ptr<SortedLinkedList<BPlusCell<K>>> newCellsList){
-    if(!node->isLeaf){
-        auto currentLinkedNode = newCellsList->min;
-        while(currentLinkedNode){
-            if(currentLinkedNode->key->right_child_node)
-                currentLinkedNode->key->right_child_node->parent_node=node;
-            currentLinkedNode=currentLinkedNode->rightSibling;
+    ///bytewise three way compare, as std::string::compare of the whole strings
+    int compare(const BPlusPrefixedString& other) const{
+        //keys of one leaf share their prefix, so comparing them only takes their suffixes
+        if(this->prefix==other.prefix){
+            return this->suffix.compare(other.suffix);
+        }
+        const std::string* mine[2]={this->prefix.get(), &this->suffix};
+        const std::string* theirs[2]={other.prefix.get(), &other.suffix};
+        size_t i=0;
+        size_t j=0;
+        size_t myOffset=0;
+        size_t theirOffset=0;
+        while(true){
+            while(i<2 && (!mine[i] || myOffset==mine[i]->size())){
+                i++;
+                myOffset=0;
+            }
+            while(j<2 && (!theirs[j] || theirOffset==theirs[j]->size())){
+                j++;
+                theirOffset=0;
+            }
+            if(i==2 || j==2){
+                return (i==2?0:1)-(j==2?0:1);
+            }
+            size_t run=std::min(mine[i]->size()-myOffset, theirs[j]->size()-theirOffset);
+            int c=std::char_traits<char>::compare(mine[i]->data()+myOffset, theirs[j]->data()+theirOffset, run);
+            if(c!=0){
+                return c<0?-1:1;
+            }
+            myOffset+=run;
+            theirOffset+=run;
         }
     }
-    node->cellsList=newCellsList;
-}
 
-template<typename K>
-static void reinforceParentShipInChildNodes(std::shared_ptr<BPlusNode<K>> node){
-    if(!node->isLeaf && node->cellsList){
-    auto currentLinkedNode = node->cellsList->min;
-    while(currentLinkedNode){
-        if(currentLinkedNode->key->right_child_node)
-            currentLinkedNode->key->right_child_node->parent_node=node;
-        currentLinkedNode=currentLinkedNode->rightSibling;
-    }
+    bool operator<(const BPlusPrefixedString& other) const{
+        return this->compare(other)<0;
     }
-}
-
-template<typename K>    
-static void setAsLeftMostChildNode(std::shared_ptr<BPlusNode<K>> node,std::shared_ptr<BPlusNode<K>> nodeToSetAsLeftMostChild){
-    node->left_most_child=nodeToSetAsLeftMostChild;
-    nodeToSetAsLeftMostChild->parent_node=node;
-    nodeToSetAsLeftMostChild->parent_cell.lock()=NULL;
-}
-
-template<typename K>
-static std::shared_ptr<BPlusNode<K>> createBPlusNode(std::shared_ptr<BPlusTree<K>>parent_tree,bool isLeaf,std::shared_ptr<BPlusNode<K>> parent_node=NULL, std::shared_ptr<BPlusNode<K>> left_most_child=NULL){
-    std::shared_ptr<BPlusNode<K>> t(new BPlusNode<K>());
-    t->parent_tree=parent_tree;
-    t->isLeaf=isLeaf;
-    t->parent_node=parent_node;
-    t->left_most_child=left_most_child;
 
-    t->cellsList=std::shared_ptr<SortedLinkedList<BPlusCell<K>>>(new SortedLinkedList<BPlusCell<K>>());
-    if(t->left_most_child){
-        t->left_most_child->parent_node=t;
-        t->left_most_child->parent_cell.lock()=NULL;
+    bool operator==(const BPlusPrefixedString& other) const{
+        return this->compare(other)==0;
     }
 
-    return t;
-}
-
+    ///points this key at prefix (NULL for none), which must be a prefix of it, leaving the rest in suffix
+    void rebase(const std::shared_ptr<const std::string>& prefix){
+        if(this->prefix==prefix){
+            return;
+        }
+        std::string whole=this->str();
+        this->suffix.assign(whole, prefix?prefix->size():0, std::string::npos);
+        this->suffix.shrink_to_fit();
+        this->prefix=prefix;
+    }
+};
 
-template<typename K>
-struct BPlusCell{
-    std::shared_ptr<K> key;
-    std::shared_ptr<void> value;
+/**
+Bytewise three way compare of BPlusPrefixedString keys, which compresses both ends of the tree:
+leaves store the common prefix of their keys once (compressLeaf), and internal nodes hold the shortest separators
+between leaves (suffix truncation, as SuffixTruncatingCompare does), which point at no prefix.
+Every comparator used with such a tree must order keys bytewise as this one does.
+*/
+struct PrefixCompressingCompare{
+    ///shorter common prefixes are not worth a shared copy
+    static const size_t MIN_PREFIX=4;
+
+    int operator()(const BPlusPrefixedString& k1,const BPlusPrefixedString& k2) const{
+        BTREE_STATS_COUNT(comparisons, 1);
+        return k1.compare(k2);
+    }
 
-    std::shared_ptr<BPlusNode<K>> right_child_node;
-    std::weak_ptr<BPlusNode<K>> parentNodeForRightChildNode;
+    BPlusPrefixedString separator(const BPlusPrefixedString& leftMax,const BPlusPrefixedString& rightMin) const{
+        return BPlusPrefixedString(SuffixTruncatingCompare().separator(leftMax.str(), rightMin.str()));
+    }
 
-    void setAsRightChildNode(std::shared_ptr<BPlusNode<K>> nodeToBecomeRCNOfThisCell){
-        std::shared_ptr<BPlusNode<K>> existingParentNode;
-        if(this->right_child_node){
-            existingParentNode=this->right_child_node->parent_node;
+    /**
+    Points the sorted keys of a leaf at one copy of their common prefix. When added is the index of the only key put in
+    since the last call, that key is pointed at the prefix of its neighbour if it starts with it, otherwise (and for added -1)
+    the prefix is worked out again from the first and last key.
+    */
+    void compressLeaf(BPlusPrefixedString* keys,int size,int added) const{
+        if(size<2){
+            //a lone key has none to share with, nor should it hold on to the prefix of the leaf it came from
+            if(size==1){
+                keys[0].rebase(NULL);
+            }
+            return;
+        }
+        if(added>=0){
+            const std::shared_ptr<const std::string>& prefix=keys[added==0?1:added-1].prefix;
+            BPlusPrefixedString& key=keys[added];
+            if(prefix && key.size()>=prefix->size()){
+                size_t i=0;
+                while(i<prefix->size() && key[i]==(*prefix)[i]){
+                    i++;
+                }
+                if(i==prefix->size()){
+                    key.rebase(prefix);
+                    return;
+                }
+            }
+        }
+        const BPlusPrefixedString& first=keys[0];
+        const BPlusPrefixedString& last=keys[size-1];
+        size_t common=0;
+        size_t limit=std::min(first.size(), last.size());
+        while(common<limit && first[common]==last[common]){
+            common++;
+        }
+        std::shared_ptr<const std::string> prefix;
+        if(common>=MIN_PREFIX){
+            prefix=first.prefix && first.prefix->size()==common?first.prefix:std::make_shared<const std::string>(first.str().substr(0, common));
+        }
+        for(int i=0;i<size;i++){
+            keys[i].rebase(prefix);
         }
-
-        this->right_child_node=nodeToBecomeRCNOfThisCell;
-        nodeToBecomeRCNOfThisCell->parent_cell=this;
-        nodeToBecomeRCNOfThisCell->parent_node=existingParentNode;
     }
 };
 
-template<typename K>
-static std::shared_ptr<BPlusCell<K>> createBPlusCell(std::shared_ptr<K> key,std::shared_ptr<BPlusNode<K>> right_child_node=NULL,std::shared_ptr<BPlusNode<K>> parentNodeForRightChildNode=NULL){
-    //:key(key),right_child_node(right_child_node),parentNodeForRightChildNode(parentNodeForRightChildNode)
-    std::shared_ptr<BPlusCell<K>> t(new BPlusCell<K>);
-    t->key=key;
-    t->right_child_node=right_child_node;
-    t->parentNodeForRightChildNode=parentNodeForRightChildNode;
+/**
+Reader/writer latch. Latches are mostly held for a few node accesses, so a waiter spins briefly and then parks on one of a fixed set of
+mutex and condition pairs picked by the latch address: a latch is just a few atomics, and waiting on one does not burn a core.
+Writers are preferred: once one is waiting, new readers wait as well, so a thread must not take a latch it already holds.
+Latches are not reentrant, so BB operations must not be nested on one tree: calling one from a comparator or callback
+another BB operation on the same tree is running would deadlock. Unless NDEBUG is defined, such a call throws instead.
+*/
+struct BPlusLatch{
+    ///checks of the latch state before a waiter parks
+    static const int SPINS=64;
+    static const int PARKING_LOTS=64;
+
+    std::atomic<int> readers{0};
+    std::atomic<int> writers_waiting{0};
+    std::atomic<bool> writer{false};
+    ///threads parked on this latch, releases only go to the parking lot when there are any
+    std::atomic<int> parked{0};
+
+    struct _ParkingLot{
+        std::mutex mutex;
+        std::condition_variable wake;
+    };
 
-    if(t->right_child_node){
-        t->right_child_node->parent_cell=t;
-        
-        if(t->right_child_node->parent_node.lock())
-            t->right_child_node->parent_node.lock()=parentNodeForRightChildNode;
+    static _ParkingLot& _lot(const BPlusLatch* latch){
+        static _ParkingLot lots[PARKING_LOTS];
+        return lots[reinterpret_cast<uintptr_t>(latch)/sizeof(BPlusLatch)%PARKING_LOTS];
     }
 
-    return t;
-}
-
-
+#ifndef NDEBUG
+    ///latches the calling thread holds
+    static std::vector<const BPlusLatch*>& _held(){
+        static thread_local std::vector<const BPlusLatch*> held;
+        return held;
+    }
 
-template<typename K>
-struct BPlusTree{
-    std::shared_ptr<BPlusNode<K>> left_most_node;
-    std::shared_ptr<BPlusNode<K>> right_most_node;
-    std::shared_ptr<BPlusNode<K>> root_node;
+    void _acquiring() const{
+        auto& held=_held();
+        if(std::find(held.begin(), held.end(), this)!=held.end()){
+            throw "${Const.BalancedTrees}: latch is already held by this thread, BB operations on one tree must not be nested";
+        }
+    }
 
-    uint64_t size=0;
-    int half_capacity=0;
-    int max_node_size=4;
+    void _released() const{
+        auto& held=_held();
+        auto it=std::find(held.begin(), held.end(), this);
+        if(it!=held.end()){
+            held.erase(it);
+        }
+    }
+#endif
+
+    void lockShared(){
+#ifndef NDEBUG
+        this->_acquiring();
+#endif
+        this->_lockShared();
+#ifndef NDEBUG
+        _held().push_back(this);
+#endif
+    }
 
-    BPlusTree(int max_node_size):max_node_size(max_node_size){
-    if(max_node_size%2==1){
-      throw "${Const.BalancedTrees} : node_size for tree must be an even number";
+    ///latches shared unless that would have to wait, returns whether it did
+    bool tryLockShared(){
+#ifndef NDEBUG
+        this->_acquiring();
+#endif
+        if(!this->_tryLockShared()){
+            return false;
+        }
+#ifndef NDEBUG
+        _held().push_back(this);
+#endif
+        return true;
     }
-    this->half_capacity= this->max_node_size/2;
+
+    void unlockShared(){
+#ifndef NDEBUG
+        this->_released();
+#endif
+        this->readers--;
+        this->_wake();
     }
-};
 
+    void lock(){
+#ifndef NDEBUG
+        this->_acquiring();
+#endif
+        this->_lock();
+#ifndef NDEBUG
+        _held().push_back(this);
+#endif
+    }
 
-enum SearchType{
-  LesserThanOrEqualsTo,
-  EqualsTo,
-  GreaterThanOrEqualsTo,
-    LesserThan,
-  GreaterThan
-};
+    void unlock(){
+#ifndef NDEBUG
+        this->_released();
+#endif
+        this->writer.store(false);
+        this->_wake();
+    }
 
-namespace LL {
-    template<typename K>
-    static std::shared_ptr<LinkedNode<K>> search(std::shared_ptr<SortedLinkedList<K>> list, ComparatorFunction<K> compare,std::shared_ptr<K> searchKey, SearchType searchType=SearchType::EqualsTo){
-        if(list->min==nullptr){
-            return list->min;
-        }else{
-            std::shared_ptr<LinkedNode<K>> eq;
-            std::shared_ptr<LinkedNode<K>> lte;
-            std::shared_ptr<LinkedNode<K>> gte;
-
-            std::shared_ptr<LinkedNode<K>> current_node = list->min;
-            while (current_node) {
-                auto compareResult = compare(searchKey, current_node->key);
-                if (compareResult == 0) {
-                    //found an exact match;
-                    if(searchType == SearchType::GreaterThan){
-                        current_node = current_node->rightSibling;
-                    }else{
-                        eq = current_node;
-                        break;
-                    }
-                } else if (compareResult > 0) {
-                    //search key is bigger than current
-                    lte = current_node;
-                    current_node = current_node->rightSibling;
-                } else {
-                    //search key is smaller than current
-                    gte = current_node;
-                    break;
-                }
-            }
+    ///turns an exclusive hold into a shared one, without letting another writer in between
+    void downgrade(){
+        this->readers++;
+        this->writer.store(false);
+        this->_wake();
+    }
 
-            switch (searchType) {
-                case SearchType::LesserThanOrEqualsTo: return eq? eq : lte;
-                case SearchType::EqualsTo: return eq;
-                case SearchType::GreaterThanOrEqualsTo: return eq? eq : gte;
-                case SearchType::LesserThan: return lte;
-                case SearchType::GreaterThan: return gte;
-            }
+    bool _tryLockShared(){
+        if(this->writer.load() || this->writers_waiting.load()>0){
+            return false;
         }
-        return NULL;
+        this->readers++;
+        //a writer may have got in between the check and the increment
+        if(!this->writer.load()){
+            return true;
+        }
+        this->readers--;
+        this->_wake();
+        return false;
     }
-    template<typename K>
-    static std::shared_ptr<LinkedNode<K>> insert(std::shared_ptr<SortedLinkedList<K>> list, ComparatorFunction<K> compare,std::shared_ptr<K> key){
-        std::shared_ptr<LinkedNode<K>> newNode(new LinkedNode<K>(key));
 
-        if(list->min==nullptr){
-            list->min=newNode;
-            list->max=newNode;
-        }else{
-            auto foundNode = search(list,compare, key, SearchType::LesserThanOrEqualsTo);
-            //as this is a less than or equals to search, if found node is undefined
-            //then its less than minimum of the list
-            if(!foundNode){
-                //new node is new min
-                list->min->leftSibling=newNode;
-                newNode->rightSibling=list->min;
-                list->min=newNode;
-            }else{
-                if(compare(key, foundNode->key)==0){
-                    foundNode->duplicate_count++;
-                    list->count--;
-                    //this is done as change feeds in recliner db were failing because of this.
-                    foundNode->key=newNode->key;
-                    newNode=foundNode;
-                }else{
-                    //found node is less then new node, that means its left sibling of new node
-                    auto right_sibling = foundNode->rightSibling;
-                    foundNode->rightSibling=newNode;
-                    newNode->leftSibling=foundNode;
-
-                    newNode->rightSibling=right_sibling;
-                    if(right_sibling){
-                        right_sibling->leftSibling=newNode;
-                    }
-                    
-                    if(foundNode==list->max){
-                        list->max=newNode;
-                    }
-                }
-            }
+    void _lockShared(){
+        while(!this->_tryLockShared()){
+            this->_wait([this]{
+                return !this->writer.load() && this->writers_waiting.load()==0;
+            });
         }
-
-        list->count++;
-
-        return newNode;
     }
 
-    template<typename K>
-    static std::shared_ptr<LinkedNode<K>> deleteNode(std::shared_ptr<SortedLinkedList<K>> list, ComparatorFunction<K> compare,std::shared_ptr<K> key){
-        auto nodeToDelete= LL::search(list,compare, key, SearchType::EqualsTo);
-        if(nodeToDelete){
-            std::shared_ptr<LinkedNode<K>> deletedNode(new LinkedNode<K>(nodeToDelete->key));
-            deletedNode->duplicate_count=nodeToDelete->duplicate_count;
-
-            if(list->count==1){
-                list->min=NULL;
-                list->max=NULL;
-            }else{
-                // assert(list->count>=2);
-                if(nodeToDelete==list->min){
-                    auto oldMin=list->min;
-                    list->min=nodeToDelete->rightSibling;
-                    
-                    oldMin->rightSibling->leftSibling=NULL;
-                    oldMin->rightSibling=NULL;
-                }else if(nodeToDelete==list->max){
-                    auto oldMax=list->max;
-                    list->max=nodeToDelete->leftSibling;
-
-                    oldMax->leftSibling->rightSibling=NULL;
-                    oldMax->leftSibling=NULL;
-                }
-                auto left_sibling = nodeToDelete->leftSibling;
-                auto right_sibling = nodeToDelete->rightSibling;
-                
-                if(left_sibling){
-                    left_sibling->rightSibling=right_sibling;
-                }
-                
-                if(right_sibling){
-                    right_sibling->leftSibling=left_sibling;
-                }
-                
-                nodeToDelete->leftSibling=NULL;
-                nodeToDelete->rightSibling=NULL;
-                nodeToDelete->key=NULL;
-            }
-            list->count-=(deletedNode->duplicate_count+1);
-            return deletedNode;
+    void _lock(){
+        this->writers_waiting++;
+        bool expected=false;
+        while(!this->writer.compare_exchange_strong(expected, true)){
+            expected=false;
+            this->_wait([this]{
+                return !this->writer.load();
+            });
         }
-        return NULL;
+        this->writers_waiting--;
+        this->_wait([this]{
+            return this->readers.load()==0;
+        });
     }
 
     /**
-    returns a splitted_lists of size 2, splitted_lists[[0]] is left portion, splitted_lists[[1]] is right portion.
-  
-    **listToSplit**: its size must be at least of length 2.
-  
-    **splitAfterIndex**: Items till splitAfterIndex are in left portion
+    Returns once ready() holds, or might: callers check the state again as they take the latch.
+    A parked waiter counts itself in parked before its last check of ready(), and a release changes the state before it reads parked,
+    so either the release sees the waiter and wakes it or the waiter sees the release.
     */
-    template<typename K>
-    static std::shared_ptr<std::vector<std::shared_ptr<SortedLinkedList<K>>>>  splitAt(std::shared_ptr<SortedLinkedList<K>> listToSplit , int splitAfterIndex){
-        std::shared_ptr<std::vector<std::shared_ptr<SortedLinkedList<K>>>> result(new std::vector<std::shared_ptr<SortedLinkedList<K>>>);
-
-        if(listToSplit->count<2){
-            throw "${Const.BalancedTrees} : Size of List to be split must be atleast 2";
-        }
-
-        if(!(splitAfterIndex<listToSplit->count-1)){
-            if(splitAfterIndex==listToSplit->count-1){
-                result->push_back(listToSplit);
-                result->push_back(std::shared_ptr<SortedLinkedList<K>>(new SortedLinkedList<K>()));
-                return result;
+    template<typename R>
+    void _wait(R ready){
+        for(int i=0;i<SPINS;i++){
+            if(ready()){
+                return;
             }
-            throw "${Const->BalancedTrees}: splitAtIndex must be less than listToSplit->count-1";
         }
-        auto origSize = listToSplit->count;
-
-        //LinkedNode<K> minOfLeftPortion=listToSplit->min;//not required
-        auto maxOfRightPortion=listToSplit->max;
-
-        auto minOfRightPortion=listToSplit->min;
-        for(int i=0;i<=splitAfterIndex;i++){
-            if(minOfRightPortion){
-                minOfRightPortion=minOfRightPortion->rightSibling;
-            }
+        _ParkingLot& lot=_lot(this);
+        std::unique_lock<std::mutex> lock(lot.mutex);
+        this->parked++;
+        while(!ready()){
+            lot.wake.wait(lock);
         }
+        this->parked--;
+    }
 
-        std::shared_ptr<LinkedNode<K>> maxOfLeftPortion;
-        if(minOfRightPortion){
-            maxOfLeftPortion = minOfRightPortion->leftSibling;
+    void _wake(){
+        if(this->parked.load()>0){
+            _ParkingLot& lot=_lot(this);
+            std::lock_guard<std::mutex> lock(lot.mutex);
+            //latches which share the lot check their own state again and park once more
+            lot.wake.notify_all();
         }
+    }
+};
 
-        //lets split
-        if(maxOfLeftPortion)
-            maxOfLeftPortion->rightSibling=NULL;
+/**
+Holds a latch till its destroyed or unlocked. A default constructed guard holds nothing till it adopts a latch.
+Guards can be moved, so a descent can keep the latches of its path in a vector.
+*/
+struct BPlusLatchGuard{
+    BPlusLatch* latch=NULL;
+    bool shared=true;
 
-        if(minOfRightPortion)
-            minOfRightPortion->leftSibling=NULL;
+    BPlusLatchGuard(){
 
-        //setting up left
-        listToSplit->count=splitAfterIndex+1;
-        listToSplit->max=maxOfLeftPortion;
+    }
 
-        //setting up right portion;
-        std::shared_ptr<SortedLinkedList<K>> rightPortion(new SortedLinkedList<K>());
-        rightPortion->min=minOfRightPortion;
-        rightPortion->max=maxOfRightPortion;
-        rightPortion->count=origSize-splitAfterIndex-1;
+    BPlusLatchGuard(BPlusLatch& latch,bool shared){
+        this->lock(latch, shared);
+    }
 
-        result->push_back(listToSplit);
-        result->push_back(rightPortion);
-        return result;
+    BPlusLatchGuard(BPlusLatchGuard&& other) noexcept:latch(other.latch),shared(other.shared){
+        other.latch=NULL;
     }
 
-    /*
-    merges rightlist into leftlist, rightlist keys are always bigger than leftlist, no check is performed inside.
-    Its something user must remember, if they want to preserve the sorted list sorting
-    return leftlist,after merge
-    */
-    template<typename K>
-    static std::shared_ptr<SortedLinkedList<K>> mergeSplittedRightIntoLeft( std::shared_ptr<SortedLinkedList<K>> leftlist,std::shared_ptr<SortedLinkedList<K>> rightlist){
-        if(rightlist->count==0){
-            return leftlist;
-        }
-        auto maxOfRight = rightlist->max;
-        auto countOfRight = rightlist->count;
+    BPlusLatchGuard(const BPlusLatchGuard&)=delete;
+    BPlusLatchGuard& operator=(const BPlusLatchGuard&)=delete;
 
-        //merging
-        if(leftlist->max)
-            leftlist->max->rightSibling=rightlist->min;
-        if(rightlist->min)
-            rightlist->min->leftSibling=leftlist->max;
+    ~BPlusLatchGuard(){
+        this->unlock();
+    }
 
-        leftlist->max= maxOfRight;
-        leftlist->count=leftlist->count+countOfRight;
+    void lock(BPlusLatch& latch,bool shared){
+        this->unlock();
+        shared?latch.lockShared():latch.lock();
+        this->latch=&latch;
+        this->shared=shared;
+    }
 
-        return leftlist;
+    ///latches next before letting go of the held latch, for hand-over-hand moves down the tree or along the leaf chain
+    void handOver(BPlusLatch& next){
+        this->shared?next.lockShared():next.lock();
+        this->unlock();
+        this->latch=&next;
     }
 
-    /*
-    merges rightlist into leftlist, rightlist keys are always bigger than leftlist, no check is performed inside.
-    Its something user must remember, if they want to preserve the sorted list sorting
-    return rightlist,after merge
-    */
-    template<typename K>
-    static std::shared_ptr<SortedLinkedList<K>> mergeSplittedLeftIntoRight(std::shared_ptr<SortedLinkedList<K>> leftlist,std::shared_ptr<SortedLinkedList<K>>  rightlist){
-        if(leftlist->count==0){
-            return rightlist;
+    ///same as handOver on a shared guard, but only when next can be latched at once, returns whether it moved
+    bool tryHandOver(BPlusLatch& next){
+        if(!next.tryLockShared()){
+            return false;
         }
-        auto minOfLeft = leftlist->min;
-        auto countOfLeft = leftlist->count;
-
-        //merging
-        if(leftlist->max)
-            leftlist->max->rightSibling=rightlist->min;
-        if(rightlist->min)
-            rightlist->min->leftSibling=leftlist->max;
-
-        rightlist->min= minOfLeft;
-        rightlist->count=rightlist->count+countOfLeft;
-
-        return rightlist;
+        this->unlock();
+        this->latch=&next;
+        this->shared=true;
+        return true;
     }
 
-
-    /*
-    If search type is LesserThanOrEqual, than if no equal or less than is found , it will simply end stream.
-    if search type is GreaterThanOrEqual, than if no equal or greater than is found than it will simply end the stream.
-    It will Stream nodes until nodes are smaller than or equals to till key. If till key is undefined , then it will stream all the right-siblings till the end
-    */
-    template<typename K>
-    static  std::shared_ptr<std::vector<std::shared_ptr<K>>> searchTillStream( std::shared_ptr<SortedLinkedList<K>> list, ComparatorFunction<K> compare, std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL,bool yieldIndividualDuplicates=false){
-        std::shared_ptr<std::vector<std::shared_ptr<K>>> result(new std::vector<std::shared_ptr<K>>());
-        
-        std::shared_ptr<LinkedNode<K>> currentNode = !startKey?list->min:LL::search(list, compare, startKey, SearchType::GreaterThanOrEqualsTo);
-        std::shared_ptr<LinkedNode<K>> endNode = !endKey?list->max:LL::search(list, compare, endKey,SearchType::LesserThanOrEqualsTo);
-
-        if(endNode){
-            while(currentNode){
-                auto cr = compare(endNode->key,currentNode->key);
-                if(cr>=0){
-                    std::shared_ptr<LinkedNode<K>> res= currentNode;
-                    currentNode=currentNode->rightSibling;
-                    if(yieldIndividualDuplicates){
-                        auto countOfDuplicates=res->duplicate_count+1;
-                        for(int i=0;i<countOfDuplicates;i++){
-                            result->push_back(res->key);
-                        }
-                    }else{
-                        result->push_back(res->key);
-                    }
-                }else{
-                    currentNode=NULL;
-                }
-            }
+    ///keeps holding the latch, but shared
+    void downgrade(){
+        if(this->latch && !this->shared){
+            this->latch->downgrade();
+            this->shared=true;
         }
-
-        return result;
     }
 
-    template<typename K>
-    static  std::shared_ptr<std::vector<std::shared_ptr<K>>> find( std::shared_ptr<SortedLinkedList<K>> list, ComparatorFunction<K> queryCompare,bool yieldIndividualDuplicates=false){
-        std::shared_ptr<std::vector<std::shared_ptr<K>>> result(new std::vector<std::shared_ptr<K>>());
-        auto cn = list->min;
-        while(cn){
-            if(queryCompare(cn->key,cn->key)==0){
-                result->push_back(cn->key);
-            }
-            cn=cn->rightSibling;
+    void unlock(){
+        if(this->latch){
+            this->shared?this->latch->unlockShared():this->latch->unlock();
+            this->latch=NULL;
         }
-        return result;
     }
-}
+};
 
-namespace BB {
-    template<typename K,typename V>
-    
-    /**
-    Key Value pair
-    */
-    struct BB_KV_P{
-        std::shared_ptr<K> key;
-        std::shared_ptr<V> value;
-        BB_KV_P(std::shared_ptr<K> key,std::shared_ptr<V> value):key(key),value(value){
+template<typename K,typename V=std::shared_ptr<void>,typename Compare=ThreeWayCompare<K>>
+struct BPlusTree;
 
+/**
+Tree scoped allocator for nodes and their arrays.
+Blocks are carved out of large chunks, freed blocks are recycled through free lists kept per (aligned) block size,
+and chunks are only given back all at once when the pool is destroyed.
+Every thread keeps free lists of its own for each pool it uses (_ThreadCache), so allocating and freeing only takes mutex
+when those run empty or grow past CACHE_BLOCKS, and then moves blocks in batches.
+*/
+struct SlabPool : std::enable_shared_from_this<SlabPool>{
+    static const size_t ALIGNMENT=alignof(std::max_align_t);
+    ///most blocks of a size a thread keeps for itself, half of them go back to the pool once there are more
+    static const size_t CACHE_BLOCKS=32;
+    ///blocks a thread takes at once when its own list is empty
+    static const size_t REFILL_BLOCKS=8;
+
+    ///singly linked list of free blocks, linked through their first word
+    struct _FreeList{
+        void* head=NULL;
+        size_t count=0;
+
+        void push(void* block){
+            *static_cast<void**>(block)=this->head;
+            this->head=block;
+            this->count++;
         }
-    };
-
-    enum BalanceCase{
-        DO_NOTHING,
-
-        REMOVE_ROOT,
-
-        SPLIT,
-
-        DISTRIBUTE_RIGHT_INTO_NODE,
-        DISTRIBUTE_LEFT_INTO_NODE,
 
-        MERGE_RIGHT_INTO_NODE,
-        MERGE_NODE_INTO_LEFT,
+        void* pop(){
+            void* block=this->head;
+            this->head=*static_cast<void**>(block);
+            this->count--;
+            return block;
+        }
     };
 
-    enum SOURCE_IS{
-    LEFT_SIBLING, RIGHT_SIBLING
+    ///free lists one thread keeps for one pool, pools are told apart by id as a freed pool's address can be reused
+    struct _Cache{
+        uint64_t id;
+        std::weak_ptr<SlabPool> pool;
+        std::vector<_FreeList> lists;
     };
 
+    ///caches of the calling thread, handed back to their pools when it exits
+    struct _ThreadCache{
+        std::vector<_Cache> caches;
+        bool* exited;
 
-    template<typename K>
-    static BalanceCase _determineBalancingCase( std::shared_ptr<BPlusTree<K>> tree , std::shared_ptr<BPlusNode<K>> effectedNode ){
-        auto node_size=effectedNode->size();
-        auto half_capacity = tree->half_capacity;
-
-        if(half_capacity<=node_size && node_size<=tree->max_node_size){
-            return BalanceCase::DO_NOTHING;
-        }else{
-            if(node_size>tree->max_node_size){
-            return BalanceCase::SPLIT;
-            }else{
-            //this node size < half capacity
+        _ThreadCache(bool* exited):exited(exited){
 
-            //we give prereference too distribution first, that too to right node for distribution
-            auto left_sibling_size = 0;
-            if(effectedNode->leftSibling.lock()){
-                left_sibling_size=effectedNode->leftSibling.lock()->size();
-            }
-            auto right_sibling_size = 0;
-            if(effectedNode->rightSibling.lock()){
-                right_sibling_size=effectedNode->rightSibling.lock()->size();
-            }
+        }
 
-            //case of root node
-            if(left_sibling_size==0 && right_sibling_size==0){
-                if(effectedNode->size()==0){
-                return BalanceCase::REMOVE_ROOT;
-                }else{
-                return BalanceCase::DO_NOTHING;
+        ~_ThreadCache(){
+            for(_Cache& cache : this->caches){
+                if(auto pool=cache.pool.lock()){
+                    pool->_flush(cache);
                 }
             }
+            *this->exited=true;
+        }
+    };
 
-            if(right_sibling_size>half_capacity){
-                return BalanceCase::DISTRIBUTE_RIGHT_INTO_NODE;
-            }
+    uint64_t id;
+    size_t chunk_size;
+    std::vector<void*> chunks;
+    char* bump=NULL;
+    size_t bump_left=0;
 
-            if(left_sibling_size>half_capacity){
-                return BalanceCase::DISTRIBUTE_LEFT_INTO_NODE;
-            }
+    ///free_lists[i] holds the free blocks of i*ALIGNMENT bytes no thread has cached
+    std::vector<_FreeList> free_lists;
 
-            if(right_sibling_size>0){
-                return BalanceCase::MERGE_RIGHT_INTO_NODE;
-            }
+    uint64_t bytes_reserved=0;
+    std::atomic<uint64_t> bytes_in_use{0};
 
-            if(left_sibling_size>0){
-                return BalanceCase::MERGE_NODE_INTO_LEFT;
-            }
+    ///guards chunks, bump and free_lists, nodes can be let go by readers while a writer allocates
+    std::mutex mutex;
+
+    SlabPool(size_t chunk_size=1<<20):id(_nextId()),chunk_size(chunk_size){
 
-            throw "${Const.BalancedTrees}: NO BALANCE CASE found for: $effectedNode";
-            }
-        }
     }
 
-    template<typename K>
-    static std::shared_ptr<BPlusCell<K>> find_effective_parent_cell(std::shared_ptr<BPlusNode<K> >effectiveNode){
-        auto effective_parent_cell=effectiveNode->parent_cell;
-        if(!effective_parent_cell.lock()){
-        auto currentNode= effectiveNode;
-        while(currentNode){
-            effective_parent_cell = currentNode->parent_cell;
-            if(effective_parent_cell.lock()){
-            return effective_parent_cell.lock();
-            }
-            currentNode=currentNode->parent_node.lock();
-        }
+    SlabPool(const SlabPool&)=delete;
+    SlabPool& operator=(const SlabPool&)=delete;
 
-        if(!effective_parent_cell.lock() && effectiveNode->parent_node.lock() && effectiveNode->parent_node.lock()->cellsList && effectiveNode->parent_node.lock()->cellsList->min){
-            return effectiveNode->parent_node.lock()->cellsList->min->key;
-        }else{
-            throw "Not allowed condition";
-        }
-        }else{
-            return effective_parent_cell.lock();
+    ~SlabPool(){
+        //blocks other threads still cache for this pool are dropped with their cache, never read
+        for(void* chunk : this->chunks){
+            ::operator delete(chunk);
         }
     }
 
-    template<typename K>
-    static std::shared_ptr<BPlusNode<K>> split(std::shared_ptr<BPlusTree<K>> tree , std::shared_ptr<BPlusNode<K>> effectedNode ,ComparatorFunction<BPlusCell<K>> customCompare) {
-        //its assumed that effected node size is greater than node_size, as that check must have been done before calling this
-
-        //Algorithm:
-        //Splitting cells list: left node has more items, then right
-        //creating new right node and setting its relationships
-        //if effected node is root, than create a new root and set it as parent of these two splitted nodes
-        //creating parent cell for new right node from maximum value from left node and push parent cell to parent node
-        //if effected node is leaf check if it is also right most child, then we will need set that too for tree as new Right Node
-        //if its not leaf, then remove the min from right node
-
-        //Splitting cellslist
-        auto splitAfterIndex=tree->half_capacity;
-        auto splits= LL::splitAt<BPlusCell<K>>(effectedNode->cellsList, splitAfterIndex);
-
-        auto newRightList = (*splits)[1];
-        auto newLeftList= effectedNode->cellsList;
-
-
-        //creating new right node and setting its relationships
-        //sets parent and child relation during construction itself
-        auto splitRightNode = createBPlusNode<K>(tree, effectedNode->isLeaf, effectedNode->parent_node.lock(), newLeftList->max->key->right_child_node);
+    static uint64_t _nextId(){
+        static std::atomic<uint64_t> next{1};
+        return next++;
+    }
 
-        //setting up new right node
-        {
-        //setting cellsList
-        setAsCellsList(splitRightNode,newRightList);
+    static size_t _rounded(size_t size){
+        return size==0?ALIGNMENT:(size+ALIGNMENT-1)/ALIGNMENT*ALIGNMENT;
+    }
 
-        //setting up sibling relationships
-            {
-                splitRightNode->rightSibling = effectedNode->rightSibling;
-                if(effectedNode->rightSibling.lock()){
-                    effectedNode->rightSibling.lock()->leftSibling.lock() = splitRightNode;
-                }
-                
-                splitRightNode->leftSibling = effectedNode;
-                effectedNode->rightSibling = splitRightNode;
+    ///free list of the calling thread for blocks of block_class of this pool, NULL once the thread is exiting and its caches are gone
+    _FreeList* _cachedList(size_t block_class){
+        //a flag without a destructor stays readable after the cache is destroyed, nodes may still be freed after that
+        static thread_local bool exited=false;
+        if(exited){
+            return NULL;
+        }
+        static thread_local _ThreadCache thread(&exited);
+        std::vector<_Cache>& caches=thread.caches;
+        _Cache* cache=NULL;
+        for(_Cache& candidate : caches){
+            if(candidate.id==this->id){
+                cache=&candidate;
+                break;
             }
         }
-
-        //if effected node is root, than create a new root
-        if (effectedNode->isRoot()) {
-            auto newRootNode = createBPlusNode<K>(tree, false, NULL, effectedNode);
-            tree->root_node = newRootNode;
+        if(!cache){
+            //caches of pools which are gone are dropped, their blocks went with the pool
+            caches.erase(std::remove_if(caches.begin(), caches.end(), [](const _Cache& candidate){
+                return candidate.pool.expired();
+            }), caches.end());
+            caches.push_back(_Cache{this->id, this->shared_from_this(), std::vector<_FreeList>()});
+            cache=&caches.back();
         }
+        if(block_class>=cache->lists.size()){
+            cache->lists.resize(block_class+1);
+        }
+        return &cache->lists[block_class];
+    }
 
-        //definitely have a parent node
-        auto parent_node = effectedNode->parent_node;
-        // assert(parent_node!=undefined);
-        splitRightNode->parent_node=parent_node;//this case is required to tackle root node split
-
-        //creating parent cell for new right node from maximum value from left node and push parent cell to parent node
-        {
-        auto parentCellForNewRightNode=createBPlusCell<K>(newLeftList->max->key->key,splitRightNode,parent_node.lock());
-        LL::insert(parent_node.lock()->cellsList, customCompare, parentCellForNewRightNode);
+    void* allocate(size_t size){
+        size_t rounded=_rounded(size);
+        this->bytes_in_use+=rounded;
+        //blocks which would waste most of a chunk are not pooled
+        if(rounded>this->chunk_size/4){
+            return ::operator new(rounded);
         }
 
-        //if effected node is leaf
-        if (effectedNode->isLeaf) {
-        //and also right most child, then we will need set that too for tree as new Right Node
-        if(effectedNode == tree->right_most_node){
-            tree->right_most_node = splitRightNode;
+        size_t block_class=rounded/ALIGNMENT;
+        _FreeList uncached;
+        _FreeList* list=this->_cachedList(block_class);
+        if(!list){
+            list=&uncached;
         }
-        } else {
-        //if its not leaf, then remove the max from left node, its right child node is already taken care of above
-        //see splitRightNode creation we pass it as left most child to right node
-        LL::deleteNode(newLeftList, customCompare,createBPlusCell<K>(newLeftList->max->key->key, NULL,NULL));
+        if(list->count==0){
+            this->_refill(*list, block_class);
         }
-
-        return parent_node.lock();
+        void* block=list->pop();
+        if(uncached.count>0){
+            std::lock_guard<std::mutex> lock(this->mutex);
+            while(uncached.count>0){
+                this->_freeList(block_class).push(uncached.pop());
+            }
+        }
+        return block;
+    }
+
+    void deallocate(void* block,size_t size){
+        size_t rounded=_rounded(size);
+        this->bytes_in_use-=rounded;
+        if(rounded>this->chunk_size/4){
+            ::operator delete(block);
+            return;
+        }
+        size_t block_class=rounded/ALIGNMENT;
+        _FreeList* list=this->_cachedList(block_class);
+        if(!list){
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->_freeList(block_class).push(block);
+            return;
+        }
+        list->push(block);
+        if(list->count>CACHE_BLOCKS){
+            std::lock_guard<std::mutex> lock(this->mutex);
+            while(list->count>CACHE_BLOCKS/2){
+                this->_freeList(block_class).push(list->pop());
+            }
+        }
+    }
+
+    ///moves up to REFILL_BLOCKS blocks of block_class into list, carving new ones when the pool has none free
+    void _refill(_FreeList& list,size_t block_class){
+        size_t rounded=block_class*ALIGNMENT;
+        std::lock_guard<std::mutex> lock(this->mutex);
+        _FreeList& free=this->_freeList(block_class);
+        while(list.count<REFILL_BLOCKS && free.count>0){
+            list.push(free.pop());
+        }
+        if(list.count>0){
+            return;
+        }
+        if(this->bump_left<rounded){
+            //tail of the current chunk is kept as a free block of its own size
+            if(this->bump_left>0){
+                this->_freeList(this->bump_left/ALIGNMENT).push(this->bump);
+            }
+            this->bump=static_cast<char*>(::operator new(this->chunk_size));
+            this->bump_left=this->chunk_size;
+            this->bytes_reserved+=this->chunk_size;
+            this->chunks.push_back(this->bump);
+        }
+        while(list.count<REFILL_BLOCKS && this->bump_left>=rounded){
+            list.push(this->bump);
+            this->bump+=rounded;
+            this->bump_left-=rounded;
+        }
+    }
+
+    _FreeList& _freeList(size_t block_class){
+        if(block_class>=this->free_lists.size()){
+            this->free_lists.resize(block_class+1);
+        }
+        return this->free_lists[block_class];
+    }
+
+    ///hands every block of cache back to the pool
+    void _flush(_Cache& cache){
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for(size_t block_class=0;block_class<cache.lists.size();block_class++){
+            _FreeList& list=cache.lists[block_class];
+            while(list.count>0){
+                this->_freeList(block_class).push(list.pop());
+            }
+        }
+    }
+};
+
+/**
+std allocator handing out blocks of a SlabPool. It shares ownership of the pool, so a node that outlives its tree still has somewhere to hand its blocks back to.
+*/
+template<typename T>
+struct SlabAllocator{
+    typedef T value_type;
+
+    std::shared_ptr<SlabPool> pool;
+
+    SlabAllocator(const std::shared_ptr<SlabPool>& pool):pool(pool){
+
+    }
+
+    template<typename U>
+    SlabAllocator(const SlabAllocator<U>& other):pool(other.pool){
+
+    }
+
+    T* allocate(size_t n){
+        static_assert(alignof(T)<=SlabPool::ALIGNMENT, "SlabPool can not align T");
+        return static_cast<T*>(this->pool->allocate(n*sizeof(T)));
+    }
+
+    void deallocate(T* p,size_t n){
+        this->pool->deallocate(p, n*sizeof(T));
+    }
+};
+
+template<typename T,typename U>
+static bool operator==(const SlabAllocator<T>& a,const SlabAllocator<U>& b){
+    return a.pool==b.pool;
+}
+
+template<typename T,typename U>
+static bool operator!=(const SlabAllocator<T>& a,const SlabAllocator<U>& b){
+    return a.pool!=b.pool;
+}
+
+template<typename T>
+using SlabVector = std::vector<T,SlabAllocator<T>>;
+
+/**
+View of a key (and for leaves its value) as seen by comparators.
+Nodes do not store cells, they are built on the fly when a ComparatorFunction<BPlusCell<K>> has to be called.
+*/
+template<typename K>
+struct BPlusCell{
+    std::shared_ptr<K> key;
+    std::shared_ptr<void> value;
+};
+
+template<typename K>
+static std::shared_ptr<BPlusCell<K>> createBPlusCell(std::shared_ptr<K> key,std::shared_ptr<void> value=NULL){
+    std::shared_ptr<BPlusCell<K>> t(new BPlusCell<K>);
+    t->key=key;
+    t->value=value;
+    return t;
+}
+
+/**
+Comparator policy which calls a ComparatorFunction over cells, for trees which want to keep comparing through std::function.
+Cells are built on the stack and passed as borrowed pointers, so a comparison allocates nothing and does no reference counting,
+but it still is an indirect call which can not be inlined.
+*/
+template<typename K>
+struct CellComparatorAdapter{
+    ComparatorFunction<BPlusCell<K>> compare;
+
+    CellComparatorAdapter(ComparatorFunction<BPlusCell<K>> compare):compare(std::move(compare)){
+
+    }
+
+    int operator()(const K& k1,const K& k2) const{
+        BPlusCell<K> c1;
+        BPlusCell<K> c2;
+        c1.key=borrowPointer(k1);
+        c2.key=borrowPointer(k2);
+        BTREE_STATS_COUNT(comparisons, 1);
+        return compare(borrowPointer(c1),borrowPointer(c2));
+    }
+};
+
+/**
+Comparator policy which calls a ComparatorFunction over keys.
+*/
+template<typename K>
+struct KeyComparatorAdapter{
+    ComparatorFunction<K> compare;
+
+    KeyComparatorAdapter(ComparatorFunction<K> compare):compare(std::move(compare)){
+
+    }
+
+    int operator()(const K& k1,const K& k2) const{
+        BTREE_STATS_COUNT(comparisons, 1);
+        return compare(borrowPointer(k1),borrowPointer(k2));
+    }
+};
+
+/**
+Number of entries below a child of an internal node.
+entries counts duplicates (like tree size does), keys counts distinct keys (like range scans do).
+Fields are atomic as writers which do not restructure the tree apply their counts concurrently, see BPlusTree::latch.
+*/
+struct BPlusSubtreeCount{
+    std::atomic<uint64_t> entries;
+    std::atomic<uint64_t> keys;
+
+    BPlusSubtreeCount(uint64_t entries=0,uint64_t keys=0):entries(entries),keys(keys){
+
+    }
+
+    BPlusSubtreeCount(const BPlusSubtreeCount& other):entries(other.entries.load(std::memory_order_relaxed)),keys(other.keys.load(std::memory_order_relaxed)){
+
+    }
+
+    BPlusSubtreeCount& operator=(const BPlusSubtreeCount& other){
+        this->entries.store(other.entries.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        this->keys.store(other.keys.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    BPlusSubtreeCount& operator+=(const BPlusSubtreeCount& other){
+        this->entries.fetch_add(other.entries.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        this->keys.fetch_add(other.keys.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    BPlusSubtreeCount& operator-=(const BPlusSubtreeCount& other){
+        this->entries.fetch_sub(other.entries.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        this->keys.fetch_sub(other.keys.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+};
+
+/**
+V is stored by value in leaves, BPlusTree<K> keeps the untyped std::shared_ptr<void> values.
+*/
+template<typename K,typename V>
+struct BPlusNode{
+    std::weak_ptr<BPlusNode<K,V>> rightSibling;
+    std::weak_ptr<BPlusNode<K,V>> leftSibling;
+
+    ///sorted keys of this node, kept contiguous so they can be binary searched
+    SlabVector<K> keys;
+
+    ///leaf only: duplicate_counts[i] is the number of extra inserts collapsed into keys[i]
+    SlabVector<int> duplicate_counts;
+
+    ///leaf only: values[i] is the value of keys[i]
+    SlabVector<V> values;
+
+    ///internal only: children[i] holds keys lesser than or equals to keys[i], children[size()] holds keys greater than the max key
+    SlabVector<std::shared_ptr<BPlusNode<K,V>>> children;
+
+    ///internal only: child_counts[i] is the number of entries below children[i]
+    SlabVector<BPlusSubtreeCount> child_counts;
+
+    bool isLeaf;
+
+    ///guards the arrays and sibling links of this node, descents latch nodes hand-over-hand from the root down, see BPlusTree::latch
+    BPlusLatch latch;
+
+    ///BPlusTree::version this node was created in, older nodes may be shared with snapshots
+    uint64_t version=0;
+
+    BPlusNode(const std::shared_ptr<SlabPool>& pool):keys(SlabAllocator<K>(pool)),duplicate_counts(SlabAllocator<int>(pool)),values(SlabAllocator<V>(pool)),children(SlabAllocator<std::shared_ptr<BPlusNode<K,V>>>(pool)),child_counts(SlabAllocator<BPlusSubtreeCount>(pool)){
+
+    }
+
+    int size(){
+        return (int)this->keys.size();
+    }
+
+    ///number of entries below this node, summed over its own arrays
+    BPlusSubtreeCount subtreeCount(){
+        uint64_t entries=0;
+        uint64_t keys=0;
+        if(this->isLeaf){
+            keys=this->keys.size();
+            entries=keys;
+            for(int d : this->duplicate_counts){
+                entries+=d;
+            }
+        }else{
+            for(const BPlusSubtreeCount& c : this->child_counts){
+                entries+=c.entries.load(std::memory_order_relaxed);
+                keys+=c.keys.load(std::memory_order_relaxed);
+            }
+        }
+        return BPlusSubtreeCount(entries, keys);
+    }
+};
+
+template<typename K,typename V,typename Compare>
+static std::shared_ptr<BPlusNode<K,V>> createBPlusNode(std::shared_ptr<BPlusTree<K,V,Compare>> parent_tree,bool isLeaf){
+    //node and its control block come out of one pool block
+    const std::shared_ptr<SlabPool>& pool=parent_tree->pool;
+    std::shared_ptr<BPlusNode<K,V>> t=std::allocate_shared<BPlusNode<K,V>>(SlabAllocator<BPlusNode<K,V>>(pool), pool);
+    t->isLeaf=isLeaf;
+    t->version=parent_tree->version;
+
+    //one more than max_node_size, as a node is allowed to overflow by one before its split
+    //BB::insertBatch and multi-piece splits can fill a leaf past this first, its arrays then reallocate through the same SlabAllocator:
+    //the larger block comes from the free list of its own size (or operator new past a quarter chunk) and goes back there when freed
+    t->keys.reserve(parent_tree->max_node_size+1);
+    if(isLeaf){
+        t->duplicate_counts.reserve(parent_tree->max_node_size+1);
+        t->values.reserve(parent_tree->max_node_size+1);
+    }else{
+        t->children.reserve(parent_tree->max_node_size+2);
+        t->child_counts.reserve(parent_tree->max_node_size+2);
+    }
+    return t;
+}
+
+/**
+Compare is the comparator policy used by the BB functions which are not handed a comparator,
+its a type so that comparisons can be inlined. Use CellComparatorAdapter to keep comparing with a ComparatorFunction.
+*/
+template<typename K,typename V,typename Compare>
+struct BPlusTree{
+    typedef K key_type;
+    typedef V value_type;
+
+    ///pool new nodes are allocated from, every node keeps the pool it came from alive
+    std::shared_ptr<SlabPool> pool;
+    ///pools of trees joined into this one (BB::joinTrees), whose nodes it now holds
+    std::vector<std::shared_ptr<SlabPool>> joined_pools;
+
+    ///root_node and left_most_node change under root_latch held exclusively
+    std::shared_ptr<BPlusNode<K,V>> left_most_node;
+    ///changed by whoever restructures the rightmost leaf, only read with the tree latched exclusively (and by cursors, see BPlusCursor)
+    std::shared_ptr<BPlusNode<K,V>> right_most_node;
+    std::shared_ptr<BPlusNode<K,V>> root_node;
+
+    std::atomic<uint64_t> size{0};
+    int half_capacity=0;
+    int max_node_size=4;
+
+    Compare compare;
+
+    /**
+    Point operations hold this latch shared and latch nodes (BPlusNode::latch) on their way down, each node before letting go of its parent.
+    Readers hold a single node at a time. A writer first descends holding the internal nodes of its path shared and its leaf exclusively,
+    and applies the child counts along the path with atomic adds. Should the leaf have to split or merge, it lets go and descends again latching
+    exclusively, and as soon as it reaches a safe node (one the write can not split or merge) the nodes above it are downgraded to shared:
+    those only take the counts, so writers in other subtrees and readers pass them while the structure change below goes on.
+    Restructuring nodes latch siblings left to right, and readers only move left along the leaf chain with a latch they can get at once,
+    so no two threads wait on each other.
+    Operations over the whole tree (batches, bulk loads, joins, splits, stats, snapshots) and writes which have to copy nodes shared with
+    a snapshot hold this latch exclusively instead, and do not latch nodes.
+    */
+    BPlusLatch latch;
+
+    ///latched before the root node by every descent, and held exclusively by writers while the root may change
+    BPlusLatch root_latch;
+
+    /**
+    Taking a snapshot starts a new version, nodes created in an older one are copied before they are written to while any snapshot is open.
+    A snapshot is a read only tree sharing the nodes of the version it was taken in, snapshot_of being the tree it was taken of.
+    */
+    uint64_t version=0;
+    std::atomic<int> open_snapshots{0};
+    std::shared_ptr<BPlusTree<K,V,Compare>> snapshot_of;
+
+#ifdef BTREE_STATS
+    BPlusCounters<std::atomic<uint64_t>> counters{};
+#endif
+
+    BPlusTree(int max_node_size,Compare compare=Compare()):pool(new SlabPool()),max_node_size(max_node_size),compare(std::move(compare)){
+    if(max_node_size%2==1){
+      throw "${Const.BalancedTrees} : node_size for tree must be an even number";
+    }
+    if(max_node_size<2){
+      throw "${Const.BalancedTrees} : node_size for tree must be atleast 2";
+    }
+    this->half_capacity= this->max_node_size/2;
+    }
+
+    ~BPlusTree(){
+        if(this->snapshot_of){
+            this->snapshot_of->open_snapshots--;
+        }
+    }
+};
+
+///fill of the nodes on one level of a tree, see BB::stats
+struct BPlusLevelStats{
+    uint64_t nodes=0;
+    uint64_t keys=0;
+    int min_fill=0;
+    int max_fill=0;
+    double avg_fill=0;
+    ///avg_fill relative to max_node_size
+    double avg_fill_ratio=0;
+    ///nodes holding fewer than half_capacity keys, which only the root and the rightmost leaf split by appends may do once deletes have rebalanced
+    uint64_t underfull_nodes=0;
+};
+
+/**
+Shape and memory of a tree, see BB::stats. Bytes are estimates of what the nodes hold:
+arrays are counted by the capacity reserved for them, and the heap memory keys and values own outside the tree only for std::string.
+*/
+struct BPlusTreeStats{
+    int height=0;
+    int max_node_size=0;
+    int half_capacity=0;
+    ///root first
+    std::vector<BPlusLevelStats> levels;
+    uint64_t leaf_chain_length=0;
+    uint64_t entries=0;
+    uint64_t distinct_keys=0;
+    ///entries beyond the first of their key
+    uint64_t duplicates=0;
+
+    uint64_t node_bytes=0;
+    uint64_t control_block_bytes=0;
+    uint64_t key_bytes=0;
+    uint64_t value_bytes=0;
+    uint64_t duplicate_count_bytes=0;
+    uint64_t child_bytes=0;
+    uint64_t key_heap_bytes=0;
+    uint64_t value_heap_bytes=0;
+
+    ///the node pool, which a tree shares with its snapshots
+    uint64_t pool_bytes_reserved=0;
+    uint64_t pool_bytes_in_use=0;
+
+    uint64_t totalBytes() const{
+        return this->node_bytes+this->control_block_bytes+this->key_bytes+this->value_bytes+this->duplicate_count_bytes+this->child_bytes
+            +this->key_heap_bytes+this->value_heap_bytes;
+    }
+};
+
+/**
+First page of a page file written by BB::writePages. Page ids are page indexes in the file, 0 (this page) stands for no page.
+Numbers are stored in the byte order of the machine which wrote the file.
+free_page heads a list of pages which paged deletes let go of, linked through their right_sibling, for the next new pages to reuse.
+*/
+struct BPlusPageHeader{
+    char magic[8];
+    uint32_t format_version;
+    uint32_t page_size;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t leaf_capacity;
+    uint32_t internal_capacity;
+    uint64_t page_count;
+    uint64_t root_page;
+    uint64_t left_most_page;
+    uint64_t right_most_page;
+    uint64_t size;
+    uint64_t free_page;
+};
+
+static const char BPLUS_PAGE_MAGIC[8]={'B','B','P','A','G','E','S','1'};
+static const uint32_t BPLUS_PAGE_FORMAT_VERSION=2;
+
+///start of every leaf and internal page, its arrays follow at the offsets of BPlusPageLayout
+struct BPlusPageNode{
+    uint32_t is_leaf;
+    uint32_t count;
+    uint64_t left_sibling;
+    uint64_t right_sibling;
+};
+
+///BPlusSubtreeCount as stored in internal pages
+struct BPlusPageCount{
+    uint64_t entries;
+    uint64_t keys;
+};
+
+/**
+Where the arrays of a page are, for a page size and key and value types.
+Leaf: keys, duplicate_counts (int32_t) and values, leaf_capacity of each.
+Internal: internal_capacity keys, then children page ids and child counts, internal_capacity+1 of each.
+*/
+template<typename K,typename V>
+struct BPlusPageLayout{
+    uint32_t page_size=0;
+    uint32_t leaf_capacity=0;
+    uint32_t internal_capacity=0;
+    size_t leaf_keys=0;
+    size_t leaf_duplicate_counts=0;
+    size_t leaf_values=0;
+    size_t internal_keys=0;
+    size_t internal_children=0;
+    size_t internal_counts=0;
+
+    static size_t alignUp(size_t offset,size_t alignment){
+        return (offset+alignment-1)/alignment*alignment;
+    }
+
+    BPlusPageLayout(uint32_t page_size):page_size(page_size){
+        if(page_size%alignof(std::max_align_t)!=0){
+            throw "${Const.BalancedTrees}: page_size must be a multiple of max alignment";
+        }
+        size_t header=sizeof(BPlusPageNode);
+        size_t capacity=(page_size-header)/(sizeof(K)+sizeof(int32_t)+sizeof(V));
+        for(;capacity>0;capacity--){
+            this->leaf_keys=alignUp(header, alignof(K));
+            this->leaf_duplicate_counts=alignUp(this->leaf_keys+capacity*sizeof(K), alignof(int32_t));
+            this->leaf_values=alignUp(this->leaf_duplicate_counts+capacity*sizeof(int32_t), alignof(V));
+            if(this->leaf_values+capacity*sizeof(V)<=page_size){
+                break;
+            }
+        }
+        this->leaf_capacity=(uint32_t)capacity;
+
+        capacity=(page_size-header)/(sizeof(K)+sizeof(uint64_t)+sizeof(BPlusPageCount));
+        for(;capacity>0;capacity--){
+            this->internal_keys=alignUp(header, alignof(K));
+            this->internal_children=alignUp(this->internal_keys+capacity*sizeof(K), alignof(uint64_t));
+            this->internal_counts=alignUp(this->internal_children+(capacity+1)*sizeof(uint64_t), alignof(BPlusPageCount));
+            if(this->internal_counts+(capacity+1)*sizeof(BPlusPageCount)<=page_size){
+                break;
+            }
+        }
+        this->internal_capacity=(uint32_t)capacity;
+
+        if(this->leaf_capacity<2 || this->internal_capacity<2){
+            throw "${Const.BalancedTrees}: page_size is too small for the key and value types";
+        }
+    }
+
+    const K* keys(const BPlusPageNode* page) const{
+        return (const K*)((const char*)page+(page->is_leaf?this->leaf_keys:this->internal_keys));
+    }
+
+    K* keys(BPlusPageNode* page) const{
+        return (K*)((char*)page+(page->is_leaf?this->leaf_keys:this->internal_keys));
+    }
+
+    const int32_t* duplicateCounts(const BPlusPageNode* page) const{
+        return (const int32_t*)((const char*)page+this->leaf_duplicate_counts);
+    }
+
+    int32_t* duplicateCounts(BPlusPageNode* page) const{
+        return (int32_t*)((char*)page+this->leaf_duplicate_counts);
+    }
+
+    const V* values(const BPlusPageNode* page) const{
+        return (const V*)((const char*)page+this->leaf_values);
+    }
+
+    V* values(BPlusPageNode* page) const{
+        return (V*)((char*)page+this->leaf_values);
+    }
+
+    const uint64_t* children(const BPlusPageNode* page) const{
+        return (const uint64_t*)((const char*)page+this->internal_children);
+    }
+
+    uint64_t* children(BPlusPageNode* page) const{
+        return (uint64_t*)((char*)page+this->internal_children);
+    }
+
+    const BPlusPageCount* childCounts(const BPlusPageNode* page) const{
+        return (const BPlusPageCount*)((const char*)page+this->internal_counts);
+    }
+
+    BPlusPageCount* childCounts(BPlusPageNode* page) const{
+        return (BPlusPageCount*)((char*)page+this->internal_counts);
+    }
+};
+
+/**
+Read only tree served straight from a page file mapped into memory, see BB::openPages.
+Opening maps the file without reading it, pages are brought in by the OS as descents touch them,
+and as the mapping is shared, processes which open the same file share its page cache.
+K and V are read in place, so they must be trivially copyable types.
+*/
+template<typename K,typename V,typename Compare=ThreeWayCompare<K>>
+struct BPlusMappedTree{
+    typedef K key_type;
+    typedef V value_type;
+
+    const char* base=NULL;
+    size_t length=0;
+    BPlusPageHeader header;
+    BPlusPageLayout<K,V> layout;
+    Compare compare;
+
+    BPlusMappedTree(uint32_t page_size,Compare compare=Compare()):layout(page_size),compare(std::move(compare)){
+
+    }
+
+    BPlusMappedTree(const BPlusMappedTree&)=delete;
+    BPlusMappedTree& operator=(const BPlusMappedTree&)=delete;
+
+    ~BPlusMappedTree(){
+        if(this->base){
+            munmap((void*)this->base, this->length);
+        }
+    }
+
+    const BPlusPageNode* page(uint64_t id) const{
+        return (const BPlusPageNode*)(this->base+id*this->header.page_size);
+    }
+
+    ///mapped pages need no pinning, these let the page search cores serve mapped and paged trees alike
+    const BPlusPageNode* pinPage(uint64_t id){
+        return this->page(id);
+    }
+
+    void unpinPage(uint64_t){
+
+    }
+};
+
+enum BPlusEvictionPolicy{
+    CLOCK_EVICTION,
+    LRU_EVICTION
+};
+
+/**
+Fixed number of page sized frames caching the pages of a page file.
+A page stays in its frame while pinned. Unpinned frames are reused for other pages, picked by CLOCK (second chance)
+or least recently used, and dirty ones are written back first. Page 0 holds the file header and is never cached.
+*/
+struct BPlusBufferPool{
+    struct Frame{
+        uint64_t page=0;
+        int pins=0;
+        bool dirty=false;
+        bool referenced=false;
+        uint64_t last_used=0;
+    };
+
+    int fd;
+    uint32_t page_size;
+    BPlusEvictionPolicy policy;
+    std::vector<std::max_align_t> memory;
+    std::vector<Frame> frames;
+    std::unordered_map<uint64_t,size_t> page_table;
+    size_t hand=0;
+    uint64_t tick=0;
+    uint64_t faults=0;
+    uint64_t evictions=0;
+    std::mutex mutex;
+
+    BPlusBufferPool(int fd,uint32_t page_size,size_t frame_count,BPlusEvictionPolicy policy):fd(fd),page_size(page_size),policy(policy),
+        memory(frame_count*page_size/sizeof(std::max_align_t)),frames(frame_count){
+
+    }
+
+    BPlusBufferPool(const BPlusBufferPool&)=delete;
+    BPlusBufferPool& operator=(const BPlusBufferPool&)=delete;
+
+    char* data(size_t index){
+        return (char*)this->memory.data()+index*this->page_size;
+    }
+
+    ///returns page pinned in its frame, read from the file unless fresh (a page just added to the file), which gets a zeroed frame
+    char* pin(uint64_t page,bool fresh=false){
+        std::lock_guard<std::mutex> lock(this->mutex);
+        size_t index;
+        auto found=this->page_table.find(page);
+        if(found!=this->page_table.end()){
+            index=found->second;
+        }else{
+            index=this->victim();
+            Frame& frame=this->frames[index];
+            if(frame.page){
+                if(frame.dirty){
+                    this->writeBack(index);
+                }
+                this->page_table.erase(frame.page);
+                frame.page=0;
+                this->evictions++;
+            }
+            if(fresh){
+                std::memset(this->data(index), 0, this->page_size);
+            }else{
+                this->faults++;
+                if(pread(this->fd, this->data(index), this->page_size, (off_t)(page*this->page_size))!=(ssize_t)this->page_size){
+                    throw "${Const.BalancedTrees}: cannot read page";
+                }
+            }
+            frame.page=page;
+            frame.dirty=fresh;
+            this->page_table[page]=index;
+        }
+        Frame& frame=this->frames[index];
+        frame.pins++;
+        frame.referenced=true;
+        frame.last_used=++this->tick;
+        return this->data(index);
+    }
+
+    ///dirty marks the page as changed, it is written back when evicted or flushed
+    void unpin(uint64_t page,bool dirty){
+        std::lock_guard<std::mutex> lock(this->mutex);
+        Frame& frame=this->frames[this->page_table.at(page)];
+        frame.pins--;
+        frame.dirty=frame.dirty || dirty;
+    }
+
+    ///writes back every dirty page, without syncing the file
+    void flush(){
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for(size_t i=0;i<this->frames.size();i++){
+            if(this->frames[i].page && this->frames[i].dirty){
+                this->writeBack(i);
+            }
+        }
+    }
+
+    void writeBack(size_t index){
+        Frame& frame=this->frames[index];
+        if(pwrite(this->fd, this->data(index), this->page_size, (off_t)(frame.page*this->page_size))!=(ssize_t)this->page_size){
+            throw "${Const.BalancedTrees}: cannot write page";
+        }
+        frame.dirty=false;
+    }
+
+    ///frame to load a page into, empty frames are taken first
+    size_t victim(){
+        size_t count=this->frames.size();
+        if(this->policy==LRU_EVICTION){
+            size_t best=count;
+            for(size_t i=0;i<count;i++){
+                if(this->frames[i].pins==0 && (best==count || this->frames[i].last_used<this->frames[best].last_used)){
+                    best=i;
+                }
+            }
+            if(best<count){
+                return best;
+            }
+        }else{
+            //the first sweep clears every reference bit, so the second finds a frame unless all are pinned
+            for(size_t step=0;step<2*count;step++){
+                size_t index=this->hand;
+                Frame& frame=this->frames[index];
+                this->hand=(this->hand+1)%count;
+                if(frame.pins>0){
+                    continue;
+                }
+                if(frame.page && frame.referenced){
+                    frame.referenced=false;
+                    continue;
+                }
+                return index;
+            }
+        }
+        throw "${Const.BalancedTrees}: every frame of the buffer pool is pinned";
+    }
+};
+
+/**
+Page file opened for reads and writes through a BPlusBufferPool, see BB::openPagedTree.
+Only pinned pages and those the pool keeps cached are in memory, so the tree may be larger than memory.
+K and V are read and written in place, so they must be trivially copyable types.
+
+The file is only consistent right after flush: header is kept in memory till then, while dirty pages reach the file whenever they are evicted,
+so after a crash in between the header on disk may point at pages which were changed or freed since.
+Keep a BPlusLog (or a copy made with BB::writePages) for changes which have to survive crashes.
+*/
+template<typename K,typename V,typename Compare=ThreeWayCompare<K>>
+struct BPlusPagedTree{
+    typedef K key_type;
+    typedef V value_type;
+
+    int fd=-1;
+    BPlusPageHeader header;
+    BPlusPageLayout<K,V> layout;
+    Compare compare;
+    std::unique_ptr<BPlusBufferPool> pool;
+    ///shared by reads, exclusive for writes, which also change header
+    BPlusLatch latch;
+
+    BPlusPagedTree(uint32_t page_size,Compare compare=Compare()):layout(page_size),compare(std::move(compare)){
+
+    }
+
+    BPlusPagedTree(const BPlusPagedTree&)=delete;
+    BPlusPagedTree& operator=(const BPlusPagedTree&)=delete;
+
+    ~BPlusPagedTree(){
+        if(this->fd>=0){
+            try{
+                this->flush();
+            }catch(...){
+
+            }
+            close(this->fd);
+        }
+    }
+
+    const BPlusPageNode* pinPage(uint64_t id){
+        return (const BPlusPageNode*)this->pool->pin(id);
+    }
+
+    void unpinPage(uint64_t id){
+        this->pool->unpin(id, false);
+    }
+
+    ///writes back the dirty pages, then the header, and syncs the file
+    void flush(){
+        this->pool->flush();
+        std::vector<char> page(this->header.page_size, 0);
+        std::memcpy(page.data(), &this->header, sizeof(this->header));
+        if(pwrite(this->fd, page.data(), page.size(), 0)!=(ssize_t)page.size() || fsync(this->fd)!=0){
+            throw "${Const.BalancedTrees}: cannot write page file";
+        }
+    }
+};
+
+/**
+Fixed set of worker threads for the parallel BB scans, made once and shared by the queries which use it.
+run(count, task) hands the indexes [0, count) out to the workers and the calling thread, and returns once every task(i) is done.
+Runs of concurrent callers take turns. A task may not call run on its own pool (that would wait on itself), run throws instead.
+*/
+struct BPlusThreadPool{
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::mutex run_mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t)>* task=NULL;
+    size_t next=0;
+    size_t count=0;
+    int busy=0;
+    bool stopping=false;
+    std::exception_ptr error;
+
+    ///threads workers besides the threads calling run
+    BPlusThreadPool(int threads){
+        for(int i=0;i<threads;i++){
+            this->workers.emplace_back([this]{
+                std::unique_lock<std::mutex> lock(this->mutex);
+                while(true){
+                    this->wake.wait(lock, [this]{
+                        return this->stopping || this->next<this->count;
+                    });
+                    if(this->stopping){
+                        return;
+                    }
+                    this->drain(lock);
+                }
+            });
+        }
+    }
+
+    BPlusThreadPool(const BPlusThreadPool&)=delete;
+    BPlusThreadPool& operator=(const BPlusThreadPool&)=delete;
+
+    ~BPlusThreadPool(){
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping=true;
+        }
+        this->wake.notify_all();
+        for(std::thread& worker : this->workers){
+            worker.join();
+        }
+    }
+
+    int size() const{
+        return (int)this->workers.size()+1;
+    }
+
+    ///pool whose task the calling thread is running, NULL outside of tasks
+    static BPlusThreadPool*& running(){
+        static thread_local BPlusThreadPool* pool=NULL;
+        return pool;
+    }
+
+    ///runs tasks until none are left, the first exception is kept for run to rethrow
+    void drain(std::unique_lock<std::mutex>& lock){
+        while(this->next<this->count){
+            size_t index=this->next++;
+            const std::function<void(size_t)>& task=*this->task;
+            this->busy++;
+            lock.unlock();
+            BPlusThreadPool* outer=BPlusThreadPool::running();
+            BPlusThreadPool::running()=this;
+            try{
+                task(index);
+                BPlusThreadPool::running()=outer;
+            }catch(...){
+                BPlusThreadPool::running()=outer;
+                lock.lock();
+                if(!this->error){
+                    this->error=std::current_exception();
+                }
+                this->next=this->count;
+                lock.unlock();
+            }
+            lock.lock();
+            this->busy--;
+        }
+        if(this->busy==0){
+            this->done.notify_all();
+        }
+    }
+
+    void run(size_t count,const std::function<void(size_t)>& task){
+        if(BPlusThreadPool::running()==this){
+            throw "${Const.BalancedTrees}: run called from a task of the same thread pool";
+        }
+        std::lock_guard<std::mutex> runLock(this->run_mutex);
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->task=&task;
+        this->next=0;
+        this->count=count;
+        this->error=NULL;
+        this->wake.notify_all();
+        this->drain(lock);
+        this->done.wait(lock, [this]{
+            return this->next>=this->count && this->busy==0;
+        });
+        this->task=NULL;
+        this->count=0;
+        this->next=0;
+        if(this->error){
+            std::rethrow_exception(this->error);
+        }
+    }
+};
+
+struct BPlusLogOptions{
+    ///a writer which starts a flush first waits this long for others to join its fsync
+    uint32_t group_commit_delay_us=0;
+
+    ///a checkpoint is taken by a thread of the log once the log segment grows past this many bytes, 0 leaves checkpoints to BB::checkpoint
+    uint64_t checkpoint_bytes=0;
+};
+
+/**
+Redo log of the inserts and deletes done through it on tree, see BB::openLog.
+Log files are base.log.N segments, base.ckpt.N is a page file checkpoint holding everything logged in segments before N.
+
+Writers apply their change and append its record in one step under mutex, so records are in the order the changes were applied,
+then wait for the record to be durable. The first waiter flushes the records of everyone (group commit), others wait for it.
+With checkpoint_bytes set, the writer which grows the segment past it only wakes checkpointer, which takes the checkpoint while writers go on.
+A failed checkpoint is kept in checkpoint_error for BB::checkpoint to throw, and tried again once the next segment grows past checkpoint_bytes.
+*/
+template<typename K,typename V,typename Compare>
+struct BPlusLog{
+    std::shared_ptr<BPlusTree<K,V,Compare>> tree;
+    std::string base;
+    BPlusLogOptions options;
+
+    std::mutex mutex;
+    std::condition_variable flushed;
+
+    ///encoded records which are not written yet, appended counts records and durable those which are synced
+    std::vector<char> pending;
+    uint64_t appended=0;
+    uint64_t durable=0;
+    bool flushing=false;
+    bool checkpointing=false;
+    bool failed=false;
+
+    std::thread checkpointer;
+    std::condition_variable checkpoint_wake;
+    bool checkpoint_due=false;
+    bool stopping=false;
+    std::exception_ptr checkpoint_error;
+
+    int fd=-1;
+    uint64_t segment=0;
+    uint64_t segment_bytes=0;
+
+    ///waits for a checkpoint being taken, one which is only due is left to the next open of the log
+    ~BPlusLog(){
+        if(this->checkpointer.joinable()){
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->stopping=true;
+            }
+            this->checkpoint_wake.notify_all();
+            this->checkpointer.join();
+        }
+        if(this->fd>=0){
+            close(this->fd);
+        }
+    }
+};
+
+///when a ShardedBPlusTree splits and merges its shards, by entry counts
+struct BPlusShardOptions{
+    ///a shard is split in two once it holds more entries than this
+    uint64_t split_entries=1<<20;
+    ///a shard is joined with a neighbour once it holds fewer entries than this, if the two together hold at most split_entries
+    uint64_t merge_entries=1<<18;
+};
+
+/**
+Range partitioned set of trees: shards[i] holds the keys from bounds[i-1] (inclusive) up to bounds[i] (exclusive), the first and last shard are open ended.
+BB functions route each key to the shard owning it and stitch range queries together across shards in key order.
+Every shard is a BPlusTree with its own latch and size, so writers on different shards do not contend.
+latch guards shards and bounds: operations hold it shared, shards are split and merged holding it exclusively,
+which is quick as BB::splitTree and BB::joinTrees only restructure O(log n) nodes.
+*/
+template<typename K,typename V=std::shared_ptr<void>,typename Compare=ThreeWayCompare<K>>
+struct ShardedBPlusTree{
+    typedef K key_type;
+    typedef V value_type;
+
+    std::vector<std::shared_ptr<BPlusTree<K,V,Compare>>> shards;
+    std::vector<K> bounds;
+    int max_node_size;
+    Compare compare;
+    BPlusShardOptions options;
+    BPlusLatch latch;
+
+    ///one shard per range between bounds, which must be sorted and distinct
+    ShardedBPlusTree(int max_node_size,BPlusShardOptions options=BPlusShardOptions(),std::vector<K> bounds=std::vector<K>(),Compare compare=Compare()):
+        bounds(std::move(bounds)),max_node_size(max_node_size),compare(std::move(compare)),options(options){
+        for(size_t i=1;i<this->bounds.size();i++){
+            if(this->compare(this->bounds[i-1], this->bounds[i])>=0){
+                throw "${Const.BalancedTrees}: shard bounds must be sorted and distinct";
+            }
+        }
+        for(size_t i=0;i<=this->bounds.size();i++){
+            this->shards.push_back(std::make_shared<BPlusTree<K,V,Compare>>(max_node_size, this->compare));
+        }
+    }
+};
+
+enum SearchType{
+  LesserThanOrEqualsTo,
+  EqualsTo,
+  GreaterThanOrEqualsTo,
+    LesserThan,
+  GreaterThan
+};
+
+namespace LL {
+    ///index of first key in [list, list+size) which is greater than or equals to searchKey, size if there is none
+    template<typename K,typename C>
+    static int lowerBound(const K* list,int size,const C& compare,const K& searchKey){
+        int low=0;
+        int high=size;
+        while(low<high){
+            int mid=low+(high-low)/2;
+            if(compare(searchKey, list[mid])>0){
+                low=mid+1;
+            }else{
+                high=mid;
+            }
+        }
+        return low;
+    }
+
+    ///index of first key in [list, list+size) which is greater than searchKey, size if there is none
+    template<typename K,typename C>
+    static int upperBound(const K* list,int size,const C& compare,const K& searchKey){
+        int low=0;
+        int high=size;
+        while(low<high){
+            int mid=low+(high-low)/2;
+            if(compare(searchKey, list[mid])>=0){
+                low=mid+1;
+            }else{
+                high=mid;
+            }
+        }
+        return low;
+    }
+
+    /**
+    Keys which are searched with vector compares when a tree orders them with ThreeWayCompare.
+    Kernels are picked at compile time: AVX2 when its enabled, else SSE2 (SSE4.2 for 64 bit integers), else a scalar loop.
+    */
+    template<typename K>
+    struct SimdKey : std::false_type{};
+    template<> struct SimdKey<int32_t> : std::true_type{};
+    template<> struct SimdKey<int64_t> : std::true_type{};
+    template<> struct SimdKey<uint64_t> : std::true_type{};
+    template<> struct SimdKey<double> : std::true_type{};
+
+    ///binary search narrows down to a cache line of keys, which are then counted with vector compares
+    static const int SIMD_SEARCH_WINDOW_BYTES=64;
+
+    /**
+    Each _countLesser returns the number of keys in [keys, keys+size) lesser than searchKey, or lesser than or equals to it when OrEqual.
+    Compare masks (-1 per hit) are subtracted from lane counters, so a block costs a load, a compare and a subtract.
+    Integer kernels count greater keys for OrEqual, as there is only a greater than compare.
+    The double kernel counts keys which searchKey is not lesser than for OrEqual, so a NaN searchKey is placed as ThreeWayCompare places it (equal to every key).
+    */
+    template<bool OrEqual>
+    inline int _countLesser(const int32_t* keys,int size,int32_t searchKey){
+        int counted=0;
+        int i=0;
+#if defined(__AVX2__)
+        __m256i key=_mm256_set1_epi32(searchKey);
+        __m256i lanes=_mm256_setzero_si256();
+        for(;i+8<=size;i+=8){
+            __m256i block=_mm256_loadu_si256((const __m256i*)(keys+i));
+            lanes=_mm256_sub_epi32(lanes, OrEqual?_mm256_cmpgt_epi32(block, key):_mm256_cmpgt_epi32(key, block));
+        }
+        int32_t sums[8];
+        _mm256_storeu_si256((__m256i*)sums, lanes);
+        for(int32_t sum : sums){
+            counted+=sum;
+        }
+#elif defined(__SSE2__)
+        __m128i key=_mm_set1_epi32(searchKey);
+        __m128i lanes=_mm_setzero_si128();
+        for(;i+4<=size;i+=4){
+            __m128i block=_mm_loadu_si128((const __m128i*)(keys+i));
+            lanes=_mm_sub_epi32(lanes, OrEqual?_mm_cmpgt_epi32(block, key):_mm_cmpgt_epi32(key, block));
+        }
+        int32_t sums[4];
+        _mm_storeu_si128((__m128i*)sums, lanes);
+        for(int32_t sum : sums){
+            counted+=sum;
+        }
+#endif
+        int count=OrEqual?i-counted:counted;
+        for(;i<size;i++){
+            count+=OrEqual?keys[i]<=searchKey:keys[i]<searchKey;
+        }
+        return count;
+    }
+
+    template<bool OrEqual>
+    inline int _countLesser(const int64_t* keys,int size,int64_t searchKey){
+        int counted=0;
+        int i=0;
+#if defined(__AVX2__)
+        __m256i key=_mm256_set1_epi64x(searchKey);
+        __m256i lanes=_mm256_setzero_si256();
+        for(;i+4<=size;i+=4){
+            __m256i block=_mm256_loadu_si256((const __m256i*)(keys+i));
+            lanes=_mm256_sub_epi64(lanes, OrEqual?_mm256_cmpgt_epi64(block, key):_mm256_cmpgt_epi64(key, block));
+        }
+        int64_t sums[4];
+        _mm256_storeu_si256((__m256i*)sums, lanes);
+        for(int64_t sum : sums){
+            counted+=(int)sum;
+        }
+#elif defined(__SSE4_2__)
+        __m128i key=_mm_set1_epi64x(searchKey);
+        __m128i lanes=_mm_setzero_si128();
+        for(;i+2<=size;i+=2){
+            __m128i block=_mm_loadu_si128((const __m128i*)(keys+i));
+            lanes=_mm_sub_epi64(lanes, OrEqual?_mm_cmpgt_epi64(block, key):_mm_cmpgt_epi64(key, block));
+        }
+        int64_t sums[2];
+        _mm_storeu_si128((__m128i*)sums, lanes);
+        for(int64_t sum : sums){
+            counted+=(int)sum;
+        }
+#endif
+        int count=OrEqual?i-counted:counted;
+        for(;i<size;i++){
+            count+=OrEqual?keys[i]<=searchKey:keys[i]<searchKey;
+        }
+        return count;
+    }
+
+    template<bool OrEqual>
+    inline int _countLesser(const uint64_t* keys,int size,uint64_t searchKey){
+        int counted=0;
+        int i=0;
+        //there is no unsigned compare, flipping the sign bit of both sides keeps their order under the signed one
+#if defined(__AVX2__)
+        __m256i bias=_mm256_set1_epi64x(INT64_MIN);
+        __m256i key=_mm256_xor_si256(_mm256_set1_epi64x((int64_t)searchKey), bias);
+        __m256i lanes=_mm256_setzero_si256();
+        for(;i+4<=size;i+=4){
+            __m256i block=_mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys+i)), bias);
+            lanes=_mm256_sub_epi64(lanes, OrEqual?_mm256_cmpgt_epi64(block, key):_mm256_cmpgt_epi64(key, block));
+        }
+        int64_t sums[4];
+        _mm256_storeu_si256((__m256i*)sums, lanes);
+        for(int64_t sum : sums){
+            counted+=(int)sum;
+        }
+#elif defined(__SSE4_2__)
+        __m128i bias=_mm_set1_epi64x(INT64_MIN);
+        __m128i key=_mm_xor_si128(_mm_set1_epi64x((int64_t)searchKey), bias);
+        __m128i lanes=_mm_setzero_si128();
+        for(;i+2<=size;i+=2){
+            __m128i block=_mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys+i)), bias);
+            lanes=_mm_sub_epi64(lanes, OrEqual?_mm_cmpgt_epi64(block, key):_mm_cmpgt_epi64(key, block));
+        }
+        int64_t sums[2];
+        _mm_storeu_si128((__m128i*)sums, lanes);
+        for(int64_t sum : sums){
+            counted+=(int)sum;
+        }
+#endif
+        int count=OrEqual?i-counted:counted;
+        for(;i<size;i++){
+            count+=OrEqual?keys[i]<=searchKey:keys[i]<searchKey;
+        }
+        return count;
+    }
+
+    template<bool OrEqual>
+    inline int _countLesser(const double* keys,int size,double searchKey){
+        int count=0;
+        int i=0;
+#if defined(__AVX2__)
+        __m256d key=_mm256_set1_pd(searchKey);
+        __m256i lanes=_mm256_setzero_si256();
+        for(;i+4<=size;i+=4){
+            __m256d block=_mm256_loadu_pd(keys+i);
+            __m256d hit=OrEqual?_mm256_cmp_pd(block, key, _CMP_NGT_UQ):_mm256_cmp_pd(block, key, _CMP_LT_OQ);
+            lanes=_mm256_sub_epi64(lanes, _mm256_castpd_si256(hit));
+        }
+        int64_t sums[4];
+        _mm256_storeu_si256((__m256i*)sums, lanes);
+        for(int64_t sum : sums){
+            count+=(int)sum;
+        }
+#elif defined(__SSE2__)
+        __m128d key=_mm_set1_pd(searchKey);
+        __m128i lanes=_mm_setzero_si128();
+        for(;i+2<=size;i+=2){
+            __m128d block=_mm_loadu_pd(keys+i);
+            __m128d hit=OrEqual?_mm_cmpngt_pd(block, key):_mm_cmplt_pd(block, key);
+            lanes=_mm_sub_epi64(lanes, _mm_castpd_si128(hit));
+        }
+        int64_t sums[2];
+        _mm_storeu_si128((__m128i*)sums, lanes);
+        for(int64_t sum : sums){
+            count+=(int)sum;
+        }
+#endif
+        for(;i<size;i++){
+            count+=OrEqual?!(searchKey<keys[i]):keys[i]<searchKey;
+        }
+        return count;
+    }
+
+    ///lowerBound (upperBound when OrEqual) of a sorted key array in natural order
+    template<bool OrEqual,typename K>
+    static int _simdBound(const K* keys,int size,K searchKey){
+        //halving without branches, the bound stays within [base, base+size]
+        const K* base=keys;
+        while(size>(int)(SIMD_SEARCH_WINDOW_BYTES/sizeof(K))){
+            int half=size/2;
+            const K& probe=base[half-1];
+            base+=(OrEqual?!(searchKey<probe):probe<searchKey)?half:0;
+            size-=half;
+            BTREE_STATS_COUNT(comparisons, 1);
+        }
+        BTREE_STATS_COUNT(comparisons, size);
+        //keys are sorted, so the bound is base plus the lesser keys in the window
+        return (int)(base-keys)+_countLesser<OrEqual>(base, size, searchKey);
+    }
+
+    template<typename K>
+    static typename std::enable_if<SimdKey<K>::value,int>::type lowerBound(const K* list,int size,const ThreeWayCompare<K>&,const K& searchKey){
+        return LL::_simdBound<false>(list, size, searchKey);
+    }
+
+    template<typename K>
+    static typename std::enable_if<SimdKey<K>::value,int>::type upperBound(const K* list,int size,const ThreeWayCompare<K>&,const K& searchKey){
+        return LL::_simdBound<true>(list, size, searchKey);
+    }
+
+    ///index of first key which is greater than or equals to searchKey, list.size() if there is none
+    template<typename K,typename A,typename C>
+    static int lowerBound(const std::vector<K,A>& list,const C& compare,const K& searchKey){
+        return LL::lowerBound(list.data(), (int)list.size(), compare, searchKey);
+    }
+
+    ///index of first key which is greater than searchKey, list.size() if there is none
+    template<typename K,typename A,typename C>
+    static int upperBound(const std::vector<K,A>& list,const C& compare,const K& searchKey){
+        return LL::upperBound(list.data(), (int)list.size(), compare, searchKey);
+    }
+
+    ///binary searches the sorted keys in [list, list+size), returns index of the found key or -1 if no key satisfies the searchType
+    template<typename K,typename C>
+    static int search(const K* list,int size,const C& compare,const K& searchKey, SearchType searchType=SearchType::EqualsTo){
+        switch (searchType) {
+            case SearchType::LesserThanOrEqualsTo: return LL::upperBound(list, size, compare, searchKey)-1;
+            case SearchType::LesserThan: return LL::lowerBound(list, size, compare, searchKey)-1;
+            case SearchType::GreaterThan:{
+                int i=LL::upperBound(list, size, compare, searchKey);
+                return i<size?i:-1;
+            }
+            case SearchType::GreaterThanOrEqualsTo:{
+                int i=LL::lowerBound(list, size, compare, searchKey);
+                return i<size?i:-1;
+            }
+            case SearchType::EqualsTo:{
+                int i=LL::lowerBound(list, size, compare, searchKey);
+                return (i<size && compare(searchKey, list[i])==0)?i:-1;
+            }
+        }
+        return -1;
+    }
+
+    template<typename K,typename A,typename C>
+    static int search(const std::vector<K,A>& list,const C& compare,const K& searchKey, SearchType searchType=SearchType::EqualsTo){
+        return LL::search(list.data(), (int)list.size(), compare, searchKey, searchType);
+    }
+
+    template<typename T,typename A>
+    static void insertAt(std::vector<T,A>& list,int index,T item){
+        list.insert(list.begin()+index, std::move(item));
+    }
+
+    template<typename T,typename A>
+    static T deleteAt(std::vector<T,A>& list,int index){
+        T deleted=std::move(list[index]);
+        list.erase(list.begin()+index);
+        return deleted;
+    }
+
+    /**
+    Block moves items after splitAfterIndex into rightPortion, items till splitAfterIndex stay in listToSplit.
+
+    **rightPortion**: must be empty.
+    */
+    template<typename T,typename A>
+    static void splitAt(std::vector<T,A>& listToSplit , int splitAfterIndex,std::vector<T,A>& rightPortion){
+        if(splitAfterIndex<-1 || splitAfterIndex>=(int)listToSplit.size()){
+            throw "${Const.BalancedTrees}: splitAfterIndex must be less than listToSplit.size()";
+        }
+        rightPortion.assign(std::make_move_iterator(listToSplit.begin()+splitAfterIndex+1),std::make_move_iterator(listToSplit.end()));
+        listToSplit.erase(listToSplit.begin()+splitAfterIndex+1,listToSplit.end());
+    }
+
+    /*
+    merges rightlist into leftlist, rightlist keys are always bigger than leftlist, no check is performed inside.
+    Its something user must remember, if they want to preserve the sorted list sorting
+    rightlist is empty after merge
+    */
+    template<typename T,typename A>
+    static void mergeSplittedRightIntoLeft(std::vector<T,A>& leftlist,std::vector<T,A>& rightlist){
+        leftlist.insert(leftlist.end(),std::make_move_iterator(rightlist.begin()),std::make_move_iterator(rightlist.end()));
+        rightlist.clear();
+    }
+
+    /*
+    merges leftlist into rightlist, rightlist keys are always bigger than leftlist, no check is performed inside.
+    Its something user must remember, if they want to preserve the sorted list sorting
+    leftlist is empty after merge
+    */
+    template<typename T,typename A>
+    static void mergeSplittedLeftIntoRight(std::vector<T,A>& leftlist,std::vector<T,A>& rightlist){
+        rightlist.insert(rightlist.begin(),std::make_move_iterator(leftlist.begin()),std::make_move_iterator(leftlist.end()));
+        leftlist.clear();
+    }
+
+    ///block moves first count items of rightlist to the end of leftlist
+    template<typename T,typename A>
+    static void shiftIntoLeft(std::vector<T,A>& leftlist,std::vector<T,A>& rightlist,int count){
+        leftlist.insert(leftlist.end(),std::make_move_iterator(rightlist.begin()),std::make_move_iterator(rightlist.begin()+count));
+        rightlist.erase(rightlist.begin(),rightlist.begin()+count);
+    }
+
+    ///block moves last count items of leftlist to the start of rightlist
+    template<typename T,typename A>
+    static void shiftIntoRight(std::vector<T,A>& leftlist,std::vector<T,A>& rightlist,int count){
+        rightlist.insert(rightlist.begin(),std::make_move_iterator(leftlist.end()-count),std::make_move_iterator(leftlist.end()));
+        leftlist.erase(leftlist.end()-count,leftlist.end());
+    }
+}
+
+namespace BB {
+    template<typename K,typename V>
+
+    /**
+    Key Value pair
+    */
+    struct BB_KV_P{
+        std::shared_ptr<K> key;
+        std::shared_ptr<V> value;
+        BB_KV_P(std::shared_ptr<K> key,std::shared_ptr<V> value):key(key),value(value){
+
+        }
+    };
+
+    /**
+    Key Value pair held by value, used by reads of trees which store their values inline.
+    */
+    template<typename K,typename V>
+    struct BB_KV{
+        K key;
+        V value;
+    };
+
+    ///residual filter of a BB_RangeQuery which lets every key through
+    struct BB_AcceptAll{
+        template<typename K>
+        bool operator()(const K&) const{
+            return true;
+        }
+    };
+
+    /**
+    Query over the keys between lower and upper (NULL bounds are open), of which filter(key) picks the matches.
+    Scans seek to lower and stop at the first key past upper, so only the keys in range are looked at. See BB::rangeQuery.
+    filter is called with the tree latched, so it must not call BB operations on the tree it runs over.
+    */
+    template<typename K,typename F=BB_AcceptAll>
+    struct BB_RangeQuery{
+        std::shared_ptr<K> lower;
+        std::shared_ptr<K> upper;
+        bool lower_inclusive;
+        bool upper_inclusive;
+        F filter;
+
+        BB_RangeQuery(std::shared_ptr<K> lower,std::shared_ptr<K> upper,F filter=F(),bool lower_inclusive=true,bool upper_inclusive=true):
+            lower(lower),upper(upper),lower_inclusive(lower_inclusive),upper_inclusive(upper_inclusive),filter(std::move(filter)){
+
+        }
+    };
+
+    ///builds a BB_RangeQuery, deducing the type of filter
+    template<typename K,typename F=BB_AcceptAll>
+    static BB_RangeQuery<K,F> rangeQuery(std::shared_ptr<K> lower,std::shared_ptr<K> upper,F filter=F(),bool lower_inclusive=true,bool upper_inclusive=true){
+        return BB_RangeQuery<K,F>(lower, upper, std::move(filter), lower_inclusive, upper_inclusive);
+    }
+
+    /**
+    Continuation token of a paged range query: pass it back unchanged to get the page right after the previous one, found again with one descent.
+    Holds the last key handed out and, when a page ended partway through its duplicates, how many of them were handed out.
+    Pages don't shift when entries are inserted or deleted between calls. done is set once the range is used up.
+    */
+    template<typename K>
+    struct BB_PageToken{
+        K last_key=K();
+        int duplicate=0;
+        bool started=false;
+        bool done=false;
+    };
+
+    enum BalanceCase{
+        DO_NOTHING,
+
+        REMOVE_ROOT,
+
+        SPLIT,
+
+        DISTRIBUTE_RIGHT_INTO_NODE,
+        DISTRIBUTE_LEFT_INTO_NODE,
+
+        MERGE_RIGHT_INTO_NODE,
+        MERGE_NODE_INTO_LEFT,
+    };
+
+    enum SOURCE_IS{
+    LEFT_SIBLING, RIGHT_SIBLING
+    };
+
+    /**
+    One step of a root to leaf descent: an internal node and the index of the child which was followed.
+    Nodes do not keep parent pointers, balancing walks back up using the recorded path.
+    */
+    template<typename K,typename V>
+    struct BPlusPathStep{
+        std::shared_ptr<BPlusNode<K,V>> node;
+        int child_index;
+    };
+
+    template<typename K,typename V>
+    using BPlusPath = std::vector<BPlusPathStep<K,V>>;
+
+    ///applies entries added below (or removed from below) the leaf at the end of path to the child counts along path
+    template<typename K,typename V>
+    static void _adjustPathCounts(BPlusPath<K,V>& path,const BPlusSubtreeCount& count,bool removed){
+        for(auto& step : path){
+            if(removed){
+                step.node->child_counts[step.child_index]-=count;
+            }else{
+                step.node->child_counts[step.child_index]+=count;
+            }
+        }
+    }
+
+    ///separator between two leaves, the max key of the left one unless the comparator policy has a shorter one
+    template<typename Compare,typename K>
+    static auto _separator(const Compare& compare,const K& leftMax,const K& rightMin,int) -> decltype(compare.separator(leftMax, rightMin)){
+        return compare.separator(leftMax, rightMin);
+    }
+
+    template<typename Compare,typename K>
+    static K _separator(const Compare&,const K& leftMax,const K&,long){
+        return leftMax;
+    }
+
+    ///lets a comparator policy with compressLeaf share the common prefix of the keys of leaf, see PrefixCompressingCompare
+    template<typename Compare,typename K,typename V>
+    static auto _compressLeaf(const Compare& compare,BPlusNode<K,V>* leaf,int added,int) -> decltype(compare.compressLeaf(leaf->keys.data(), 0, 0)){
+        return compare.compressLeaf(leaf->keys.data(), leaf->size(), added);
+    }
+
+    template<typename Compare,typename K,typename V>
+    static void _compressLeaf(const Compare&,BPlusNode<K,V>*,int,long){
+
+    }
+
+    template<typename K,typename V,typename Compare>
+    static BalanceCase _determineBalancingCase( std::shared_ptr<BPlusTree<K,V,Compare>> tree , std::shared_ptr<BPlusNode<K,V>> effectedNode, std::shared_ptr<BPlusNode<K,V>> parent_node, int child_index){
+        auto node_size=effectedNode->size();
+        auto half_capacity = tree->half_capacity;
+
+        if(node_size>tree->max_node_size){
+            return BalanceCase::SPLIT;
+        }
+
+        //case of root node
+        if(!parent_node){
+            if(node_size==0){
+                return BalanceCase::REMOVE_ROOT;
+            }
+            return BalanceCase::DO_NOTHING;
+        }
+
+        if(half_capacity<=node_size){
+            return BalanceCase::DO_NOTHING;
+        }
+
+        //this node size < half capacity
+        //we give prereference too distribution first, that too to right node for distribution
+        auto left_sibling_size = child_index>0 ? parent_node->children[child_index-1]->size() : 0;
+        auto right_sibling_size = child_index<parent_node->size() ? parent_node->children[child_index+1]->size() : 0;
+
+        //after batched deletes a node can be short by more than one key,
+        //then distribution is only done if both nodes end up with at least half capacity, otherwise they are merged
+        if(right_sibling_size>half_capacity && node_size+right_sibling_size>=2*half_capacity){
+            return BalanceCase::DISTRIBUTE_RIGHT_INTO_NODE;
+        }
+
+        if(left_sibling_size>half_capacity && node_size+left_sibling_size>=2*half_capacity){
+            return BalanceCase::DISTRIBUTE_LEFT_INTO_NODE;
+        }
+
+        if(child_index<parent_node->size()){
+            return BalanceCase::MERGE_RIGHT_INTO_NODE;
+        }
+
+        if(child_index>0){
+            return BalanceCase::MERGE_NODE_INTO_LEFT;
+        }
+
+        throw "${Const.BalancedTrees}: NO BALANCE CASE found for: $effectedNode";
+    }
+
+    template<typename K,typename V>
+    static void _linkAsRightSibling(std::shared_ptr<BPlusNode<K,V>> node,std::shared_ptr<BPlusNode<K,V>> newRightNode){
+        auto oldRight=node->rightSibling.lock();
+        newRightNode->rightSibling=oldRight;
+        if(oldRight){
+            oldRight->leftSibling=newRightNode;
+        }
+        newRightNode->leftSibling=node;
+        node->rightSibling=newRightNode;
+    }
+
+    template<typename K,typename V>
+    static void _unlinkFromSiblings(std::shared_ptr<BPlusNode<K,V>> node){
+        auto left=node->leftSibling.lock();
+        auto right=node->rightSibling.lock();
+        if(left){
+            left->rightSibling=right;
+        }
+        if(right){
+            right->leftSibling=left;
+        }
+        node->leftSibling.reset();
+        node->rightSibling.reset();
+    }
+
+    template<typename K,typename V,typename Compare>
+    static void _checkWritable(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree){
+        if(tree->snapshot_of){
+            throw "${Const.BalancedTrees}: snapshot is read only";
+        }
+    }
+
+    ///node is older than the current version while a snapshot is open, so it may be reachable from that snapshot and must not be written to
+    template<typename K,typename V,typename Compare>
+    static bool _isShared(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree,const std::shared_ptr<BPlusNode<K,V>>& node){
+        return node->version!=tree->version && tree->open_snapshots.load()>0;
+    }
+
+    /**
+    Copy of node in the current version, which takes its place in the leaf chain (or the chain of its level) of tree.
+    Caller puts the copy into the parent of node.
+    */
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusNode<K,V>> _copyNode(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const std::shared_ptr<BPlusNode<K,V>>& node){
+        auto copy=createBPlusNode<K,V>(tree, node->isLeaf);
+        copy->keys.assign(node->keys.begin(), node->keys.end());
+        if(node->isLeaf){
+            copy->duplicate_counts.assign(node->duplicate_counts.begin(), node->duplicate_counts.end());
+            copy->values.assign(node->values.begin(), node->values.end());
+        }else{
+            copy->children.assign(node->children.begin(), node->children.end());
+            copy->child_counts.assign(node->child_counts.begin(), node->child_counts.end());
+        }
+
+        //links of the shared node are left as they are, snapshots never follow them
+        auto left=node->leftSibling.lock();
+        auto right=node->rightSibling.lock();
+        copy->leftSibling=left;
+        copy->rightSibling=right;
+        if(left){
+            left->rightSibling=copy;
+        }
+        if(right){
+            right->leftSibling=copy;
+        }
+        if(tree->left_most_node==node){
+            tree->left_most_node=copy;
+        }
+        if(tree->right_most_node==node){
+            tree->right_most_node=copy;
+        }
+        return copy;
+    }
+
+    ///copies parent_node->children[child_index] if its shared, parent_node must not be shared
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusNode<K,V>> _ownChild(std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<BPlusNode<K,V>> parent_node,int child_index){
+        auto& child=parent_node->children[child_index];
+        if(_isShared(tree, child)){
+            child=_copyNode(tree, child);
+        }
+        return child;
+    }
+
+    /**
+    Copies the nodes of path and leaf which are shared with a snapshot, top down, so that they can be written to in place.
+    path and leaf are updated to the copies. A node which is not shared only has ancestors which are not shared either.
+    Caller must hold the tree latch exclusively.
+    */
+    template<typename K,typename V,typename Compare>
+    static void _copyPathForWrite(std::shared_ptr<BPlusTree<K,V,Compare>> tree,BPlusPath<K,V>& path,std::shared_ptr<BPlusNode<K,V>>& leaf){
+        if(tree->open_snapshots.load()==0){
+            return;
+        }
+        std::shared_ptr<BPlusNode<K,V>>* slot=&tree->root_node;
+        for(auto& step : path){
+            if(_isShared(tree, step.node)){
+                step.node=_copyNode(tree, step.node);
+                *slot=step.node;
+            }
+            slot=&step.node->children[step.child_index];
+        }
+        if(_isShared(tree, leaf)){
+            leaf=_copyNode(tree, leaf);
+            *slot=leaf;
+        }
+    }
+
+    /**
+    Splits effectedNode into itself and as many new right siblings as it takes to bring every piece within max_node_size,
+    and pushes the separators into parent_node. A node which overflowed by one key is split in two.
+    If effectedNode is root, a new root is created first.
+    When the rightmost leaf overflows by an append it keeps max_node_size keys and only the appended one moves to the new leaf,
+    as the keys which follow are appended there too. The new leaf holds fewer than half_capacity keys until they fill it.
+    Returns the parent node which received the separators.
+    */
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusNode<K,V>> split(std::shared_ptr<BPlusTree<K,V,Compare>> tree , std::shared_ptr<BPlusNode<K,V>> effectedNode, std::shared_ptr<BPlusNode<K,V>> parent_node, int child_index,bool append=false) {
+        //its assumed that effected node size is greater than node_size, as that check must have been done before calling this
+
+        //Algorithm:
+        //Leaf: keys are evenly divided into pieces, left most pieces take the remainder, max of each piece (or a shorter key below the next piece) is copied up as separator
+        //Internal: children are evenly divided the same way, the key between two pieces moves up as separator
+        //For a single overflow that is: left keeps half_capacity+1 keys (Leaf) or half_capacity keys (Internal), right gets the rest
+        int items=effectedNode->isLeaf?effectedNode->size():effectedNode->size()+1;
+        int pieceCapacity=effectedNode->isLeaf?tree->max_node_size:tree->max_node_size+1;
+        int pieces=(items+pieceCapacity-1)/pieceCapacity;
+        //read from the sibling link rather than right_most_node, which a concurrent split of the actual rightmost leaf may be writing
+        bool rightMost=effectedNode->isLeaf && !effectedNode->rightSibling.lock();
+        bool leftFull=append && pieces==2 && rightMost;
+
+        //if effected node is root, than create a new root
+        if (!parent_node) {
+            parent_node = createBPlusNode<K,V>(tree, false);
+            parent_node->children.push_back(effectedNode);
+            parent_node->child_counts.push_back(BPlusSubtreeCount());
+            tree->root_node = parent_node;
+            child_index=0;
+        }
+
+        //pieces are peeled off the tail, so each new one is the left neighbour of the one peeled before it
+        std::vector<K> separators;
+        std::vector<std::shared_ptr<BPlusNode<K,V>>> splitRightNodes;
+        for(int piece=pieces-1;piece>0;piece--){
+            int pieceSize=leftFull?items-pieceCapacity:items/pieces+(piece<items%pieces?1:0);
+            auto splitRightNode = createBPlusNode<K,V>(tree, effectedNode->isLeaf);
+
+            if(effectedNode->isLeaf){
+                int splitAfterIndex=effectedNode->size()-pieceSize-1;
+                LL::splitAt(effectedNode->keys, splitAfterIndex, splitRightNode->keys);
+                LL::splitAt(effectedNode->duplicate_counts, splitAfterIndex, splitRightNode->duplicate_counts);
+                LL::splitAt(effectedNode->values, splitAfterIndex, splitRightNode->values);
+                separators.push_back(_separator(tree->compare, effectedNode->keys.back(), splitRightNode->keys.front(), 0));
+
+                //if effected node is also right most node, then we will need set that too for tree as new Right Node
+                if(rightMost && piece==pieces-1){
+                    tree->right_most_node = splitRightNode;
+                }
+            }else{
+                int splitAfterIndex=(int)effectedNode->children.size()-pieceSize-1;
+                LL::splitAt(effectedNode->keys, splitAfterIndex, splitRightNode->keys);
+                LL::splitAt(effectedNode->children, splitAfterIndex, splitRightNode->children);
+                LL::splitAt(effectedNode->child_counts, splitAfterIndex, splitRightNode->child_counts);
+                separators.push_back(LL::deleteAt(effectedNode->keys, splitAfterIndex));
+            }
+
+            _linkAsRightSibling(effectedNode, splitRightNode);
+            splitRightNodes.push_back(splitRightNode);
+        }
+        if(effectedNode->isLeaf){
+            //each piece has a common prefix of its own, at least as long as the one of the whole
+            BB::_compressLeaf(tree->compare, effectedNode.get(), -1, 0);
+            for(auto& node : splitRightNodes){
+                BB::_compressLeaf(tree->compare, node.get(), -1, 0);
+            }
+        }
+
+        //all pieces go into parent_node in one block move
+        std::vector<BPlusSubtreeCount> counts;
+        for(auto& node : splitRightNodes){
+            counts.push_back(node->subtreeCount());
+        }
+        parent_node->keys.insert(parent_node->keys.begin()+child_index, std::make_move_iterator(separators.rbegin()), std::make_move_iterator(separators.rend()));
+        parent_node->children.insert(parent_node->children.begin()+child_index+1, splitRightNodes.rbegin(), splitRightNodes.rend());
+        parent_node->child_counts.insert(parent_node->child_counts.begin()+child_index+1, counts.rbegin(), counts.rend());
+        parent_node->child_counts[child_index]=effectedNode->subtreeCount();
+
+        return parent_node;
+    }
+
+    /**
+    Merges parent_node->children[separator_index+1] (source) into parent_node->children[separator_index] (target).
+    Source is always right sibling.
+    Returns parent_node, which lost a key.
+    */
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusNode<K,V>> merge(
+        std::shared_ptr<BPlusTree<K,V,Compare>> tree ,
+        std::shared_ptr<BPlusNode<K,V>> parent_node,
+        int separator_index){
+        //its assumed that source and target size are all calculated before hand, and this is indeed a case of merge
+        auto target=_ownChild(tree, parent_node, separator_index);
+        auto source=_ownChild(tree, parent_node, separator_index+1);
+
+        auto separator=LL::deleteAt(parent_node->keys, separator_index);
+        LL::deleteAt(parent_node->children, separator_index+1);
+        parent_node->child_counts[separator_index]+=LL::deleteAt(parent_node->child_counts, separator_index+1);
+
+        if(source->isLeaf){
+            LL::mergeSplittedRightIntoLeft(target->keys, source->keys);
+            LL::mergeSplittedRightIntoLeft(target->duplicate_counts, source->duplicate_counts);
+            LL::mergeSplittedRightIntoLeft(target->values, source->values);
+            BB::_compressLeaf(tree->compare, target.get(), -1, 0);
+        }else{
+            //separator comes down to sit between targets max and sources min
+            target->keys.push_back(std::move(separator));
+            LL::mergeSplittedRightIntoLeft(target->keys, source->keys);
+            LL::mergeSplittedRightIntoLeft(target->children, source->children);
+            LL::mergeSplittedRightIntoLeft(target->child_counts, source->child_counts);
+        }
+
+        if(source->isLeaf && !source->rightSibling.lock()){
+            tree->right_most_node=target;
+        }
+        _unlinkFromSiblings(source);
+
+        return parent_node;
+    }
+
+    ///Source will have alays have more nodes than target and more than half capacity, no check performed here. Its must be performed at source end.
+    ///Keys are moved until both nodes are of equal size, separator between them in parent_node is updated.
+    template <typename K,typename V,typename Compare>
+    static void distribute(std::shared_ptr<BPlusTree<K,V,Compare>> tree, std::shared_ptr<BPlusNode<K,V>> parent_node, int separator_index, SOURCE_IS source_is){
+        auto left=_ownChild(tree, parent_node, separator_index);
+        auto right=_ownChild(tree, parent_node, separator_index+1);
+
+        if(left->isLeaf){
+            int total=left->size()+right->size();
+            int newLeftSize=(total+1)/2;
+            if(source_is==SOURCE_IS::RIGHT_SIBLING){
+                //move head of right into tail of left
+                int moveCount=newLeftSize-left->size();
+                LL::shiftIntoLeft(left->keys, right->keys, moveCount);
+                LL::shiftIntoLeft(left->duplicate_counts, right->duplicate_counts, moveCount);
+                LL::shiftIntoLeft(left->values, right->values, moveCount);
+            }else{
+                //move tail of left into head of right
+                int moveCount=left->size()-newLeftSize;
+                LL::shiftIntoRight(left->keys, right->keys, moveCount);
+                LL::shiftIntoRight(left->duplicate_counts, right->duplicate_counts, moveCount);
+                LL::shiftIntoRight(left->values, right->values, moveCount);
+            }
+            parent_node->keys[separator_index]=_separator(tree->compare, left->keys.back(), right->keys.front(), 0);
+            BB::_compressLeaf(tree->compare, left.get(), -1, 0);
+            BB::_compressLeaf(tree->compare, right.get(), -1, 0);
+        }else{
+            //keys rotate through the separator in parent_node
+            int total=left->size()+right->size();
+            int newLeftSize=total/2;
+            if(source_is==SOURCE_IS::RIGHT_SIBLING){
+                int moveCount=newLeftSize-left->size();
+                //separator comes down into left, last key taken from right becomes the new separator
+                left->keys.push_back(std::move(parent_node->keys[separator_index]));
+                LL::shiftIntoLeft(left->keys, right->keys, moveCount-1);
+                parent_node->keys[separator_index]=LL::deleteAt(right->keys, 0);
+                LL::shiftIntoLeft(left->children, right->children, moveCount);
+                LL::shiftIntoLeft(left->child_counts, right->child_counts, moveCount);
+            }else{
+                int moveCount=left->size()-newLeftSize;
+                //separator comes down into right, first key taken from left becomes the new separator
+                LL::insertAt(right->keys, 0, std::move(parent_node->keys[separator_index]));
+                LL::shiftIntoRight(left->keys, right->keys, moveCount-1);
+                parent_node->keys[separator_index]=LL::deleteAt(left->keys, left->size()-1);
+                LL::shiftIntoRight(left->children, right->children, moveCount);
+                LL::shiftIntoRight(left->child_counts, right->child_counts, moveCount);
+            }
+        }
+
+        //entries only moved between the two, so their sum in parent_node stays the same
+        parent_node->child_counts[separator_index]=left->subtreeCount();
+        parent_node->child_counts[separator_index+1]=right->subtreeCount();
+    }
+
+    /**
+    Latches, left to right, the nodes next to effectedNode (latched by guard) which balanceCase writes to: siblings it moves keys between,
+    and the neighbours whose sibling links change. A left sibling is latched after letting go of effectedNode, which guard latches again.
+    Sizes of the siblings could be read before, as no other writer gets below parent_node while it is latched exclusively.
+    */
+    template<typename K,typename V>
+    static void _latchSiblings(BalanceCase balanceCase,const std::shared_ptr<BPlusNode<K,V>>& effectedNode,const std::shared_ptr<BPlusNode<K,V>>& parent_node,int child_index,BPlusLatchGuard& guard,std::vector<BPlusLatchGuard>& siblings){
+        std::shared_ptr<BPlusNode<K,V>> right;
+        switch(balanceCase){
+        case BalanceCase::SPLIT:
+            right=effectedNode->rightSibling.lock();
+            break;
+        case BalanceCase::DISTRIBUTE_RIGHT_INTO_NODE:
+            siblings.emplace_back(parent_node->children[child_index+1]->latch, false);
+            break;
+        case BalanceCase::MERGE_RIGHT_INTO_NODE:{
+            auto& source=parent_node->children[child_index+1];
+            siblings.emplace_back(source->latch, false);
+            right=source->rightSibling.lock();
+            break;
+        }
+        case BalanceCase::DISTRIBUTE_LEFT_INTO_NODE:
+        case BalanceCase::MERGE_NODE_INTO_LEFT:
+            guard.unlock();
+            siblings.emplace_back(parent_node->children[child_index-1]->latch, false);
+            guard.lock(effectedNode->latch, false);
+            if(balanceCase==BalanceCase::MERGE_NODE_INTO_LEFT){
+                right=effectedNode->rightSibling.lock();
+            }
+            break;
+        default:
+            break;
+        }
+        if(right){
+            siblings.emplace_back(right->latch, false);
+        }
+    }
+
+    /**
+    Restores node sizes after effectedNode was modified.
+    path holds the ancestors of effectedNode as recorded while descending, it is consumed while walking up.
+    append is set when effectedNode grew by a key appended to the rightmost leaf, see split.
+    latches is given when the tree is only latched shared: it holds the latches of path followed by the one of effectedNode, see _latchPathForWrite.
+    Siblings are then latched as they are restructured, each level is let go of once balancing moves above it,
+    and balancing stops at the nodes above a safe one, which are only latched shared.
+    */
+    template <typename K,typename V,typename Compare>
+    static void balance( std::shared_ptr<BPlusTree<K,V,Compare>> tree, BPlusPath<K,V>& path, std::shared_ptr<BPlusNode<K,V>> effectedNode,bool append=false,std::vector<BPlusLatchGuard>* latches=NULL){
+        while(effectedNode){
+            if(latches && !latches->empty() && latches->back().shared){
+                return;
+            }
+            std::shared_ptr<BPlusNode<K,V>> parent_node;
+            int child_index=0;
+            if(!path.empty()){
+                parent_node=path.back().node;
+                child_index=path.back().child_index;
+                path.pop_back();
+            }
+
+            auto balanceCase = _determineBalancingCase(tree, effectedNode, parent_node, child_index);
+            BTREE_STATS_BALANCE(tree, balanceCase);
+            std::vector<BPlusLatchGuard> siblings;
+            if(latches && parent_node){
+                BB::_latchSiblings(balanceCase, effectedNode, parent_node, child_index, latches->back(), siblings);
+            }
+            switch(balanceCase){
+            case BalanceCase::DO_NOTHING:
+                return;
+            case BalanceCase::REMOVE_ROOT:
+                if(effectedNode->isLeaf){
+                    tree->root_node=NULL;
+                    tree->left_most_node=NULL;
+                    tree->right_most_node=NULL;
+                }else{
+                    tree->root_node=effectedNode->children[0];
+                }
+                return;
+            case BalanceCase::SPLIT:
+                effectedNode=BB::split(tree, effectedNode, parent_node, child_index, append);
+                break;
+            case BalanceCase::DISTRIBUTE_RIGHT_INTO_NODE:
+                BB::distribute(tree, parent_node, child_index, SOURCE_IS::RIGHT_SIBLING);
+                return;
+            case BalanceCase::DISTRIBUTE_LEFT_INTO_NODE:
+                BB::distribute(tree, parent_node, child_index-1, SOURCE_IS::LEFT_SIBLING);
+                return;
+            case BalanceCase::MERGE_RIGHT_INTO_NODE:
+                effectedNode=BB::merge(tree, parent_node, child_index);
+                break;
+            case BalanceCase::MERGE_NODE_INTO_LEFT:
+                effectedNode=BB::merge(tree, parent_node, child_index-1);
+                break;
+            }
+            if(latches && !latches->empty()){
+                latches->pop_back();
+            }
+        }
+    }
+
+    /**
+    Descends from root to the leaf which should hold key, recording the followed internal nodes in path when its given.
+    Nodes are not latched, so caller must hold the tree latch exclusively, see _descendLatched otherwise.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<BPlusNode<K,V>> _descendToLeaf(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const K& key, BPlusPath<K,V>* path=NULL){
+        std::shared_ptr<BPlusNode<K,V>> bpNode = tree->root_node;
+        while(bpNode && !bpNode->isLeaf){
+            BTREE_STATS_COUNT(node_visits, 1);
+            //separator is not lesser than any key of its left child, so equal keys are found on the left
+            int child_index=LL::lowerBound(bpNode->keys, compare, key);
+            if(path){
+                path->push_back(BPlusPathStep<K,V>{bpNode, child_index});
+            }
+            bpNode=bpNode->children[child_index];
+        }
+        BTREE_STATS_COUNT(node_visits, bpNode?1:0);
+        //bpnode is guaranteed leaf
+        return bpNode;
+    }
+
+    /**
+    Latches the root of tree for a descent, shared unless its a leaf and writeLeaf is set. root_latch is held while root_node is read and latched,
+    so the root can not be replaced in between. Returns NULL with nothing latched when the tree is empty.
+    */
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusNode<K,V>> _latchRoot(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree,BPlusLatchGuard& guard,bool writeLeaf=false){
+        BPlusLatchGuard rootGuard(tree->root_latch, true);
+        auto root=tree->root_node;
+        if(root){
+            guard.lock(root->latch, !(writeLeaf && root->isLeaf));
+        }
+        return root;
+    }
+
+    /**
+    Same as _descendToLeaf, but latches each node shared before letting go of its parent.
+    Returns the leaf latched shared by guard. Caller must hold the tree latch.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<BPlusNode<K,V>> _descendLatched(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree,const C& compare,const K& key,BPlusLatchGuard& guard){
+        auto bpNode=BB::_latchRoot(tree, guard);
+        while(bpNode && !bpNode->isLeaf){
+            BTREE_STATS_COUNT(node_visits, 1);
+            int child_index=LL::lowerBound(bpNode->keys, compare, key);
+            bpNode=bpNode->children[child_index];
+            guard.handOver(bpNode->latch);
+        }
+        BTREE_STATS_COUNT(node_visits, bpNode?1:0);
+        return bpNode;
+    }
+
+    ///leftmost leaf of tree latched shared by guard, NULL when the tree is empty. Caller must hold the tree latch.
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusNode<K,V>> _firstLeaf(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree,BPlusLatchGuard& guard){
+        BPlusLatchGuard rootGuard(tree->root_latch, true);
+        auto leaf=tree->left_most_node;
+        if(leaf){
+            guard.lock(leaf->latch, true);
+        }
+        return leaf;
+    }
+
+    ///counts of every entry of tree, read off its root. Caller must hold the tree latch.
+    template<typename K,typename V,typename Compare>
+    static BPlusSubtreeCount _treeCount(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree){
+        BPlusLatchGuard guard;
+        auto root=BB::_latchRoot(tree, guard);
+        return root?root->subtreeCount():BPlusSubtreeCount();
+    }
+
+    /**
+    Descends to the leaf key is written to for a write which may split or merge nodes, latching every node exclusively.
+    Once it reaches a node the write can not split or merge (a safe one), root_latch is let go of and the nodes above are downgraded to shared,
+    as they only take new counts. latches is left with the latches of path followed by the one of the leaf, rootGuard with root_latch
+    while the root may still change. An insert into an empty tree creates its root leaf, otherwise NULL is returned for one.
+    Caller must hold the tree latch shared, with no snapshot of the tree open.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<BPlusNode<K,V>> _latchPathForWrite(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree,const C& compare,const K& key,bool inserting,BPlusPath<K,V>& path,std::vector<BPlusLatchGuard>& latches,BPlusLatchGuard& rootGuard){
+        path.clear();
+        latches.clear();
+        rootGuard.lock(tree->root_latch, false);
+        if(!tree->root_node && inserting){
+            tree->root_node=createBPlusNode(tree, true);
+            tree->left_most_node=tree->root_node;
+            tree->right_most_node=tree->root_node;
+        }
+        std::shared_ptr<BPlusNode<K,V>> bpNode=tree->root_node;
+        while(bpNode){
+            BTREE_STATS_COUNT(node_visits, 1);
+            latches.emplace_back(bpNode->latch, false);
+            int size=bpNode->size();
+            //an insert adds at most one key to each node it passes, a delete takes at most one, the root may go down to one
+            bool safe=inserting?size<tree->max_node_size:size>(path.empty()?1:tree->half_capacity);
+            if(safe){
+                rootGuard.unlock();
+                for(size_t i=0;i+1<latches.size();i++){
+                    latches[i].downgrade();
+                }
+            }
+            if(bpNode->isLeaf){
+                break;
+            }
+            int child_index=size>0 && compare(key, bpNode->keys[size-1])>0?size:LL::lowerBound(bpNode->keys, compare, key);
+            path.push_back(BPlusPathStep<K,V>{bpNode, child_index});
+            bpNode=bpNode->children[child_index];
+        }
+        return bpNode;
+    }
+
+    /**
+    Leaf next to leaf in key order, on its right or on its left, NULL at either end.
+    Sibling links are kept for the live tree only, nodes a snapshot shares with it may link to newer copies,
+    so in a snapshot the neighbour is found by descending from its root instead.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<BPlusNode<K,V>> _siblingLeaf(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const std::shared_ptr<BPlusNode<K,V>>& leaf,bool right){
+        if(!tree->snapshot_of){
+            return right?leaf->rightSibling.lock():leaf->leftSibling.lock();
+        }
+        if(leaf->size()==0){
+            return NULL;
+        }
+        const K& key=right?leaf->keys.back():leaf->keys.front();
+        std::shared_ptr<BPlusNode<K,V>> neighbour;
+        BPlusNode<K,V>* bpNode=tree->root_node.get();
+        while(bpNode && !bpNode->isLeaf){
+            int child_index=LL::lowerBound(bpNode->keys, compare, key);
+            //deepest subtree beside the path on that side holds the neighbour
+            if(right && child_index<bpNode->size()){
+                neighbour=bpNode->children[child_index+1];
+            }
+            if(!right && child_index>0){
+                neighbour=bpNode->children[child_index-1];
+            }
+            bpNode=bpNode->children[child_index].get();
+        }
+        while(neighbour && !neighbour->isLeaf){
+            neighbour=right?neighbour->children.front():neighbour->children.back();
+        }
+        return neighbour;
+    }
+
+    /**
+    Finds the leaf and index of the entry which satisfies searchType for key, following the leaf chain if the entry lies in a sibling.
+    Returns NULL if there is no such entry, otherwise the leaf is returned latched shared by leafGuard.
+    Latches are only taken right to left when they are free (see BPlusTree::latch): when the left sibling is latched,
+    the seek waits for it without holding anything and starts over from the root.
+    Caller must hold the tree latch.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<BPlusNode<K,V>> _seek(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const K& key, SearchType searchType, int& index,BPlusLatchGuard& leafGuard){
+        std::shared_ptr<BPlusNode<K,V>> leafNode;
+        bool restart=true;
+        while(restart){
+            restart=false;
+            leafNode=BB::_descendLatched(tree, compare, key, leafGuard);
+            if(!leafNode){
+                return NULL;
+            }
+            index=LL::search(leafNode->keys, compare, key, searchType);
+            switch(searchType){
+                case SearchType::EqualsTo:
+                    break;
+                case SearchType::LesserThanOrEqualsTo:
+                case SearchType::LesserThan:
+                    while(index<0){
+                        auto left=BB::_siblingLeaf(tree, compare, leafNode, false);
+                        if(!left){
+                            break;
+                        }
+                        if(!leafGuard.tryHandOver(left->latch)){
+                            leafGuard.unlock();
+                            left->latch.lockShared();
+                            left->latch.unlockShared();
+                            restart=true;
+                            break;
+                        }
+                        leafNode=left;
+                        index=leafNode->size()-1;
+                    }
+                    break;
+                case SearchType::GreaterThanOrEqualsTo:
+                case SearchType::GreaterThan:
+                    while(index<0){
+                        leafNode=BB::_siblingLeaf(tree, compare, leafNode, true);
+                        if(!leafNode){
+                            break;
+                        }
+                        leafGuard.handOver(leafNode->latch);
+                        index=leafNode->size()>0?0:-1;
+                    }
+                    break;
+            }
+        }
+        if(index<0){
+            leafGuard.unlock();
+            return NULL;
+        }
+        return leafNode;
+    }
+
+    /**
+    Number of entries with a key lesser than key, or lesser than or equals to key when inclusive.
+    Duplicates are counted, unless distinct is set in which case every key counts once.
+    Caller must hold the tree latch.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static uint64_t _rank(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const K& key,bool inclusive,bool distinct){
+        uint64_t rank=0;
+        BPlusLatchGuard guard;
+        auto bpNode=BB::_latchRoot(tree, guard);
+        while(bpNode && !bpNode->isLeaf){
+            BTREE_STATS_COUNT(node_visits, 1);
+            //children left of the followed one only hold keys lesser than key, children right of it only greater ones
+            int child_index=LL::lowerBound(bpNode->keys, compare, key);
+            for(int i=0;i<child_index;i++){
+                rank+=distinct?bpNode->child_counts[i].keys:bpNode->child_counts[i].entries;
+            }
+            bpNode=bpNode->children[child_index];
+            guard.handOver(bpNode->latch);
+        }
+        if(bpNode){
+            BTREE_STATS_COUNT(node_visits, 1);
+            int end=inclusive?LL::upperBound(bpNode->keys, compare, key):LL::lowerBound(bpNode->keys, compare, key);
+            rank+=end;
+            if(!distinct){
+                for(int i=0;i<end;i++){
+                    rank+=bpNode->duplicate_counts[i];
+                }
+            }
+        }
+        return rank;
+    }
+
+    /**
+    Finds the leaf and index of the entry at position (0 based, in key order), descending by the child counts.
+    Duplicates take up as many positions as they were inserted, unless distinct is set.
+    Returns NULL if position is past the last entry, otherwise the leaf is returned latched shared by leafGuard.
+    Caller must hold the tree latch.
+    */
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusNode<K,V>> _select(std::shared_ptr<BPlusTree<K,V,Compare>> tree,uint64_t position,bool distinct,int& index,BPlusLatchGuard& leafGuard){
+        auto leaf=BB::_latchRoot(tree, leafGuard);
+        if(!leaf){
+            return NULL;
+        }
+        while(!leaf->isLeaf){
+            BTREE_STATS_COUNT(node_visits, 1);
+            int child_index=0;
+            for(;child_index<leaf->size();child_index++){
+                uint64_t count=distinct?leaf->child_counts[child_index].keys:leaf->child_counts[child_index].entries;
+                if(position<count){
+                    break;
+                }
+                position-=count;
+            }
+            leaf=leaf->children[child_index];
+            leafGuard.handOver(leaf->latch);
+        }
+        //a concurrent writer applies its counts to the path after writing its leaf, so position can run past the leaf it was counted into
+        BTREE_STATS_COUNT(node_visits, 1);
+        while(leaf){
+            for(index=0;index<leaf->size();index++){
+                uint64_t count=distinct?1:leaf->duplicate_counts[index]+1;
+                if(position<count){
+                    return leaf;
+                }
+                position-=count;
+            }
+            //a snapshot has no concurrent writers, there position only runs past the last leaf
+            leaf=tree->snapshot_of?NULL:leaf->rightSibling.lock();
+            if(leaf){
+                leafGuard.handOver(leaf->latch);
+            }
+        }
+        leafGuard.unlock();
+        return NULL;
+    }
+
+    /**
+    Position on an entry of a leaf, which moves along the leaf chain.
+    Keys and values are read in place, nothing is copied or materialized.
+
+    A cursor keeps its leaf alive, but any insert or delete on the tree invalidates it (like iterators of std containers),
+    it has to be positioned again with seek afterwards. A cursor holds no latches between calls,
+    so it must not be used while other threads write to the tree. A cursor over a snapshot stays valid.
+    */
+    template<typename K,typename V,typename Compare=ThreeWayCompare<K>>
+    struct BPlusCursor{
+        std::shared_ptr<BPlusTree<K,V,Compare>> tree;
+        std::shared_ptr<BPlusNode<K,V>> leaf;
+        int index=-1;
+
+        BPlusCursor(std::shared_ptr<BPlusTree<K,V,Compare>> tree):tree(tree){
+
+        }
+
+        ///positions on the entry which satisfies searchType for key, returns false (and invalidates) if there is none
+        bool seek(const K& key,SearchType searchType=SearchType::GreaterThanOrEqualsTo){
+            BPlusLatchGuard treeGuard(this->tree->latch, true);
+            BPlusLatchGuard leafGuard;
+            this->leaf=BB::_seek(this->tree, this->tree->compare, key, searchType, this->index, leafGuard);
+            return this->_settle();
+        }
+
+        bool seekToFirst(){
+            this->leaf=this->tree->left_most_node;
+            this->index=0;
+            return this->_settle();
+        }
+
+        bool seekToLast(){
+            this->leaf=this->tree->right_most_node;
+            this->index=this->leaf?this->leaf->size()-1:-1;
+            return this->_settle();
+        }
+
+        bool isValid() const{
+            return this->leaf && this->index>=0 && this->index<this->leaf->size();
+        }
+
+        ///moves to next entry, returns false when it moves past the last one
+        bool next(){
+            if(!this->leaf){
+                return false;
+            }
+            this->index++;
+            while(this->leaf && this->index>=this->leaf->size()){
+                this->leaf=BB::_siblingLeaf(this->tree, this->tree->compare, this->leaf, true);
+                this->index=0;
+            }
+            return this->leaf!=NULL;
+        }
+
+        ///moves to previous entry, returns false when it moves before the first one
+        bool prev(){
+            if(!this->leaf){
+                return false;
+            }
+            this->index--;
+            while(this->leaf && this->index<0){
+                this->leaf=BB::_siblingLeaf(this->tree, this->tree->compare, this->leaf, false);
+                this->index=this->leaf?this->leaf->size()-1:-1;
+            }
+            return this->leaf!=NULL;
+        }
+
+        const K& key() const{
+            return this->leaf->keys[this->index];
+        }
+
+        V& value() const{
+            return this->leaf->values[this->index];
+        }
+
+        ///number of extra inserts collapsed into the current key
+        int duplicateCount() const{
+            return this->leaf->duplicate_counts[this->index];
+        }
+
+        bool _settle(){
+            //leaves in the chain are never empty, except the root leaf of an empty tree
+            if(this->leaf && (this->index<0 || this->index>=this->leaf->size())){
+                this->leaf=NULL;
+            }
+            if(!this->leaf){
+                this->index=-1;
+            }
+            return this->leaf!=NULL;
+        }
+    };
+
+    template<typename K,typename V,typename Compare>
+    static BPlusCursor<K,V,Compare> createCursor(std::shared_ptr<BPlusTree<K,V,Compare>> tree){
+        return BPlusCursor<K,V,Compare>(tree);
+    }
+
+    ///number of entries (duplicates included) with a key lesser than key
+    template<typename K,typename V,typename Compare>
+    static uint64_t rank(std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> key){
+        BTREE_STATS_OPERATION(tree, OP_RANK);
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        return BB::_rank(tree, tree->compare, *key, false, false);
+    }
+
+    /**
+    Returns a cursor on the entry at position (0 based, duplicates included), so select(tree, rank(tree, key)) lands on key.
+    Cursor is invalid if position is not lesser than tree size.
+    */
+    template<typename K,typename V,typename Compare>
+    static BPlusCursor<K,V,Compare> select(std::shared_ptr<BPlusTree<K,V,Compare>> tree,uint64_t position){
+        BTREE_STATS_OPERATION(tree, OP_SELECT);
+        BPlusCursor<K,V,Compare> cursor(tree);
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        cursor.leaf=BB::_select(tree, position, false, cursor.index, leafGuard);
+        cursor._settle();
+        return cursor;
+    }
+
+    ///number of entries (duplicates included) with startKey <= key <= endKey, NULL bounds are open
+    template<typename K,typename V,typename Compare>
+    static uint64_t countRange(std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        BTREE_STATS_OPERATION(tree, OP_COUNT_RANGE);
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        uint64_t end=endKey?BB::_rank(tree, tree->compare, *endKey, true, false):tree->size.load();
+        uint64_t start=startKey?BB::_rank(tree, tree->compare, *startKey, false, false):0;
+        return end>start?end-start:0;
+    }
+
+    ///returned leaf is not latched, its entries can change under concurrent writers
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusNode<K,V>> searchForLeafNode(std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> key){
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        return BB::_descendLatched(tree, tree->compare, *key, leafGuard);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusNode<K,V>> searchForLeafNode(std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> key,ComparatorFunction<BPlusCell<K>> queryCompare=NULL){
+        CellComparatorAdapter<K> effectiveComparator(queryCompare?queryCompare:compare);
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        return BB::_descendLatched(tree, effectiveComparator, *key, leafGuard);
+    }
+
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<K> _searchForKey( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,std::shared_ptr<K> searchKey,SearchType searchType){
+        BTREE_STATS_OPERATION(tree, OP_SEARCH);
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        int index;
+        auto leafNode = BB::_seek(tree, compare, *searchKey, searchType, index, leafGuard);
+        if(leafNode){
+            return std::make_shared<K>(leafNode->keys[index]);
+        }
+        return NULL;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> searchForKey( std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
+        return BB::_searchForKey(tree, tree->compare, searchKey, searchType);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> searchForKey( std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
+        return BB::_searchForKey(tree, CellComparatorAdapter<K>(std::move(compare)), searchKey, searchType);
+    }
+
+    template<typename K,typename V,typename Compare,typename C>
+    static bool _searchForValue( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,std::shared_ptr<K> searchKey,V& value,SearchType searchType){
+        BTREE_STATS_OPERATION(tree, OP_SEARCH);
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        int index;
+        auto leafNode = BB::_seek(tree, compare, *searchKey, searchType, index, leafGuard);
+        if(leafNode){
+            value=leafNode->values[index];
+            return true;
+        }
+        return false;
+    }
+
+    ///returns V() if nothing is found, use the overload taking value to tell a missing key from a default value
+    template<typename K,typename V,typename Compare>
+    static V searchForValue( std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
+        V value=V();
+        BB::_searchForValue(tree, tree->compare, searchKey, value, searchType);
+        return value;
+    }
+
+    ///copies found value into value, returns false if nothing is found
+    template<typename K,typename V,typename Compare>
+    static bool searchForValue( std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> searchKey,V& value,SearchType searchType = SearchType::EqualsTo){
+        return BB::_searchForValue(tree, tree->compare, searchKey, value, searchType);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static V searchForValue( std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
+        V value=V();
+        BB::_searchForValue(tree, CellComparatorAdapter<K>(std::move(compare)), searchKey, value, searchType);
+        return value;
+    }
+
+    template<typename K,typename T,typename Compare,typename C>
+    static std::shared_ptr<BB_KV_P<K,T>> _searchForKV( std::shared_ptr<BPlusTree<K,std::shared_ptr<void>,Compare>> tree,const C& compare,std::shared_ptr<K> searchKey,SearchType searchType){
+        BTREE_STATS_OPERATION(tree, OP_SEARCH);
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        int index;
+        auto leafNode = BB::_seek(tree, compare, *searchKey, searchType, index, leafGuard);
+        if(leafNode){
+            return std::shared_ptr<BB_KV_P<K,T>>(new BB_KV_P<K,T>(std::make_shared<K>(leafNode->keys[index]),std::static_pointer_cast<T>(leafNode->values[index])));
+        }
+        return NULL;
+    }
+
+    ///for trees with untyped values, value is cast to V
+    template<typename K, typename V,typename Compare>
+    static std::shared_ptr<BB_KV_P<K,V>> searchForKV( std::shared_ptr<BPlusTree<K,std::shared_ptr<void>,Compare>> tree,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
+        return BB::_searchForKV<K,V>(tree, tree->compare, searchKey, searchType);
+    }
+
+    ///for trees with untyped values, value is cast to V
+    template<typename K, typename V,typename Compare>
+    static std::shared_ptr<BB_KV_P<K,V>> searchForKV( std::shared_ptr<BPlusTree<K,std::shared_ptr<void>,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
+        return BB::_searchForKV<K,V>(tree, CellComparatorAdapter<K>(std::move(compare)), searchKey, searchType);
+    }
+
+    ///copies found key and value into kv, returns false if nothing is found
+    template<typename K, typename V,typename Compare>
+    static bool searchForKV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> searchKey,BB_KV<K,V>& kv,SearchType searchType = SearchType::EqualsTo){
+        BTREE_STATS_OPERATION(tree, OP_SEARCH);
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        int index;
+        auto leafNode = BB::_seek(tree, tree->compare, *searchKey, searchType, index, leafGuard);
+        if(leafNode){
+            kv.key=leafNode->keys[index];
+            kv.value=leafNode->values[index];
+            return true;
+        }
+        return false;
+    }
+
+    /**
+    Walks entries with startKey <= key <= endKey in order along the leaf chain, skipping offset entries and handing at most limit entries (-1 for all) to yield(leaf, index).
+    Duplicates are yielded once. Skipped entries are not walked, the scan starts by selecting the entry at rank(startKey)+offset.
+    Leaves are latched hand-over-hand, yield is called with the leaf latched shared.
+    */
+    template<typename K,typename V,typename Compare,typename C,typename Y>
+    static void _scanRange( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,int offset,int limit,std::shared_ptr<K> startKey,std::shared_ptr<K> endKey,Y yield){
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        int index=0;
+        std::shared_ptr<BPlusNode<K,V>> currentNode;
+        if(offset>0){
+            uint64_t position=startKey?BB::_rank(tree, compare, *startKey, false, true):0;
+            currentNode=BB::_select(tree, position+offset, true, index, leafGuard);
+        }else if(startKey){
+            currentNode=BB::_seek(tree, compare, *startKey, SearchType::GreaterThanOrEqualsTo, index, leafGuard);
+        }else{
+            currentNode=BB::_firstLeaf(tree, leafGuard);
+        }
+
+        int count=0;
+        while(currentNode && count!=limit){
+            BTREE_STATS_COUNT(leaves_scanned, 1);
+            int size=currentNode->size();
+            //when the whole leaf is in range, there is no need to compare against endKey per key
+            bool leafInRange= !endKey || (size>0 && compare(*endKey, currentNode->keys[size-1])>=0);
+            for(;index<size;index++){
+                if(!leafInRange && compare(*endKey, currentNode->keys[index])<0){
+                    return;
+                }
+                if(count==limit){
+                    return;
+                }
+                count++;
+                yield(currentNode, index);
+            }
+            if(!leafInRange){
+                return;
+            }
+            currentNode=BB::_siblingLeaf(tree, compare, currentNode, true);
+            if(currentNode){
+                leafGuard.handOver(currentNode->latch);
+            }
+            index=0;
+        }
+    }
+
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> _searchForRangeWithPagination( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,int offset,int limit,std::shared_ptr<K> startKey,std::shared_ptr<K> endKey){
+        BTREE_STATS_OPERATION(tree, OP_RANGE);
+        std::shared_ptr<std::vector<std::shared_ptr<K>>> result(new std::vector<std::shared_ptr<K>>());
+        BB::_scanRange(tree, compare, offset, limit, startKey, endKey, [&result](std::shared_ptr<BPlusNode<K,V>>& node,int index){
+            result->push_back(std::make_shared<K>(node->keys[index]));
+        });
+        return result;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> searchForRangeWithPagination( std::shared_ptr<BPlusTree<K,V,Compare>> tree,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_searchForRangeWithPagination(tree, tree->compare, offset, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> searchForRangeWithPagination( std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_searchForRangeWithPagination(tree, CellComparatorAdapter<K>(std::move(compare)), offset, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<std::vector<V>> _searchForRangeWithPaginationV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,int offset,int limit,std::shared_ptr<K> startKey,std::shared_ptr<K> endKey){
+        BTREE_STATS_OPERATION(tree, OP_RANGE);
+        std::shared_ptr<std::vector<V>> result(new std::vector<V>());
+        BB::_scanRange(tree, compare, offset, limit, startKey, endKey, [&result](std::shared_ptr<BPlusNode<K,V>>& node,int index){
+            result->push_back(node->values[index]);
+        });
+        return result;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<V>> searchForRangeWithPaginationV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_searchForRangeWithPaginationV(tree, tree->compare, offset, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<V>> searchForRangeWithPaginationV( std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_searchForRangeWithPaginationV(tree, CellComparatorAdapter<K>(std::move(compare)), offset, limit, startKey, endKey);
+    }
+
+    /**
+    Walks the leaf chain from bookmark_key (exclusive) or from the start of the tree, handing every entry for which matches(leaf, index) holds to yield(leaf, index).
+    Stops when yield returns false. Leaves are latched hand-over-hand, matches and yield are called with the leaf latched shared.
+    */
+    template<typename K,typename V,typename Compare,typename C,typename M,typename Y>
+    static void _scanMatching( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,std::shared_ptr<K> bookmark_key,M matches,Y yield){
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        int index=0;
+        std::shared_ptr<BPlusNode<K,V>> found_leaf_node;
+        if(bookmark_key){
+            found_leaf_node=BB::_seek(tree, compare, *bookmark_key, SearchType::GreaterThan, index, leafGuard);
+        }else{
+            found_leaf_node=BB::_firstLeaf(tree, leafGuard);
+        }
+
+        while(found_leaf_node){
+            BTREE_STATS_COUNT(leaves_scanned, 1);
+            int size=found_leaf_node->size();
+            for(;index<size;index++){
+                if(matches(found_leaf_node, index)){
+                    if(!yield(found_leaf_node, index)){
+                        return;
+                    }
+                }
+            }
+            found_leaf_node = BB::_siblingLeaf(tree, compare, found_leaf_node, true);
+            if(found_leaf_node){
+                leafGuard.handOver(found_leaf_node->latch);
+            }
+            index=0;
+        }
+    }
+
+    template<typename K,typename V,typename Compare,typename C,typename Q>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> _find( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const Q& queryComparator,std::shared_ptr<K> bookmark_key, bool yieldIndividualDuplicates){
+        BTREE_STATS_OPERATION(tree, OP_FIND);
+        std::shared_ptr<std::vector<std::shared_ptr<K>>> result(new std::vector<std::shared_ptr<K>>());
+        BB::_scanMatching(tree, compare, bookmark_key, [&queryComparator](std::shared_ptr<BPlusNode<K,V>>& node,int index){
+            return queryComparator(node->keys[index],node->keys[index])==0;
+        },[&result,yieldIndividualDuplicates](std::shared_ptr<BPlusNode<K,V>>& node,int index){
+            auto key=std::make_shared<K>(node->keys[index]);
+            int copies=yieldIndividualDuplicates?node->duplicate_counts[index]+1:1;
+            for(int i=0;i<copies;i++){
+                result->push_back(key);
+            }
+            return true;
+        });
+        return result;
+    }
+
+    /**
+    queryComparator is called as queryComparator(key, key) for every key after bookmark_key, keys for which it returns 0 are matched.
+    It is called with the tree latched, so it must not call BB operations on tree (see BPlusLatch).
+    */
+    template<typename K,typename V,typename Compare,typename Q>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> find( std::shared_ptr<BPlusTree<K,V,Compare>> tree,Q queryComparator,std::shared_ptr<K> bookmark_key=NULL, bool yieldIndividualDuplicates=false){
+        return BB::_find(tree, tree->compare, queryComparator, bookmark_key, yieldIndividualDuplicates);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> find( std::shared_ptr<BPlusTree<K,V,Compare>> tree,  ComparatorFunction<BPlusCell<K>>  compare ,  ComparatorFunction<BPlusCell<K>> queryComparator,std::shared_ptr<K> bookmark_key=NULL, bool yieldIndividualDuplicates=false){
+        return BB::_find(tree, CellComparatorAdapter<K>(std::move(compare)), CellComparatorAdapter<K>(std::move(queryComparator)), bookmark_key, yieldIndividualDuplicates);
+    }
+
+    template<typename K,typename V,typename Compare,typename C,typename Q>
+    static std::shared_ptr<std::vector<V>> _findV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const Q& queryComparator,std::shared_ptr<K> bookmark_key,uint limit){
+        BTREE_STATS_OPERATION(tree, OP_FIND);
+        std::shared_ptr<std::vector<V>> result(new std::vector<V>());
+        BB::_scanMatching(tree, compare, bookmark_key, [&queryComparator](std::shared_ptr<BPlusNode<K,V>>& node,int index){
+            return queryComparator(node->keys[index],node->keys[index])==0;
+        },[&result,limit](std::shared_ptr<BPlusNode<K,V>>& node,int index){
+            result->push_back(node->values[index]);
+            return result->size()!=limit;
+        });
+        return result;
+    }
+
+    /**
+    Same as find, but returns values of matched keys, at most limit of them (0 for all).
+    */
+    template<typename K,typename V,typename Compare,typename Q>
+    static std::shared_ptr<std::vector<V>> findV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,Q queryComparator,std::shared_ptr<K> bookmark_key=NULL, bool yieldIndividualDuplicates=false,uint limit=0){
+        return BB::_findV(tree, tree->compare, queryComparator, bookmark_key, limit);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<V>> findV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,  ComparatorFunction<BPlusCell<K>>  compare ,  ComparatorFunction<K> queryComparator,std::shared_ptr<K> bookmark_key=NULL, bool yieldIndividualDuplicates=false,uint limit=0){
+        return BB::_findV(tree, CellComparatorAdapter<K>(std::move(compare)), KeyComparatorAdapter<K>(std::move(queryComparator)), bookmark_key, limit);
+    }
+
+    /**
+    Walks the entries of query from index in leaf (latched shared by leafGuard) along the leaf chain, handing the ones filter picks to yield(leaf, index).
+    Returns false once past upper or the last leaf, true if yield stopped the scan by returning false.
+    */
+    template<typename K,typename V,typename Compare,typename C,typename F,typename Y>
+    static bool _scanQueryFrom( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const BB_RangeQuery<K,F>& query,std::shared_ptr<BPlusNode<K,V>> leaf,int index,BPlusLatchGuard& leafGuard,Y yield){
+        //keys for which compare(upper, key)<end are past the upper bound
+        int end=query.upper_inclusive?0:1;
+        while(leaf){
+            BTREE_STATS_COUNT(leaves_scanned, 1);
+            int size=leaf->size();
+            bool leafInRange= !query.upper || (size>0 && compare(*query.upper, leaf->keys[size-1])>=end);
+            for(;index<size;index++){
+                const K& key=leaf->keys[index];
+                if(!leafInRange && compare(*query.upper, key)<end){
+                    return false;
+                }
+                if(query.filter(key) && !yield(leaf, index)){
+                    return true;
+                }
+            }
+            if(!leafInRange){
+                return false;
+            }
+            leaf=BB::_siblingLeaf(tree, compare, leaf, true);
+            if(leaf){
+                leafGuard.handOver(leaf->latch);
+            }
+            index=0;
+        }
+        return false;
+    }
+
+    /**
+    Hands the entries in range of query after bookmark_key (exclusive) which pass its filter to yield(leaf, index), in key order, until yield returns false.
+    Seeks to the greater of the lower bound and bookmark_key, and stops at the first key past the upper bound.
+    Leaves are latched hand-over-hand, filter and yield are called with the leaf latched shared.
+    */
+    template<typename K,typename V,typename Compare,typename C,typename F,typename Y>
+    static void _scanQuery( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const BB_RangeQuery<K,F>& query,std::shared_ptr<K> bookmark_key,Y yield){
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        int index=0;
+        std::shared_ptr<BPlusNode<K,V>> leaf;
+        if(bookmark_key && (!query.lower || compare(*bookmark_key, *query.lower)>=0)){
+            leaf=BB::_seek(tree, compare, *bookmark_key, SearchType::GreaterThan, index, leafGuard);
+        }else if(query.lower){
+            leaf=BB::_seek(tree, compare, *query.lower, query.lower_inclusive?SearchType::GreaterThanOrEqualsTo:SearchType::GreaterThan, index, leafGuard);
+        }else{
+            leaf=BB::_firstLeaf(tree, leafGuard);
+        }
+        BB::_scanQueryFrom(tree, compare, query, leaf, index, leafGuard, yield);
+    }
+
+    /**
+    Keys of the entries matched by query after bookmark_key, in O(log n + keys in range) instead of a scan of every key after bookmark_key.
+    */
+    template<typename K,typename V,typename Compare,typename F>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> find( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const BB_RangeQuery<K,F>& query,std::shared_ptr<K> bookmark_key=NULL, bool yieldIndividualDuplicates=false){
+        BTREE_STATS_OPERATION(tree, OP_FIND);
+        std::shared_ptr<std::vector<std::shared_ptr<K>>> result(new std::vector<std::shared_ptr<K>>());
+        BB::_scanQuery(tree, tree->compare, query, bookmark_key, [&result,yieldIndividualDuplicates](std::shared_ptr<BPlusNode<K,V>>& node,int index){
+            auto key=std::make_shared<K>(node->keys[index]);
+            int copies=yieldIndividualDuplicates?node->duplicate_counts[index]+1:1;
+            result->insert(result->end(), copies, key);
+            return true;
+        });
+        return result;
+    }
+
+    ///same as find with a query, but returns values of matched keys, at most limit of them (0 for all)
+    template<typename K,typename V,typename Compare,typename F>
+    static std::shared_ptr<std::vector<V>> findV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const BB_RangeQuery<K,F>& query,std::shared_ptr<K> bookmark_key=NULL,uint limit=0){
+        BTREE_STATS_OPERATION(tree, OP_FIND);
+        std::shared_ptr<std::vector<V>> result(new std::vector<V>());
+        BB::_scanQuery(tree, tree->compare, query, bookmark_key, [&result,limit](std::shared_ptr<BPlusNode<K,V>>& node,int index){
+            result->push_back(node->values[index]);
+            return result->size()!=limit;
+        });
+        return result;
+    }
+
+    /**
+    Hands the next page of at most limit rows (-1 for all) of query after token to yield(leaf, index, copies), and moves token past them.
+    With individualDuplicates a key counts as one row per duplicate and copies says how many of them are in the page, otherwise it is 1.
+    */
+    template<typename K,typename V,typename Compare,typename C,typename F,typename Y>
+    static void _scanPage( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const BB_RangeQuery<K,F>& query,BB_PageToken<K>& token,int limit,bool individualDuplicates,Y yield){
+        if(token.done || limit==0){
+            return;
+        }
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        int index=0;
+        int skip=0;
+        std::shared_ptr<BPlusNode<K,V>> leaf;
+        if(token.started){
+            leaf=BB::_seek(tree, compare, token.last_key, token.duplicate>0?SearchType::GreaterThanOrEqualsTo:SearchType::GreaterThan, index, leafGuard);
+            if(leaf && token.duplicate>0 && compare(leaf->keys[index], token.last_key)==0){
+                skip=token.duplicate;
+            }
+        }else if(query.lower){
+            leaf=BB::_seek(tree, compare, *query.lower, query.lower_inclusive?SearchType::GreaterThanOrEqualsTo:SearchType::GreaterThan, index, leafGuard);
+        }else{
+            leaf=BB::_firstLeaf(tree, leafGuard);
+        }
+
+        int count=0;
+        bool stopped=BB::_scanQueryFrom(tree, compare, query, leaf, index, leafGuard, [&](std::shared_ptr<BPlusNode<K,V>>& node,int i){
+            int rows=individualDuplicates?node->duplicate_counts[i]+1:1;
+            //duplicates of last_key the previous page already handed out
+            int handed=skip;
+            skip=0;
+            if(handed>=rows){
+                return true;
+            }
+            int copies=rows-handed;
+            if(limit>=0){
+                copies=std::min(copies, limit-count);
+            }
+            handed+=copies;
+            count+=copies;
+            token.last_key=node->keys[i];
+            token.duplicate=handed<rows?handed:0;
+            token.started=true;
+            yield(node, i, copies);
+            return count!=limit;
+        });
+        token.done=!stopped;
+    }
+
+    ///keys of the next page of at most limit entries (-1 for all) matched by query after token, see BB_PageToken
+    template<typename K,typename V,typename Compare,typename F>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> find( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const BB_RangeQuery<K,F>& query,BB_PageToken<K>& token,int limit=-1, bool yieldIndividualDuplicates=false){
+        BTREE_STATS_OPERATION(tree, OP_FIND);
+        std::shared_ptr<std::vector<std::shared_ptr<K>>> result(new std::vector<std::shared_ptr<K>>());
+        BB::_scanPage(tree, tree->compare, query, token, limit, yieldIndividualDuplicates, [&result](std::shared_ptr<BPlusNode<K,V>>& node,int index,int copies){
+            result->insert(result->end(), copies, std::make_shared<K>(node->keys[index]));
+        });
+        return result;
+    }
+
+    ///values of the next page of at most limit entries (-1 for all) matched by query after token, see BB_PageToken
+    template<typename K,typename V,typename Compare,typename F>
+    static std::shared_ptr<std::vector<V>> findV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const BB_RangeQuery<K,F>& query,BB_PageToken<K>& token,int limit=-1){
+        BTREE_STATS_OPERATION(tree, OP_FIND);
+        std::shared_ptr<std::vector<V>> result(new std::vector<V>());
+        BB::_scanPage(tree, tree->compare, query, token, limit, false, [&result](std::shared_ptr<BPlusNode<K,V>>& node,int index,int){
+            result->push_back(node->values[index]);
+        });
+        return result;
+    }
+
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> _searchForRangeWithPagination( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,BB_PageToken<K>& token,int limit,std::shared_ptr<K> startKey,std::shared_ptr<K> endKey){
+        BTREE_STATS_OPERATION(tree, OP_RANGE);
+        std::shared_ptr<std::vector<std::shared_ptr<K>>> result(new std::vector<std::shared_ptr<K>>());
+        BB::_scanPage(tree, compare, BB::rangeQuery(startKey, endKey), token, limit, false, [&result](std::shared_ptr<BPlusNode<K,V>>& node,int index,int){
+            result->push_back(std::make_shared<K>(node->keys[index]));
+        });
+        return result;
+    }
+
+    /**
+    Same as searchForRangeWithPagination, but pages by token instead of offset: each page starts right after the previous one in O(log n),
+    however deep it is, and doesn't shift when entries are inserted or deleted between calls. See BB_PageToken.
+    */
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> searchForRangeWithPagination( std::shared_ptr<BPlusTree<K,V,Compare>> tree,BB_PageToken<K>& token,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_searchForRangeWithPagination(tree, tree->compare, token, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> searchForRangeWithPagination( std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,BB_PageToken<K>& token,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_searchForRangeWithPagination(tree, CellComparatorAdapter<K>(std::move(compare)), token, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<std::vector<V>> _searchForRangeWithPaginationV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,BB_PageToken<K>& token,int limit,std::shared_ptr<K> startKey,std::shared_ptr<K> endKey){
+        BTREE_STATS_OPERATION(tree, OP_RANGE);
+        std::shared_ptr<std::vector<V>> result(new std::vector<V>());
+        BB::_scanPage(tree, compare, BB::rangeQuery(startKey, endKey), token, limit, false, [&result](std::shared_ptr<BPlusNode<K,V>>& node,int index,int){
+            result->push_back(node->values[index]);
+        });
+        return result;
+    }
+
+    ///same as searchForRangeWithPaginationV, but pages by token instead of offset
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<V>> searchForRangeWithPaginationV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,BB_PageToken<K>& token,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_searchForRangeWithPaginationV(tree, tree->compare, token, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<V>> searchForRangeWithPaginationV( std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,BB_PageToken<K>& token,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_searchForRangeWithPaginationV(tree, CellComparatorAdapter<K>(std::move(compare)), token, limit, startKey, endKey);
+    }
+
+    ///same as searchForRangeWithPaginationKV, but pages by token instead of offset
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<BB_KV<K,V>>> searchForRangeWithPaginationKV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,BB_PageToken<K>& token,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        BTREE_STATS_OPERATION(tree, OP_RANGE);
+        std::shared_ptr<std::vector<BB_KV<K,V>>> result(new std::vector<BB_KV<K,V>>());
+        BB::_scanPage(tree, tree->compare, BB::rangeQuery(startKey, endKey), token, limit, false, [&result](std::shared_ptr<BPlusNode<K,V>>& node,int index,int){
+            result->push_back(BB_KV<K,V>{node->keys[index], node->values[index]});
+        });
+        return result;
+    }
+
+    /**
+    Keys scanned by one task of a parallel scan: those after lower up to and including upper, NULL for an open end.
+    node is the subtree they were found under, which is only used to split them further.
+    */
+    template<typename K,typename V>
+    struct _ScanPartition{
+        std::shared_ptr<BPlusNode<K,V>> node;
+        std::shared_ptr<K> lower;
+        std::shared_ptr<K> upper;
+    };
+
+    /**
+    Splits the keys after bookmark_key into partitions for a parallel scan by the separators of the tree, going down a level at a time
+    until there are about 4 per thread, so that threads which get small partitions pick up more.
+    Each node is latched shared while its separators are copied. Nodes may be restructured by concurrent writers in between,
+    so separators are clipped to the partition they split: the partitions always cover every key after bookmark_key, whatever the tree looks like.
+    Caller must hold the tree latch.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static std::vector<_ScanPartition<K,V>> _scanPartitions(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const K* bookmark_key,int threads){
+        std::vector<_ScanPartition<K,V>> partitions;
+        {
+            BPlusLatchGuard rootGuard;
+            auto root=BB::_latchRoot(tree, rootGuard);
+            if(root){
+                partitions.push_back(_ScanPartition<K,V>{root, bookmark_key?std::make_shared<K>(*bookmark_key):NULL, NULL});
+            }
+        }
+        bool deeper=true;
+        while(deeper && (int)partitions.size()<4*threads){
+            deeper=false;
+            std::vector<_ScanPartition<K,V>> children;
+            for(auto& partition : partitions){
+                auto& node=partition.node;
+                BPlusLatchGuard nodeGuard(node->latch, true);
+                //a node merged away has no children left
+                if(node->isLeaf || node->children.empty()){
+                    children.push_back(partition);
+                    continue;
+                }
+                deeper=true;
+                for(int i=0;i<=node->size();i++){
+                    //children only hold keys lesser than or equals to their separator
+                    std::shared_ptr<K> lower=partition.lower;
+                    std::shared_ptr<K> upper=partition.upper;
+                    if(i>0 && (!lower || compare(node->keys[i-1], *lower)>0)){
+                        lower=std::make_shared<K>(node->keys[i-1]);
+                    }
+                    if(i<node->size() && (!upper || compare(node->keys[i], *upper)<0)){
+                        upper=std::make_shared<K>(node->keys[i]);
+                    }
+                    if(lower && upper && compare(*upper, *lower)<=0){
+                        continue;
+                    }
+                    children.push_back(_ScanPartition<K,V>{node->children[i], lower, upper});
+                }
+            }
+            partitions.swap(children);
+        }
+        return partitions;
+    }
+
+    /**
+    Hands the entries of partition in key order to yield(leaf, index) until it returns false or stop() holds.
+    Leaves are latched hand-over-hand along the leaf chain. The calling thread of the scan holds the tree latch for it.
+    */
+    template<typename K,typename V,typename Compare,typename C,typename Y,typename S>
+    static void _scanPartition(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const _ScanPartition<K,V>& partition,Y& yield,S& stop){
+        BPlusLatchGuard leafGuard;
+        int index=0;
+        auto leaf=partition.lower?BB::_seek(tree, compare, *partition.lower, SearchType::GreaterThan, index, leafGuard):BB::_firstLeaf(tree, leafGuard);
+        while(leaf && !stop()){
+            BTREE_STATS_COUNT(leaves_scanned, 1);
+            for(;index<leaf->size();index++){
+                if(partition.upper && compare(leaf->keys[index], *partition.upper)>0){
+                    return;
+                }
+                if(!yield(leaf.get(), index)){
+                    return;
+                }
+            }
+            leaf=BB::_siblingLeaf(tree, compare, leaf, true);
+            if(leaf){
+                leafGuard.handOver(leaf->latch);
+            }
+            index=0;
+        }
+    }
+
+    /**
+    find and findV over pool: the keys are split into partitions which the pool scans at once, and their results are joined in key order.
+    Once the partitions before one have matched limit entries (0 for no limit), the scans of it and of later ones stop.
+    add(result, leaf, index) adds an entry to a partition result and returns how many entries it added.
+    */
+    template<typename R,typename K,typename V,typename Compare,typename C,typename Q,typename A>
+    static std::shared_ptr<std::vector<R>> _parallelFind(std::shared_ptr<BPlusTree<K,V,Compare>> tree,BPlusThreadPool& pool,const C& compare,const Q& queryComparator,std::shared_ptr<K> bookmark_key,uint64_t limit,A add){
+        BTREE_STATS_OPERATION(tree, OP_FIND);
+        std::shared_ptr<std::vector<R>> result(new std::vector<R>());
+        //workers latch nodes under the tree latch the calling thread holds
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        auto partitions=BB::_scanPartitions(tree, compare, bookmark_key.get(), pool.size());
+        std::vector<std::vector<R>> results(partitions.size());
+        std::vector<char> finished(partitions.size(), 0);
+        std::mutex progress;
+        //partitions after cutoff are not needed any more
+        std::atomic<size_t> cutoff{partitions.size()};
+
+        std::function<void(size_t)> task=[&](size_t i){
+            std::vector<R>& matched=results[i];
+            uint64_t count=0;
+            auto yield=[&](BPlusNode<K,V>* leaf,int index){
+                if(queryComparator(leaf->keys[index], leaf->keys[index])!=0){
+                    return true;
+                }
+                count+=add(matched, leaf, index);
+                return limit==0 || count<limit;
+            };
+            auto stop=[&]{
+                return i>cutoff.load(std::memory_order_relaxed);
+            };
+            BB::_scanPartition(tree, compare, partitions[i], yield, stop);
+            if(limit==0){
+                return;
+            }
+            std::lock_guard<std::mutex> lock(progress);
+            finished[i]=1;
+            uint64_t total=0;
+            for(size_t p=0;p<partitions.size() && finished[p];p++){
+                total+=results[p].size();
+                if(total>=limit){
+                    if(p<cutoff.load()){
+                        cutoff.store(p);
+                    }
+                    break;
+                }
+            }
+        };
+        pool.run(partitions.size(), task);
+
+        for(size_t i=0;i<partitions.size() && i<=cutoff.load();i++){
+            for(R& item : results[i]){
+                if(limit>0 && result->size()>=limit){
+                    return result;
+                }
+                result->push_back(std::move(item));
+            }
+        }
+        return result;
+    }
+
+    ///same as find, but the scan is spread over the threads of pool, the calling thread keeps tree latched shared till all of them are done
+    template<typename K,typename V,typename Compare,typename Q>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> parallelFind( std::shared_ptr<BPlusTree<K,V,Compare>> tree,BPlusThreadPool& pool,Q queryComparator,std::shared_ptr<K> bookmark_key=NULL, bool yieldIndividualDuplicates=false){
+        return BB::_parallelFind<std::shared_ptr<K>>(tree, pool, tree->compare, queryComparator, bookmark_key, 0, [yieldIndividualDuplicates](std::vector<std::shared_ptr<K>>& matched,BPlusNode<K,V>* leaf,int index){
+            auto key=std::make_shared<K>(leaf->keys[index]);
+            int copies=yieldIndividualDuplicates?leaf->duplicate_counts[index]+1:1;
+            matched.insert(matched.end(), copies, key);
+            return (uint64_t)copies;
+        });
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> parallelFind( std::shared_ptr<BPlusTree<K,V,Compare>> tree,BPlusThreadPool& pool,  ComparatorFunction<BPlusCell<K>>  compare ,  ComparatorFunction<BPlusCell<K>> queryComparator,std::shared_ptr<K> bookmark_key=NULL, bool yieldIndividualDuplicates=false){
+        return BB::_parallelFind<std::shared_ptr<K>>(tree, pool, CellComparatorAdapter<K>(std::move(compare)), CellComparatorAdapter<K>(std::move(queryComparator)), bookmark_key, 0, [yieldIndividualDuplicates](std::vector<std::shared_ptr<K>>& matched,BPlusNode<K,V>* leaf,int index){
+            auto key=std::make_shared<K>(leaf->keys[index]);
+            int copies=yieldIndividualDuplicates?leaf->duplicate_counts[index]+1:1;
+            matched.insert(matched.end(), copies, key);
+            return (uint64_t)copies;
+        });
+    }
+
+    ///same as findV, but the scan is spread over the threads of pool
+    template<typename K,typename V,typename Compare,typename Q>
+    static std::shared_ptr<std::vector<V>> parallelFindV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,BPlusThreadPool& pool,Q queryComparator,std::shared_ptr<K> bookmark_key=NULL,uint64_t limit=0){
+        return BB::_parallelFind<V>(tree, pool, tree->compare, queryComparator, bookmark_key, limit, [](std::vector<V>& matched,BPlusNode<K,V>* leaf,int index){
+            matched.push_back(leaf->values[index]);
+            return (uint64_t)1;
+        });
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<V>> parallelFindV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,BPlusThreadPool& pool,  ComparatorFunction<BPlusCell<K>>  compare ,  ComparatorFunction<K> queryComparator,std::shared_ptr<K> bookmark_key=NULL,uint64_t limit=0){
+        return BB::_parallelFind<V>(tree, pool, CellComparatorAdapter<K>(std::move(compare)), KeyComparatorAdapter<K>(std::move(queryComparator)), bookmark_key, limit, [](std::vector<V>& matched,BPlusNode<K,V>* leaf,int index){
+            matched.push_back(leaf->values[index]);
+            return (uint64_t)1;
+        });
+    }
+
+    ///inserts key into leafNode of tree in place, returns the entries it added (a duplicate adds no key)
+    template<typename K,typename V,typename Compare,typename C>
+    static BPlusSubtreeCount _insertIntoLeaf(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree,std::shared_ptr<BPlusNode<K,V>>& leafNode,const C& compare,const K& key,V value){
+        //appends go to the end without a search
+        int size=leafNode->size();
+        int index=size>0 && compare(leafNode->keys[size-1], key)<0?size:LL::lowerBound(leafNode->keys, compare, key);
+        if(index<leafNode->size() && compare(key, leafNode->keys[index])==0){
+            leafNode->duplicate_counts[index]++;
+            //this is done as change feeds in recliner db were failing because of this.
+            leafNode->keys[index]=key;
+            leafNode->values[index]=std::move(value);
+            BB::_compressLeaf(tree->compare, leafNode.get(), index, 0);
+            return BPlusSubtreeCount(1, 0);
+        }
+        LL::insertAt(leafNode->keys, index, key);
+        LL::insertAt(leafNode->duplicate_counts, index, 0);
+        LL::insertAt(leafNode->values, index, std::move(value));
+        BB::_compressLeaf(tree->compare, leafNode.get(), index, 0);
+        return BPlusSubtreeCount(1, 1);
+    }
+
+    /**
+    Where an insert went: the leaf and the path to it, see BB::insert with a hint.
+    The next insert with the hint goes straight to that leaf, without a descent, as long as the tree was not restructured around it and key still belongs there.
+    The nodes it holds are kept alive by it.
+    */
+    template<typename K,typename V>
+    struct BB_InsertHint{
+        BPlusPath<K,V> path;
+        std::shared_ptr<BPlusNode<K,V>> leaf;
+    };
+
+    ///whether step of a path still leads to next, a node merged away is left without children
+    template<typename K,typename V>
+    static bool _stepLeadsTo(const BPlusPathStep<K,V>& step,const std::shared_ptr<BPlusNode<K,V>>& next){
+        return step.child_index<(int)step.node->children.size() && step.node->children[step.child_index]==next;
+    }
+
+    ///whether key lies within the closest separators on either side of the node path leads to
+    template<typename K,typename V,typename C>
+    static bool _pathCovers(const C& compare,const K& key,const BPlusPath<K,V>& path){
+        bool lowerChecked=false;
+        bool upperChecked=false;
+        for(size_t i=path.size();i-->0 && !(lowerChecked && upperChecked);){
+            auto& step=path[i];
+            if(!lowerChecked && step.child_index>0){
+                if(compare(key, step.node->keys[step.child_index-1])<=0){
+                    return false;
+                }
+                lowerChecked=true;
+            }
+            if(!upperChecked && step.child_index<step.node->size()){
+                if(compare(key, step.node->keys[step.child_index])>0){
+                    return false;
+                }
+                upperChecked=true;
+            }
+        }
+        return true;
+    }
+
+    /**
+    Whether key belongs in leaf, reached from the root of tree by path: every step must still lead to the next node,
+    then only the closest separators on either side of leaf have to be compared with key. Caller must hold the tree latch exclusively.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static bool _leafCovers(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const K& key,const BPlusPath<K,V>& path,const std::shared_ptr<BPlusNode<K,V>>& leaf){
+        if(!leaf || tree->root_node!=(path.empty()?leaf:path.front().node)){
+            return false;
+        }
+        for(size_t i=0;i<path.size();i++){
+            if(!BB::_stepLeadsTo(path[i], i+1<path.size()?path[i+1].node:leaf)){
+                return false;
+            }
+        }
+        return BB::_pathCovers(compare, key, path);
+    }
+
+    /**
+    Finds the leaf key goes into and the path to it, skipping the descent when hint still covers key.
+    Otherwise descends once as _descendToLeaf does, but first compares key with the last separator of each node,
+    so an append past it takes the last child without a search.
+    Caller must hold the tree latch exclusively.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<BPlusNode<K,V>> _leafForInsert(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const K& key,BPlusPath<K,V>& path,const BB_InsertHint<K,V>* hint){
+        if(hint && BB::_leafCovers(tree, compare, key, hint->path, hint->leaf)){
+            path=hint->path;
+            return hint->leaf;
+        }
+        path.clear();
+        std::shared_ptr<BPlusNode<K,V>> bpNode=tree->root_node;
+        while(bpNode && !bpNode->isLeaf){
+            BTREE_STATS_COUNT(node_visits, 1);
+            int size=bpNode->size();
+            int child_index=size>0 && compare(key, bpNode->keys[size-1])>0?size:LL::lowerBound(bpNode->keys, compare, key);
+            path.push_back(BPlusPathStep<K,V>{bpNode, child_index});
+            bpNode=bpNode->children[child_index];
+        }
+        BTREE_STATS_COUNT(node_visits, bpNode?1:0);
+        return bpNode;
+    }
+
+    /**
+    Latches the path hint went down from the root, checking each step still leads to the next node before latching that one:
+    internal nodes shared into latches, the leaf exclusively into leafGuard. Returns whether hint still leads to a leaf key belongs in,
+    nothing is left latched when it does not.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static bool _latchHint(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree,const C& compare,const K& key,const BB_InsertHint<K,V>& hint,std::vector<BPlusLatchGuard>& latches,BPlusLatchGuard& leafGuard){
+        auto& path=hint.path;
+        if(!hint.leaf){
+            return false;
+        }
+        {
+            BPlusLatchGuard rootGuard(tree->root_latch, true);
+            auto& root=path.empty()?hint.leaf:path.front().node;
+            if(tree->root_node!=root){
+                return false;
+            }
+            if(path.empty()){
+                leafGuard.lock(root->latch, false);
+            }else{
+                latches.emplace_back(root->latch, true);
+            }
+        }
+        for(size_t i=0;i<path.size();i++){
+            bool last=i+1==path.size();
+            auto& next=last?hint.leaf:path[i+1].node;
+            if(!BB::_stepLeadsTo(path[i], next)){
+                latches.clear();
+                return false;
+            }
+            if(last){
+                leafGuard.lock(next->latch, false);
+            }else{
+                latches.emplace_back(next->latch, true);
+            }
+        }
+        if(!BB::_pathCovers(compare, key, path)){
+            leafGuard.unlock();
+            latches.clear();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+    Finds the leaf key is written to by a write which does not restructure the tree, and the path to it.
+    The internal nodes of path are latched shared into latches and the leaf exclusively into leafGuard,
+    and they stay latched till the write has applied its counts to path. Goes down the path of hint when it still covers key,
+    otherwise descends as _leafForInsert does. Returns NULL when the tree is empty. Caller must hold the tree latch shared.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<BPlusNode<K,V>> _latchLeafForWrite(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree,const C& compare,const K& key,BPlusPath<K,V>& path,std::vector<BPlusLatchGuard>& latches,BPlusLatchGuard& leafGuard,const BB_InsertHint<K,V>* hint){
+        if(hint && BB::_latchHint(tree, compare, key, *hint, latches, leafGuard)){
+            path=hint->path;
+            return hint->leaf;
+        }
+        path.clear();
+        auto bpNode=BB::_latchRoot(tree, leafGuard, true);
+        while(bpNode && !bpNode->isLeaf){
+            BTREE_STATS_COUNT(node_visits, 1);
+            int size=bpNode->size();
+            int child_index=size>0 && compare(key, bpNode->keys[size-1])>0?size:LL::lowerBound(bpNode->keys, compare, key);
+            path.push_back(BPlusPathStep<K,V>{bpNode, child_index});
+            bpNode=bpNode->children[child_index];
+            latches.push_back(std::move(leafGuard));
+            leafGuard.lock(bpNode->latch, !bpNode->isLeaf);
+        }
+        BTREE_STATS_COUNT(node_visits, bpNode?1:0);
+        return bpNode;
+    }
+
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<K> _insert( std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,std::shared_ptr<K> key,V value,BB_InsertHint<K,V>* hint=NULL){
+        BTREE_STATS_OPERATION(tree, OP_INSERT);
+        BPlusPath<K,V> path;
+        {
+            BPlusLatchGuard treeGuard(tree->latch, true);
+            BB::_checkWritable(tree);
+            std::vector<BPlusLatchGuard> latches;
+            BPlusLatchGuard leafGuard;
+            //first only the leaf is latched exclusively, which works as long as it does not have to split
+            auto leafNode=BB::_latchLeafForWrite(tree, compare, *key, path, latches, leafGuard, hint);
+            //a leaf shared with a snapshot has to be copied along with its path, which needs the tree latched exclusively
+            if(leafNode && !BB::_isShared(tree, leafNode) && (leafNode->size()<tree->max_node_size || LL::search(leafNode->keys, compare, *key, SearchType::EqualsTo)>=0)){
+                auto added=BB::_insertIntoLeaf(tree, leafNode, compare, *key, std::move(value));
+                BB::_adjustPathCounts(path, added, false);
+                tree->size++;
+                if(hint){
+                    hint->path=std::move(path);
+                    hint->leaf=leafNode;
+                }
+                return key;
+            }
+            leafGuard.unlock();
+            latches.clear();
+
+            //then every node the split may reach is latched exclusively, see _latchPathForWrite
+            if(tree->open_snapshots.load()==0){
+                BPlusLatchGuard rootGuard;
+                leafNode=BB::_latchPathForWrite(tree, compare, *key, true, path, latches, rootGuard);
+                auto added=BB::_insertIntoLeaf(tree, leafNode, compare, *key, std::move(value));
+                BB::_adjustPathCounts(path, added, false);
+                if(hint){
+                    hint->path=path;
+                    hint->leaf=leafNode;
+                }
+                if(leafNode->size()>tree->max_node_size){
+                    bool append=!leafNode->rightSibling.lock() && compare(leafNode->keys.back(), *key)==0;
+                    BB::balance(tree, path, leafNode, append, &latches);
+                }
+                tree->size++;
+                return key;
+            }
+        }
+
+        BPlusLatchGuard treeGuard(tree->latch, false);
+        if(!tree->root_node){
+            tree->root_node=createBPlusNode(tree, true);
+            tree->left_most_node=tree->root_node;
+            tree->right_most_node=tree->root_node;
+        }
+
+        auto leafNode = BB::_leafForInsert(tree, compare, *key, path, hint);
+        if(leafNode){
+            BB::_copyPathForWrite(tree, path, leafNode);
+            auto added=BB::_insertIntoLeaf(tree, leafNode, compare, *key, std::move(value));
+            BB::_adjustPathCounts(path, added, false);
+            if(hint){
+                hint->path=path;
+                hint->leaf=leafNode;
+            }
+            //an insert only has to be balanced once it overflows the leaf, a short leaf (such as the rightmost one after appends) is left short
+            if(leafNode->size()>tree->max_node_size){
+                bool append=leafNode==tree->right_most_node && compare(leafNode->keys.back(), *key)==0;
+                BB::balance(tree, path, leafNode, append);
+            }
+            tree->size++;
+            return key;
+        }
+
+        return NULL;
+    }
+
+    //returns NULL if found no applicable leaf node
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> insert( std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> key,typename BPlusTree<K,V,Compare>::value_type value=V()){
+        return BB::_insert(tree, tree->compare, key, std::move(value));
+    }
+
+    //returns NULL if found no applicable leaf node
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> insert( std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> key,typename BPlusTree<K,V,Compare>::value_type value=V()){
+        return BB::_insert(tree, CellComparatorAdapter<K>(std::move(compare)), key, std::move(value));
+    }
+
+    /**
+    Same as insert, but goes straight to the leaf of the insert hint was last used for when key still belongs there, and then updates hint.
+    Inserts of keys close to each other (or in key order) with the same hint skip most descents.
+    */
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> insert( std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> key,typename BPlusTree<K,V,Compare>::value_type value,BB_InsertHint<K,V>& hint){
+        return BB::_insert(tree, tree->compare, key, std::move(value), &hint);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> insert( std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> key,typename BPlusTree<K,V,Compare>::value_type value,BB_InsertHint<K,V>& hint){
+        return BB::_insert(tree, CellComparatorAdapter<K>(std::move(compare)), key, std::move(value), &hint);
+    }
+
+    ///removes the entry at index of leafNode, moving its key and value out when they are asked for, returns the entries it removed
+    template<typename K,typename V>
+    static BPlusSubtreeCount _deleteFromLeaf(std::shared_ptr<BPlusNode<K,V>>& leafNode,int index,K* deletedKey,V* deletedValue){
+        auto k=LL::deleteAt(leafNode->keys, index);
+        auto duplicate_count=LL::deleteAt(leafNode->duplicate_counts, index);
+        auto v=LL::deleteAt(leafNode->values, index);
+        if(deletedKey){
+            *deletedKey=std::move(k);
+        }
+        if(deletedValue){
+            *deletedValue=std::move(v);
+        }
+        return BPlusSubtreeCount(1+duplicate_count, 1);
+    }
+
+    /**
+    Removes key along with its duplicates and rebalances, returns false if key was not found.
+    Removed key and value are moved into deletedKey and deletedValue when they are given.
+    */
+    template<typename K,typename V,typename Compare,typename C>
+    static bool _deleteKey(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const K& key,K* deletedKey,V* deletedValue) {
+        BTREE_STATS_OPERATION(tree, OP_DELETE);
+        BPlusPath<K,V> path;
+        {
+            BPlusLatchGuard treeGuard(tree->latch, true);
+            BB::_checkWritable(tree);
+            std::vector<BPlusLatchGuard> latches;
+            BPlusLatchGuard leafGuard;
+            //first only the leaf is latched exclusively, which works as long as it does not have to be merged or distributed
+            auto leafNode=BB::_latchLeafForWrite(tree, compare, key, path, latches, leafGuard, (const BB_InsertHint<K,V>*)NULL);
+            if(!leafNode){
+                return false;
+            }
+            int index=LL::search(leafNode->keys, compare, key, SearchType::EqualsTo);
+            if(index<0){
+                return false;
+            }
+            //root leaf only needs balancing once its empty
+            if(!BB::_isShared(tree, leafNode) && leafNode->size()>(path.empty()?1:tree->half_capacity)){
+                auto removed=BB::_deleteFromLeaf(leafNode, index, deletedKey, deletedValue);
+                BB::_adjustPathCounts(path, removed, true);
+                tree->size-=removed.entries;
+                return true;
+            }
+            leafGuard.unlock();
+            latches.clear();
+
+            //then every node the merge may reach is latched exclusively, see _latchPathForWrite
+            if(tree->open_snapshots.load()==0){
+                BPlusLatchGuard rootGuard;
+                leafNode=BB::_latchPathForWrite(tree, compare, key, false, path, latches, rootGuard);
+                index=leafNode?LL::search(leafNode->keys, compare, key, SearchType::EqualsTo):-1;
+                if(index<0){
+                    return false;
+                }
+                auto removed=BB::_deleteFromLeaf(leafNode, index, deletedKey, deletedValue);
+                tree->size-=removed.entries;
+                BB::_adjustPathCounts(path, removed, true);
+                BB::balance(tree, path, leafNode, false, &latches);
+                return true;
+            }
+        }
+
+        BPlusLatchGuard treeGuard(tree->latch, false);
+        if(!tree->root_node){
+            return false;
+        }
+        path.clear();
+        auto leafNode = BB::_descendToLeaf(tree, compare, key, &path);
+        int index=LL::search(leafNode->keys, compare, key, SearchType::EqualsTo);
+        if(index<0){
+            return false;
+        }
+
+        BB::_copyPathForWrite(tree, path, leafNode);
+        auto removed=BB::_deleteFromLeaf(leafNode, index, deletedKey, deletedValue);
+        tree->size-=removed.entries;
+        BB::_adjustPathCounts(path, removed, true);
+        BB::balance(tree, path, leafNode);
+        return true;
+    }
+
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<K> _deleteKeyReturnKey(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,std::shared_ptr<K> key) {
+        K deletedKey;
+        if(BB::_deleteKey(tree, compare, *key, &deletedKey, (V*)NULL)){
+            return std::make_shared<K>(std::move(deletedKey));
+        }
+        return NULL;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> deleteKey(std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> key) {
+        return BB::_deleteKeyReturnKey(tree, tree->compare, key);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> deleteKey(std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> key) {
+        return BB::_deleteKeyReturnKey(tree, CellComparatorAdapter<K>(std::move(compare)), key);
+    }
+
+    template<typename K,typename V,typename Compare,typename C>
+    static V _deleteKeyReturnValue(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,std::shared_ptr<K> key) {
+        V deletedValue=V();
+        BB::_deleteKey(tree, compare, *key, (K*)NULL, &deletedValue);
+        return deletedValue;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static V deleteKeyReturnValue(std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<K> key) {
+        return BB::_deleteKeyReturnValue(tree, tree->compare, key);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static V deleteKeyReturnValue(std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> key) {
+        return BB::_deleteKeyReturnValue(tree, CellComparatorAdapter<K>(std::move(compare)), key);
+    }
+
+    template<typename K,typename V>
+    static const K& _entryKey(const std::pair<K,V>& entry){
+        return entry.first;
+    }
+
+    template<typename K,typename V>
+    static const V& _entryValue(const std::pair<K,V>& entry){
+        return entry.second;
+    }
+
+    template<typename K,typename V>
+    static const K& _entryKey(const BB_KV<K,V>& entry){
+        return entry.key;
+    }
+
+    template<typename K,typename V>
+    static const V& _entryValue(const BB_KV<K,V>& entry){
+        return entry.value;
+    }
+
+    /**
+    Sizes of consecutive groups when count items are packed target at a time,
+    the last group is evened out with the one before it (or merged into it) so that no group is under minimum.
+    */
+    inline std::vector<int> _packedGroupSizes(int count,int target,int minimum){
+        std::vector<int> sizes;
+        while(count>0){
+            int size=count<target?count:target;
+            sizes.push_back(size);
+            count-=size;
+        }
+        if(sizes.size()>1 && sizes.back()<minimum){
+            int total=sizes[sizes.size()-2]+sizes.back();
+            sizes.pop_back();
+            if(total>=2*minimum){
+                sizes.back()=total-total/2;
+                sizes.push_back(total/2);
+            }else{
+                sizes.back()=total;
+            }
+        }
+        return sizes;
+    }
+
+    template<typename K,typename V>
+    static void _linkLevel(std::vector<std::shared_ptr<BPlusNode<K,V>>>& level){
+        for(size_t i=1;i<level.size();i++){
+            level[i-1]->rightSibling=level[i];
+            level[i]->leftSibling=level[i-1];
+        }
+    }
+
+    /**
+    Builds the tree bottom up from entries in [begin, end), which must be sorted by the tree comparator.
+    Entries are std::pair<K,V> or BB_KV<K,V>, equal keys are collapsed into duplicates with the last value winning, just like insert does.
+
+    Leaves and internal nodes are packed to fill_factor of max_node_size (never below half_capacity),
+    so a tree which will mostly be read can be loaded full, and one which will take inserts can be left room to grow.
+    Tree must be empty.
+    */
+    template<typename K,typename V,typename Compare,typename It>
+    static void bulkLoad(std::shared_ptr<BPlusTree<K,V,Compare>> tree,It begin,It end,double fill_factor=1.0){
+        BTREE_STATS_OPERATION(tree, OP_BULK_LOAD);
+        BB::_checkWritable(tree);
+        BPlusLatchGuard treeGuard(tree->latch, false);
+        if(tree->root_node){
+            throw "${Const.BalancedTrees}: bulkLoad needs an empty tree";
+        }
+        if(!(fill_factor>0 && fill_factor<=1)){
+            throw "${Const.BalancedTrees}: fill_factor must be in (0, 1]";
+        }
+        int target=(int)(tree->max_node_size*fill_factor);
+        if(target<tree->half_capacity){
+            target=tree->half_capacity;
+        }
+
+        //1. streaming entries into leaves of target size
+        std::vector<std::shared_ptr<BPlusNode<K,V>>> level;
+        std::shared_ptr<BPlusNode<K,V>> leaf;
+        uint64_t size=0;
+        for(It it=begin;it!=end;++it){
+            const K& key=BB::_entryKey(*it);
+            if(leaf && leaf->size()>0){
+                int c=tree->compare(key, leaf->keys.back());
+                if(c<0){
+                    throw "${Const.BalancedTrees}: bulkLoad input must be sorted";
+                }
+                if(c==0){
+                    leaf->duplicate_counts.back()++;
+                    leaf->keys.back()=key;
+                    leaf->values.back()=BB::_entryValue(*it);
+                    size++;
+                    continue;
+                }
+            }
+            if(!leaf || leaf->size()==target){
+                leaf=createBPlusNode(tree, true);
+                level.push_back(leaf);
+            }
+            leaf->keys.push_back(key);
+            leaf->duplicate_counts.push_back(0);
+            leaf->values.push_back(BB::_entryValue(*it));
+            size++;
+        }
+        if(level.empty()){
+            return;
+        }
+
+        //last leaf may be under half capacity, even it out with the one before it
+        if(level.size()>1 && level.back()->size()<tree->half_capacity){
+            auto last=level.back();
+            auto previous=level[level.size()-2];
+            int total=previous->size()+last->size();
+            if(total>=2*tree->half_capacity){
+                int moveCount=previous->size()-(total-total/2);
+                LL::shiftIntoRight(previous->keys, last->keys, moveCount);
+                LL::shiftIntoRight(previous->duplicate_counts, last->duplicate_counts, moveCount);
+                LL::shiftIntoRight(previous->values, last->values, moveCount);
+            }else{
+                LL::mergeSplittedRightIntoLeft(previous->keys, last->keys);
+                LL::mergeSplittedRightIntoLeft(previous->duplicate_counts, last->duplicate_counts);
+                LL::mergeSplittedRightIntoLeft(previous->values, last->values);
+                level.pop_back();
+            }
+        }
+        for(auto& node : level){
+            BB::_compressLeaf(tree->compare, node.get(), -1, 0);
+        }
+        _linkLevel(level);
+        tree->left_most_node=level.front();
+        tree->right_most_node=level.back();
+
+        //separators[i] sits between level[i] and level[i+1], for leaves its the max of the left leaf or a shorter key
+        std::vector<K> separators;
+        for(size_t i=0;i+1<level.size();i++){
+            separators.push_back(_separator(tree->compare, level[i]->keys.back(), level[i+1]->keys.front(), 0));
+        }
+
+        //2. internal levels, a node with target keys has target+1 children
+        while(level.size()>1){
+            auto groups=_packedGroupSizes((int)level.size(), target+1, tree->half_capacity+1);
+            std::vector<std::shared_ptr<BPlusNode<K,V>>> parents;
+            std::vector<K> parentSeparators;
+            size_t child=0;
+            for(size_t g=0;g<groups.size();g++){
+                auto node=createBPlusNode(tree, false);
+                for(int i=0;i<groups[g];i++,child++){
+                    node->children.push_back(level[child]);
+                    node->child_counts.push_back(level[child]->subtreeCount());
+                    if(i>0){
+                        node->keys.push_back(std::move(separators[child-1]));
+                    }
+                }
+                //separator after the last child of this node moves up a level
+                if(child<level.size()){
+                    parentSeparators.push_back(std::move(separators[child-1]));
+                }
+                parents.push_back(node);
+            }
+            _linkLevel(parents);
+            level.swap(parents);
+            separators.swap(parentSeparators);
+        }
+
+        tree->root_node=level.front();
+        tree->size=size;
+    }
+
+    ///greatest key which the leaf at the end of path may hold, NULL if it is the right most leaf
+    template<typename K,typename V>
+    static const K* _leafUpperBound(BPlusPath<K,V>& path){
+        for(auto step=path.rbegin();step!=path.rend();++step){
+            if(step->child_index<step->node->size()){
+                return &step->node->keys[step->child_index];
+            }
+        }
+        return NULL;
+    }
+
+    /**
+    Inserts entries in [begin, end), std::pair<K,V> or BB_KV<K,V>, which need not be sorted.
+    Result is the same as inserting them one by one in order: equal keys are collapsed into duplicates and the last value wins.
+
+    Entries are sorted, then each leaf is found once for the run of entries which falls into it,
+    the run is merged into the leaf and the leaf is balanced once, splitting it into as many nodes as needed.
+    */
+    template<typename K,typename V,typename Compare,typename It>
+    static void insertBatch(std::shared_ptr<BPlusTree<K,V,Compare>> tree,It begin,It end){
+        BTREE_STATS_OPERATION(tree, OP_INSERT_BATCH);
+        BB::_checkWritable(tree);
+        typedef typename std::iterator_traits<It>::value_type Entry;
+        std::vector<const Entry*> entries;
+        for(It it=begin;it!=end;++it){
+            entries.push_back(&*it);
+        }
+        if(entries.empty()){
+            return;
+        }
+        //stable, so equal keys stay in insertion order and the last value wins
+        const Compare& compare=tree->compare;
+        std::stable_sort(entries.begin(), entries.end(), [&compare](const Entry* a,const Entry* b){
+            return compare(BB::_entryKey(*a), BB::_entryKey(*b))<0;
+        });
+
+        //leaves get split and merged all through a batch, so its applied with the tree latched exclusively
+        BPlusLatchGuard treeGuard(tree->latch, false);
+
+        if(!tree->root_node){
+            tree->root_node=createBPlusNode(tree, true);
+            tree->left_most_node=tree->root_node;
+            tree->right_most_node=tree->root_node;
+        }
+
+        //merge buffers are swapped with the leaf arrays, so they keep circulating instead of being allocated per leaf
+        const std::shared_ptr<SlabPool>& pool=tree->pool;
+        SlabVector<K> keys{SlabAllocator<K>(pool)};
+        SlabVector<int> duplicate_counts{SlabAllocator<int>(pool)};
+        SlabVector<V> values{SlabAllocator<V>(pool)};
+        auto keyIsLesser=[&compare](const K& k1,const K& k2){
+            return compare(k1, k2)<0;
+        };
+
+        BPlusPath<K,V> path;
+        size_t next=0;
+        while(next<entries.size()){
+            path.clear();
+            auto leafNode=BB::_descendToLeaf(tree, compare, BB::_entryKey(*entries[next]), &path);
+            BB::_copyPathForWrite(tree, path, leafNode);
+            const K* upperBound=BB::_leafUpperBound(path);
+
+            //run of entries not greater than upperBound goes into this leaf
+            size_t runEnd=next+1;
+            while(runEnd<entries.size() && (!upperBound || compare(BB::_entryKey(*entries[runEnd]), *upperBound)<=0)){
+                runEnd++;
+            }
+
+            //a lone entry is cheaper to shift in than to merge the whole leaf for
+            if(runEnd-next==1){
+                auto added=BB::_insertIntoLeaf(tree, leafNode, compare, BB::_entryKey(*entries[next]), V(BB::_entryValue(*entries[next])));
+                next=runEnd;
+                tree->size++;
+                BB::_adjustPathCounts(path, added, false);
+                if(added.keys>0){
+                    BB::balance(tree, path, leafNode);
+                }
+                continue;
+            }
+
+            keys.clear();
+            duplicate_counts.clear();
+            values.clear();
+            size_t reserve=leafNode->size()+(runEnd-next);
+            keys.reserve(reserve);
+            duplicate_counts.reserve(reserve);
+            values.reserve(reserve);
+
+            BPlusSubtreeCount added;
+            int index=0;
+            for(;next<runEnd;next++){
+                const K& key=BB::_entryKey(*entries[next]);
+                //leaf entries lesser than key are block moved
+                int lesser=(int)(std::lower_bound(leafNode->keys.begin()+index, leafNode->keys.end(), key, keyIsLesser)-leafNode->keys.begin());
+                if(index<lesser){
+                    keys.insert(keys.end(), std::make_move_iterator(leafNode->keys.begin()+index), std::make_move_iterator(leafNode->keys.begin()+lesser));
+                    duplicate_counts.insert(duplicate_counts.end(), leafNode->duplicate_counts.begin()+index, leafNode->duplicate_counts.begin()+lesser);
+                    values.insert(values.end(), std::make_move_iterator(leafNode->values.begin()+index), std::make_move_iterator(leafNode->values.begin()+lesser));
+                    index=lesser;
+                }
+                if(index<leafNode->size() && compare(leafNode->keys[index], key)==0){
+                    //key moves into the merged arrays, which take care of later duplicates in the run
+                    keys.push_back(std::move(leafNode->keys[index]));
+                    duplicate_counts.push_back(leafNode->duplicate_counts[index]);
+                    values.push_back(std::move(leafNode->values[index]));
+                    index++;
+                }
+                if(!keys.empty() && compare(keys.back(), key)==0){
+                    duplicate_counts.back()++;
+                    keys.back()=key;
+                    values.back()=BB::_entryValue(*entries[next]);
+                    added+=BPlusSubtreeCount(1, 0);
+                }else{
+                    keys.push_back(key);
+                    duplicate_counts.push_back(0);
+                    values.push_back(BB::_entryValue(*entries[next]));
+                    added+=BPlusSubtreeCount(1, 1);
+                }
+            }
+            keys.insert(keys.end(), std::make_move_iterator(leafNode->keys.begin()+index), std::make_move_iterator(leafNode->keys.end()));
+            duplicate_counts.insert(duplicate_counts.end(), leafNode->duplicate_counts.begin()+index, leafNode->duplicate_counts.end());
+            values.insert(values.end(), std::make_move_iterator(leafNode->values.begin()+index), std::make_move_iterator(leafNode->values.end()));
+            leafNode->keys.swap(keys);
+            leafNode->duplicate_counts.swap(duplicate_counts);
+            leafNode->values.swap(values);
+            BB::_compressLeaf(tree->compare, leafNode.get(), -1, 0);
+
+            tree->size+=added.entries;
+            BB::_adjustPathCounts(path, added, false);
+            BB::balance(tree, path, leafNode);
+        }
+    }
+
+    /**
+    Removes keys in [begin, end) along with their duplicates, keys need not be sorted and missing keys are skipped.
+    Each leaf is found once for the run of keys which falls into it and is balanced once after all of them are removed.
+    Returns the number of keys which were found and removed.
+    */
+    template<typename K,typename V,typename Compare,typename It>
+    static uint64_t deleteBatch(std::shared_ptr<BPlusTree<K,V,Compare>> tree,It begin,It end){
+        BTREE_STATS_OPERATION(tree, OP_DELETE_BATCH);
+        BB::_checkWritable(tree);
+        std::vector<const K*> keys;
+        for(It it=begin;it!=end;++it){
+            keys.push_back(&*it);
+        }
+        const Compare& compare=tree->compare;
+        std::sort(keys.begin(), keys.end(), [&compare](const K* a,const K* b){
+            return compare(*a, *b)<0;
+        });
+
+        BPlusLatchGuard treeGuard(tree->latch, false);
+        uint64_t deleted=0;
+        BPlusPath<K,V> path;
+        size_t next=0;
+        while(next<keys.size() && tree->root_node){
+            path.clear();
+            auto leafNode=BB::_descendToLeaf(tree, compare, *keys[next], &path);
+            BB::_copyPathForWrite(tree, path, leafNode);
+            const K* upperBound=BB::_leafUpperBound(path);
+
+            //compacting the leaf in place, skipping entries whose key is in the run
+            BPlusSubtreeCount removed;
+            int kept=0;
+            for(int index=0;index<leafNode->size();index++){
+                while(next<keys.size() && compare(*keys[next], leafNode->keys[index])<0){
+                    next++;
+                }
+                if(next<keys.size() && compare(*keys[next], leafNode->keys[index])==0){
+                    removed+=BPlusSubtreeCount(leafNode->duplicate_counts[index]+1, 1);
+                    continue;
+                }
+                if(kept!=index){
+                    leafNode->keys[kept]=std::move(leafNode->keys[index]);
+                    leafNode->duplicate_counts[kept]=leafNode->duplicate_counts[index];
+                    leafNode->values[kept]=std::move(leafNode->values[index]);
+                }
+                kept++;
+            }
+            leafNode->keys.erase(leafNode->keys.begin()+kept, leafNode->keys.end());
+            leafNode->duplicate_counts.erase(leafNode->duplicate_counts.begin()+kept, leafNode->duplicate_counts.end());
+            leafNode->values.erase(leafNode->values.begin()+kept, leafNode->values.end());
+
+            //rest of the run was not in the leaf
+            while(next<keys.size() && (!upperBound || compare(*keys[next], *upperBound)<=0)){
+                next++;
+            }
+
+            deleted+=removed.keys;
+            tree->size-=removed.entries;
+            BB::_adjustPathCounts(path, removed, true);
+            BB::balance(tree, path, leafNode);
+        }
+        return deleted;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static uint64_t getSize(std::shared_ptr<BPlusTree<K,V,Compare>> tree){
+        return tree->size;
+    }
+
+    ///heap memory item owns outside of its own bytes
+    template<typename T>
+    static uint64_t _heapBytes(const T&){
+        return 0;
+    }
+
+    inline uint64_t _heapBytes(const std::string& item){
+        //short strings are kept inline
+        return item.capacity()>std::string().capacity()?item.capacity()+1:0;
+    }
+
+    ///a shared prefix (string and control block) is split over the keys pointing at it
+    inline uint64_t _heapBytes(const BPlusPrefixedString& item){
+        uint64_t bytes=_heapBytes(item.suffix);
+        if(item.prefix){
+            bytes+=(sizeof(std::string)+2*sizeof(void*)+_heapBytes(*item.prefix))/item.prefix.use_count();
+        }
+        return bytes;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static void _nodeStats(std::shared_ptr<BPlusTree<K,V,Compare>>& tree,BPlusNode<K,V>* node,int depth,BPlusTreeStats& stats){
+        if((int)stats.levels.size()<=depth){
+            stats.levels.resize(depth+1);
+        }
+        BPlusLevelStats& level=stats.levels[depth];
+        //leaves can change under concurrent writers, internal nodes are frozen by the tree latch
+        BPlusLatchGuard leafGuard;
+        if(node->isLeaf){
+            leafGuard.lock(node->latch, true);
+        }
+        int fill=node->size();
+        level.min_fill=level.nodes==0?fill:std::min(level.min_fill, fill);
+        level.max_fill=std::max(level.max_fill, fill);
+        level.nodes++;
+        level.keys+=fill;
+        if(depth>0 && fill<tree->half_capacity){
+            level.underfull_nodes++;
+        }
+
+        //allocate_shared puts the control block (vtable pointer, use and weak counts and the allocator) in the node block
+        stats.node_bytes+=sizeof(BPlusNode<K,V>);
+        stats.control_block_bytes+=sizeof(void*)+2*sizeof(int)+sizeof(SlabAllocator<char>);
+        stats.key_bytes+=node->keys.capacity()*sizeof(K);
+        for(const K& key : node->keys){
+            stats.key_heap_bytes+=BB::_heapBytes(key);
+        }
+        if(node->isLeaf){
+            stats.value_bytes+=node->values.capacity()*sizeof(V);
+            stats.duplicate_count_bytes+=node->duplicate_counts.capacity()*sizeof(int);
+            for(const V& value : node->values){
+                stats.value_heap_bytes+=BB::_heapBytes(value);
+            }
+            for(int duplicates : node->duplicate_counts){
+                stats.duplicates+=duplicates;
+                stats.entries+=duplicates+1;
+            }
+            stats.distinct_keys+=fill;
+            return;
+        }
+        stats.child_bytes+=node->children.capacity()*sizeof(std::shared_ptr<BPlusNode<K,V>>)+node->child_counts.capacity()*sizeof(BPlusSubtreeCount);
+        for(auto& child : node->children){
+            BB::_nodeStats(tree, child.get(), depth+1, stats);
+        }
+    }
+
+    /**
+    Height, fill per level, leaf chain length, duplicates and estimated memory of tree, in one walk over its nodes.
+    Nothing is allocated per entry or per node, only per level. The tree is latched exclusively for the walk, which does not latch nodes.
+    */
+    template<typename K,typename V,typename Compare>
+    static BPlusTreeStats stats(std::shared_ptr<BPlusTree<K,V,Compare>> tree){
+        BPlusTreeStats stats;
+        stats.max_node_size=tree->max_node_size;
+        stats.half_capacity=tree->half_capacity;
+        BPlusLatchGuard treeGuard(tree->latch, false);
+        if(tree->root_node){
+            BB::_nodeStats(tree, tree->root_node.get(), 0, stats);
+        }
+        stats.height=(int)stats.levels.size();
+        for(BPlusLevelStats& level : stats.levels){
+            level.avg_fill=level.nodes?(double)level.keys/level.nodes:0;
+            level.avg_fill_ratio=level.avg_fill/tree->max_node_size;
+        }
+        if(tree->snapshot_of){
+            //snapshots do not follow sibling links
+            stats.leaf_chain_length=stats.levels.empty()?0:stats.levels.back().nodes;
+        }else{
+            for(auto leaf=tree->left_most_node;leaf;leaf=leaf->rightSibling.lock()){
+                stats.leaf_chain_length++;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(tree->pool->mutex);
+            stats.pool_bytes_reserved=tree->pool->bytes_reserved;
+            stats.pool_bytes_in_use=tree->pool->bytes_in_use.load();
+        }
+        return stats;
+    }
+
+#ifdef BTREE_STATS
+    ///copies the counters of tree out, for scraping into metrics
+    template<typename K,typename V,typename Compare>
+    static BPlusCounters<uint64_t> counters(std::shared_ptr<BPlusTree<K,V,Compare>> tree){
+        const BPlusCounters<std::atomic<uint64_t>>& live=tree->counters;
+        BPlusCounters<uint64_t> copy{};
+        copy.comparisons=live.comparisons.load(std::memory_order_relaxed);
+        copy.node_visits=live.node_visits.load(std::memory_order_relaxed);
+        copy.leaves_scanned=live.leaves_scanned.load(std::memory_order_relaxed);
+        for(int i=0;i<BPLUS_BALANCE_CASES;i++){
+            copy.balance_cases[i]=live.balance_cases[i].load(std::memory_order_relaxed);
+        }
+        for(int op=0;op<OPERATION_COUNT;op++){
+            copy.operations[op]=live.operations[op].load(std::memory_order_relaxed);
+            for(int bucket=0;bucket<BPLUS_LATENCY_BUCKETS;bucket++){
+                copy.latency[op][bucket]=live.latency[op][bucket].load(std::memory_order_relaxed);
+            }
+        }
+        return copy;
+    }
+#endif
+
+    /**
+    Read only view of tree as it is now, later writes to tree do not show up in it. Nothing is copied up front:
+    tree moves to a new version, and while a snapshot is open its writers copy the older nodes on their path before writing to them.
+    Nodes which only snapshots still hold are freed along with the last of them.
+    A snapshot is read with the usual BB functions without ever waiting on writers of tree, writing to it throws.
+    */
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusTree<K,V,Compare>> snapshot(std::shared_ptr<BPlusTree<K,V,Compare>> tree){
+        if(tree->snapshot_of){
+            return tree;
+        }
+        BPlusLatchGuard treeGuard(tree->latch, false);
+        std::shared_ptr<BPlusTree<K,V,Compare>> view(new BPlusTree<K,V,Compare>(tree->max_node_size, tree->compare));
+        view->pool=tree->pool;
+        view->joined_pools=tree->joined_pools;
+        view->root_node=tree->root_node;
+        view->left_most_node=tree->left_most_node;
+        view->right_most_node=tree->right_most_node;
+        view->size=tree->size.load();
+        view->version=tree->version;
+        view->snapshot_of=tree;
+        tree->open_snapshots++;
+        tree->version++;
+        return view;
+    }
+
+    ///node, or what is left of it once internal nodes with a single child and empty leaves are dropped from its top, NULL if nothing is
+    template<typename K,typename V>
+    static std::shared_ptr<BPlusNode<K,V>> _trimRoot(std::shared_ptr<BPlusNode<K,V>> node){
+        while(node && !node->isLeaf && node->children.size()<=1){
+            auto child=node->children.empty()?std::shared_ptr<BPlusNode<K,V>>():node->children[0];
+            _unlinkFromSiblings(node);
+            node=child;
+        }
+        if(node && node->isLeaf && node->size()==0){
+            _unlinkFromSiblings(node);
+            return NULL;
+        }
+        return node;
+    }
+
+    ///nodes down the left (or right) edge of the subtree below node, indexed by height, leaf first
+    template<typename K,typename V>
+    static std::vector<std::shared_ptr<BPlusNode<K,V>>> _edge(std::shared_ptr<BPlusNode<K,V>> node,bool right){
+        std::vector<std::shared_ptr<BPlusNode<K,V>>> edge;
+        for(;node;node=node->isLeaf?std::shared_ptr<BPlusNode<K,V>>():(right?node->children.back():node->children.front())){
+            edge.push_back(node);
+        }
+        std::reverse(edge.begin(), edge.end());
+        return edge;
+    }
+
+    /**
+    Makes tree->root_node the root of the entries below left followed by those below right, every key below left being lesser than every key below right.
+    The lower of the two is hung next to the edge of the taller one facing it and evened out with its new sibling there,
+    the edge is then split upwards if it overflowed, so only nodes along that edge are restructured.
+    Leaves and internal nodes are linked across the seam on every level the two share.
+    Caller must hold the tree latch exclusively.
+    */
+    template<typename K,typename V,typename Compare>
+    static void _joinNodes(std::shared_ptr<BPlusTree<K,V,Compare>> tree,std::shared_ptr<BPlusNode<K,V>> left,std::shared_ptr<BPlusNode<K,V>> right){
+        left=_trimRoot(left);
+        right=_trimRoot(right);
+        if(!left || !right){
+            tree->root_node=left?left:right;
+            return;
+        }
+
+        auto leftEdge=_edge(left, true);
+        auto rightEdge=_edge(right, false);
+        int leftHeight=(int)leftEdge.size()-1;
+        int rightHeight=(int)rightEdge.size()-1;
+        for(int height=0;height<=std::min(leftHeight, rightHeight);height++){
+            leftEdge[height]->rightSibling=rightEdge[height];
+            rightEdge[height]->leftSibling=leftEdge[height];
+        }
+        K separator=_separator(tree->compare, leftEdge[0]->keys.back(), rightEdge[0]->keys.front(), 0);
+
+        if(leftHeight==rightHeight){
+            auto root=createBPlusNode<K,V>(tree, false);
+            root->keys.push_back(std::move(separator));
+            root->children.push_back(left);
+            root->children.push_back(right);
+            root->child_counts.push_back(left->subtreeCount());
+            root->child_counts.push_back(right->subtreeCount());
+            tree->root_node=root;
+
+            //either side may be short, as roots are allowed to be
+            BPlusPath<K,V> path{BPlusPathStep<K,V>{root, 0}};
+            BB::balance(tree, path, left);
+            if(tree->root_node==root && root->children.size()==2){
+                path={BPlusPathStep<K,V>{root, 1}};
+                BB::balance(tree, path, right);
+            }
+            return;
+        }
+
+        bool lower_is_right=rightHeight<leftHeight;
+        auto lower=lower_is_right?right:left;
+        auto& edge=lower_is_right?leftEdge:rightEdge;
+        int lowerHeight=std::min(leftHeight, rightHeight);
+        tree->root_node=edge.back();
+
+        //the node on the edge one level above lower takes it in as its outer child
+        BPlusPath<K,V> path;
+        for(int height=(int)edge.size()-1;height>lowerHeight+1;height--){
+            path.push_back(BPlusPathStep<K,V>{edge[height], lower_is_right?edge[height]->size():0});
+        }
+        auto parent_node=edge[lowerHeight+1];
+        BPlusSubtreeCount count=lower->subtreeCount();
+        if(lower_is_right){
+            parent_node->keys.push_back(std::move(separator));
+            parent_node->children.push_back(lower);
+            parent_node->child_counts.push_back(count);
+        }else{
+            parent_node->keys.insert(parent_node->keys.begin(), std::move(separator));
+            parent_node->children.insert(parent_node->children.begin(), lower);
+            parent_node->child_counts.insert(parent_node->child_counts.begin(), count);
+        }
+        _adjustPathCounts(path, count, false);
+
+        BPlusPath<K,V> lowerPath=path;
+        lowerPath.push_back(BPlusPathStep<K,V>{parent_node, lower_is_right?parent_node->size():0});
+        BB::balance(tree, lowerPath, lower);
+        //a distribution leaves parent_node a key longer
+        BB::balance(tree, path, parent_node);
+    }
+
+    ///sets the leaf chain ends and size of tree from its root
+    template<typename K,typename V,typename Compare>
+    static void _resetFromRoot(std::shared_ptr<BPlusTree<K,V,Compare>> tree){
+        tree->root_node=_trimRoot(tree->root_node);
+        auto root=tree->root_node;
+        tree->left_most_node=root?_edge(root, false).front():std::shared_ptr<BPlusNode<K,V>>();
+        tree->right_most_node=root?_edge(root, true).front():std::shared_ptr<BPlusNode<K,V>>();
+        tree->size=root?root->subtreeCount().entries.load():0;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static void _checkRestructurable(const std::shared_ptr<BPlusTree<K,V,Compare>>& tree){
+        _checkWritable(tree);
+        if(tree->open_snapshots.load()>0){
+            throw "${Const.BalancedTrees}: tree can not be split or joined while a snapshot of it is open";
+        }
+    }
+
+    ///_splitTree for a caller which holds the latch of tree exclusively and has checked that no snapshot of it is open
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<BPlusTree<K,V,Compare>> _splitLatched(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const K& key){
+        std::shared_ptr<BPlusTree<K,V,Compare>> right(new BPlusTree<K,V,Compare>(tree->max_node_size, tree->compare));
+        right->pool=tree->pool;
+        right->joined_pools=tree->joined_pools;
+        right->version=tree->version;
+        if(!tree->root_node){
+            return right;
+        }
+
+        //every node on the path to key is cut in two: what is left of the path stays in the node, the rest goes into a new one
+        std::vector<std::shared_ptr<BPlusNode<K,V>>> leftPieces;
+        std::vector<std::shared_ptr<BPlusNode<K,V>>> rightPieces;
+        auto node=tree->root_node;
+        while(node){
+            auto rightPiece=createBPlusNode<K,V>(tree, node->isLeaf);
+            std::shared_ptr<BPlusNode<K,V>> child;
+            if(node->isLeaf){
+                int index=LL::lowerBound(node->keys, compare, key);
+                LL::splitAt(node->keys, index-1, rightPiece->keys);
+                LL::splitAt(node->duplicate_counts, index-1, rightPiece->duplicate_counts);
+                LL::splitAt(node->values, index-1, rightPiece->values);
+            }else{
+                //keys on either side of child are dropped, joining the pieces back up puts in separators of their own
+                int child_index=LL::lowerBound(node->keys, compare, key);
+                child=node->children[child_index];
+                LL::splitAt(node->keys, std::min(child_index, node->size()-1), rightPiece->keys);
+                LL::splitAt(node->children, child_index, rightPiece->children);
+                LL::splitAt(node->child_counts, child_index, rightPiece->child_counts);
+                node->keys.erase(node->keys.begin()+std::max(child_index-1, 0), node->keys.end());
+                node->children.pop_back();
+                node->child_counts.pop_back();
+            }
+
+            auto oldRight=node->rightSibling.lock();
+            rightPiece->rightSibling=oldRight;
+            if(oldRight){
+                oldRight->leftSibling=rightPiece;
+            }
+            node->rightSibling.reset();
+
+            leftPieces.push_back(node);
+            rightPieces.push_back(rightPiece);
+            node=child;
+        }
+
+        //pieces are joined bottom up, each one into the tree built out of the pieces below it
+        tree->root_node=leftPieces.back();
+        right->root_node=rightPieces.back();
+        for(int level=(int)leftPieces.size()-2;level>=0;level--){
+            _joinNodes(tree, leftPieces[level], tree->root_node);
+            _joinNodes(right, right->root_node, rightPieces[level]);
+        }
+        _resetFromRoot(tree);
+        _resetFromRoot(right);
+        return right;
+    }
+
+    template<typename K,typename V,typename Compare,typename C>
+    static std::shared_ptr<BPlusTree<K,V,Compare>> _splitTree(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,const K& key){
+        _checkWritable(tree);
+        //snapshots are opened with the tree latched, so checking for them under the latch leaves no gap for one to open in
+        BPlusLatchGuard treeGuard(tree->latch, false);
+        _checkRestructurable(tree);
+        return BB::_splitLatched(tree, compare, key);
+    }
+
+    /**
+    Moves every entry with a key greater than or equals to key out of tree into a new tree, which is returned.
+    Only the nodes on the path to key are cut and joined back up, so it takes O(log n) node restructures whatever the number of entries moved.
+    The new tree shares the node pool of tree. Throws while a snapshot of tree is open.
+    */
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusTree<K,V,Compare>> splitTree(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const K& key){
+        return BB::_splitTree(tree, tree->compare, key);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusTree<K,V,Compare>> splitTree(std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,const K& key){
+        return BB::_splitTree(tree, CellComparatorAdapter<K>(std::move(compare)), key);
+    }
+
+    ///latches two trees exclusively, always in the same order, so two joins of the same trees can not deadlock
+    template<typename K,typename V,typename Compare>
+    static void _latchPair(const std::shared_ptr<BPlusTree<K,V,Compare>>& left,const std::shared_ptr<BPlusTree<K,V,Compare>>& right,BPlusLatchGuard& firstGuard,BPlusLatchGuard& secondGuard){
+        bool leftFirst=left.get()<right.get();
+        firstGuard.lock(leftFirst?left->latch:right->latch, false);
+        secondGuard.lock(leftFirst?right->latch:left->latch, false);
+    }
+
+    ///joinTrees for a caller which holds the latches of both trees exclusively and has checked that no snapshot of either is open
+    template<typename K,typename V,typename Compare>
+    static void _joinLatched(std::shared_ptr<BPlusTree<K,V,Compare>> left,std::shared_ptr<BPlusTree<K,V,Compare>> right){
+        if(left->right_most_node && right->left_most_node && left->compare(left->right_most_node->keys.back(), right->left_most_node->keys.front())>=0){
+            throw "${Const.BalancedTrees}: keys of trees to join overlap";
+        }
+
+        if(right->pool!=left->pool){
+            left->joined_pools.push_back(right->pool);
+        }
+        for(auto& pool : right->joined_pools){
+            if(pool!=left->pool && std::find(left->joined_pools.begin(), left->joined_pools.end(), pool)==left->joined_pools.end()){
+                left->joined_pools.push_back(pool);
+            }
+        }
+        //nodes of right keep their versions, which must not be mistaken for ones created after the next snapshot of left
+        left->version=std::max(left->version, right->version);
+
+        //the rightmost leaf of left may be short after appends (see split), which it may only be while its the rightmost one
+        auto last=left->right_most_node;
+        if(last && last!=left->root_node && last->size()<left->half_capacity){
+            BPlusPath<K,V> path;
+            for(auto bpNode=left->root_node;!bpNode->isLeaf;bpNode=bpNode->children.back()){
+                path.push_back(BPlusPathStep<K,V>{bpNode, bpNode->size()});
+            }
+            BB::balance(left, path, last);
+        }
+        _joinNodes(left, left->root_node, right->root_node);
+        _resetFromRoot(left);
+        right->root_node=NULL;
+        right->left_most_node=NULL;
+        right->right_most_node=NULL;
+        right->size=0;
+    }
+
+    /**
+    Moves every entry of right into left, right is left empty. Every key of left must be lesser than every key of right.
+    The lower of the two trees is hung from the edge of the taller one, so it takes O(log n) node restructures whatever their sizes.
+    Both trees must have the same max_node_size. Throws while a snapshot of either is open.
+    */
+    template<typename K,typename V,typename Compare>
+    static void joinTrees(std::shared_ptr<BPlusTree<K,V,Compare>> left,std::shared_ptr<BPlusTree<K,V,Compare>> right){
+        if(left==right){
+            throw "${Const.BalancedTrees}: a tree can not be joined with itself";
+        }
+        _checkWritable(left);
+        _checkWritable(right);
+        if(left->max_node_size!=right->max_node_size){
+            throw "${Const.BalancedTrees}: trees to join must have the same node_size";
+        }
+        BPlusLatchGuard firstGuard;
+        BPlusLatchGuard secondGuard;
+        BB::_latchPair(left, right, firstGuard, secondGuard);
+        _checkRestructurable(left);
+        _checkRestructurable(right);
+        BB::_joinLatched(left, right);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> getMiddleKey(std::shared_ptr<BPlusTree<K,V,Compare>> tree){
+        BTREE_STATS_OPERATION(tree, OP_MIDDLE_KEY);
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        int index;
+        auto found_leaf_node = BB::_select(tree, getSize(tree)/2, false, index, leafGuard);
+        if(found_leaf_node){
+            return std::make_shared<K>(found_leaf_node->keys[index]);
+        }
+        return NULL;
+    }
+
+
+    template<typename K,typename T,typename Compare,typename C>
+    static std::shared_ptr<std::vector<std::shared_ptr<BB_KV_P<K,T>>>> _searchForRangeWithPaginationKVP( std::shared_ptr<BPlusTree<K,std::shared_ptr<void>,Compare>> tree,const C& compare,int offset,int limit,std::shared_ptr<K> startKey,std::shared_ptr<K> endKey){
+        BTREE_STATS_OPERATION(tree, OP_RANGE);
+        std::shared_ptr<std::vector<std::shared_ptr<BB_KV_P<K,T>>>> result(new std::vector<std::shared_ptr<BB_KV_P<K,T>>>());
+        BB::_scanRange(tree, compare, offset, limit, startKey, endKey, [&result](std::shared_ptr<BPlusNode<K,std::shared_ptr<void>>>& node,int index){
+            auto kvp = std::shared_ptr<BB_KV_P<K,T>>(new BB_KV_P<K,T>(std::make_shared<K>(node->keys[index]),std::static_pointer_cast<T>(node->values[index])));
+            result->push_back(kvp);
+        });
+        return result;
+    }
+
+    ///for trees with untyped values, values are cast to V
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<BB_KV_P<K,V>>>> searchForRangeWithPaginationKVP( std::shared_ptr<BPlusTree<K,std::shared_ptr<void>,Compare>> tree,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_searchForRangeWithPaginationKVP<K,V>(tree, tree->compare, offset, limit, startKey, endKey);
     }
 
-    ///Source is always right sibling
+    ///for trees with untyped values, values are cast to V
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<BB_KV_P<K,V>>>> searchForRangeWithPaginationKVP( std::shared_ptr<BPlusTree<K,std::shared_ptr<void>,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_searchForRangeWithPaginationKVP<K,V>(tree, CellComparatorAdapter<K>(std::move(compare)), offset, limit, startKey, endKey);
+    }
+
+    ///same as searchForRangeWithPaginationKVP, but keys and values are copied into the result by value
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<BB_KV<K,V>>> searchForRangeWithPaginationKV( std::shared_ptr<BPlusTree<K,V,Compare>> tree,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        BTREE_STATS_OPERATION(tree, OP_RANGE);
+        std::shared_ptr<std::vector<BB_KV<K,V>>> result(new std::vector<BB_KV<K,V>>());
+        BB::_scanRange(tree, tree->compare, offset, limit, startKey, endKey, [&result](std::shared_ptr<BPlusNode<K,V>>& node,int index){
+            result->push_back(BB_KV<K,V>{node->keys[index], node->values[index]});
+        });
+        return result;
+    }
+
+    /**
+    Where a columnar export of a range (BB::exportRange) goes on from: after the last key it exported.
+    Start a new export with a fresh one, done is set once the range is used up.
+    */
     template<typename K>
-    static std::shared_ptr<BPlusNode<K>> merge(
-        std::shared_ptr<BPlusTree<K>> tree ,
-        std::shared_ptr<BPlusNode<K>> source,
-        std::shared_ptr<BPlusNode<K>> target,
-        ComparatorFunction<BPlusCell<K>> customCompare){
-        //its assumed that source and target size are all calculated before hand, and this is indeed a case of merge
+    struct BB_ExportCursor{
+        K last_key=K();
+        bool started=false;
+        bool done=false;
+    };
+
+    template<typename K,typename V,typename Compare,typename C>
+    static size_t _exportRange(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const C& compare,BB_ExportCursor<K>& cursor,size_t capacity,K* keys,V* values,int* duplicate_counts,std::shared_ptr<K> startKey,std::shared_ptr<K> endKey){
+        if(cursor.done || capacity==0){
+            return 0;
+        }
+        BTREE_STATS_OPERATION(tree, OP_RANGE);
+        BPlusLatchGuard treeGuard(tree->latch, true);
+        BPlusLatchGuard leafGuard;
+        int index=0;
+        std::shared_ptr<BPlusNode<K,V>> leaf;
+        if(cursor.started){
+            leaf=BB::_seek(tree, compare, cursor.last_key, SearchType::GreaterThan, index, leafGuard);
+        }else if(startKey){
+            leaf=BB::_seek(tree, compare, *startKey, SearchType::GreaterThanOrEqualsTo, index, leafGuard);
+        }else{
+            leaf=BB::_firstLeaf(tree, leafGuard);
+        }
+
+        size_t count=0;
+        while(leaf && count<capacity){
+            BTREE_STATS_COUNT(leaves_scanned, 1);
+            int size=leaf->size();
+            int end=endKey?LL::upperBound(leaf->keys, compare, *endKey):size;
+            //leaf arrays are contiguous, so a batch is filled with block copies
+            int copy=(int)std::min<size_t>(std::max(end-index, 0), capacity-count);
+            if(keys){
+                std::copy(leaf->keys.begin()+index, leaf->keys.begin()+index+copy, keys+count);
+            }
+            if(values){
+                std::copy(leaf->values.begin()+index, leaf->values.begin()+index+copy, values+count);
+            }
+            if(duplicate_counts){
+                std::copy(leaf->duplicate_counts.begin()+index, leaf->duplicate_counts.begin()+index+copy, duplicate_counts+count);
+            }
+            count+=copy;
+            if(copy>0){
+                cursor.last_key=leaf->keys[index+copy-1];
+                cursor.started=true;
+            }
+            if(index+copy<std::max(end, index)){
+                return count;
+            }
+            if(end<size){
+                cursor.done=true;
+                return count;
+            }
+            leaf=BB::_siblingLeaf(tree, compare, leaf, true);
+            if(leaf){
+                leafGuard.handOver(leaf->latch);
+            }
+            index=0;
+        }
+        if(!leaf){
+            cursor.done=true;
+        }
+        return count;
+    }
+
+    /**
+    Copies the next batch of at most capacity entries with startKey <= key <= endKey (NULL bounds are open) into caller owned columns,
+    keys[i], values[i] and duplicate_counts[i] (any of which may be NULL to leave it out), and returns how many were copied, 0 once cursor is done.
+    Each call goes on after the last key the previous one copied, found again with one descent, so batches stay in order under concurrent writes.
+    Duplicates are copied once, as range scans yield them. Nothing is allocated per entry.
+    */
+    template<typename K,typename V,typename Compare>
+    static size_t exportRange(std::shared_ptr<BPlusTree<K,V,Compare>> tree,BB_ExportCursor<K>& cursor,size_t capacity,K* keys,V* values,int* duplicate_counts=NULL,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_exportRange(tree, tree->compare, cursor, capacity, keys, values, duplicate_counts, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static size_t exportRange(std::shared_ptr<BPlusTree<K,V,Compare>> tree, ComparatorFunction<BPlusCell<K>>  compare,BB_ExportCursor<K>& cursor,size_t capacity,K* keys,V* values,int* duplicate_counts=NULL,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_exportRange(tree, CellComparatorAdapter<K>(std::move(compare)), cursor, capacity, keys, values, duplicate_counts, startKey, endKey);
+    }
+
+    ///entries and distinct keys under page
+    template<typename K,typename V>
+    static BPlusPageCount _pageCount(const BPlusPageLayout<K,V>& layout,const BPlusPageNode* page){
+        BPlusPageCount total{0, 0};
+        if(page->is_leaf){
+            const int32_t* duplicate_counts=layout.duplicateCounts(page);
+            for(uint32_t i=0;i<page->count;i++){
+                total.entries+=duplicate_counts[i]+1;
+            }
+            total.keys=page->count;
+        }else{
+            const BPlusPageCount* counts=layout.childCounts(page);
+            for(uint32_t i=0;i<=page->count;i++){
+                total.entries+=counts[i].entries;
+                total.keys+=counts[i].keys;
+            }
+        }
+        return total;
+    }
+
+    ///one page of the level below, as seen by the level being built above it
+    struct _PageLevelEntry{
+        uint64_t page;
+        BPlusPageCount count;
+    };
+
+    /**
+    Writes tree into a page file at path, which BB::openPages can serve reads from without loading it.
+    Leaves are packed full in key order and internal pages are built bottom up over them, so the file does not depend on max_node_size.
+    The file is written next to path and renamed over it once its complete, so readers never map a partial file.
+
+    The tree is scanned like a range scan, pass a snapshot of it to write a point in time view while writers go on.
+    K and V are written by their bytes, so they must be trivially copyable.
+    */
+    template<typename K,typename V,typename Compare>
+    static void writePages(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const std::string& path,uint32_t page_size=4096){
+        static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value, "page files hold keys and values by their bytes");
+        BPlusPageLayout<K,V> layout(page_size);
+        std::string temporary=path+".tmp";
+        int fd=::open(temporary.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+        if(fd<0){
+            throw "${Const.BalancedTrees}: cannot create page file";
+        }
+
+        std::vector<char> buffer(page_size);
+        BPlusPageNode* node=(BPlusPageNode*)buffer.data();
+        uint64_t page_count=1;
+        bool failed=false;
+        auto writePage=[&](){
+            if(!failed && pwrite(fd, buffer.data(), page_size, (off_t)(page_count*page_size))!=(ssize_t)page_size){
+                failed=true;
+            }
+            page_count++;
+            std::fill(buffer.begin(), buffer.end(), 0);
+        };
+
+        //1. leaves, in order of their page ids
+        std::vector<_PageLevelEntry> level;
+        std::vector<K> separators;
+        uint64_t size=0;
+        BB::_scanRange(tree, tree->compare, 0, -1, std::shared_ptr<K>(), std::shared_ptr<K>(), [&](std::shared_ptr<BPlusNode<K,V>>& leaf,int index){
+            if(!level.empty() && node->count==layout.leaf_capacity){
+                node->right_sibling=page_count+1;
+                const K& last=((K*)(buffer.data()+layout.leaf_keys))[node->count-1];
+                separators.push_back(_separator(tree->compare, last, leaf->keys[index], 0));
+                writePage();
+            }
+            if(level.empty() || node->count==0){
+                node->is_leaf=1;
+                node->left_sibling=level.empty()?0:page_count-1;
+                level.push_back(_PageLevelEntry{page_count, BPlusPageCount{0, 0}});
+            }
+            uint32_t slot=node->count++;
+            ((K*)(buffer.data()+layout.leaf_keys))[slot]=leaf->keys[index];
+            ((int32_t*)(buffer.data()+layout.leaf_duplicate_counts))[slot]=leaf->duplicate_counts[index];
+            ((V*)(buffer.data()+layout.leaf_values))[slot]=leaf->values[index];
+            level.back().count.entries+=leaf->duplicate_counts[index]+1;
+            level.back().count.keys++;
+            size+=leaf->duplicate_counts[index]+1;
+        });
+        //the last leaf is evened out with the one before it, so that only a lone root leaf is under half full (see _pageRebalance)
+        if(level.size()>1 && node->count<layout.leaf_capacity/2){
+            std::vector<char> previousBuffer(page_size);
+            BPlusPageNode* previous=(BPlusPageNode*)previousBuffer.data();
+            if(failed || pread(fd, previousBuffer.data(), page_size, (off_t)((page_count-1)*page_size))!=(ssize_t)page_size){
+                failed=true;
+            }else{
+                int count=(int)node->count;
+                int total=(int)previous->count+count;
+                int keep=total-total/2;
+                int move=(int)previous->count-keep;
+                K* keys=layout.keys(node);
+                int32_t* duplicate_counts=layout.duplicateCounts(node);
+                V* values=layout.values(node);
+                std::copy_backward(keys, keys+count, keys+count+move);
+                std::copy_backward(duplicate_counts, duplicate_counts+count, duplicate_counts+count+move);
+                std::copy_backward(values, values+count, values+count+move);
+                std::copy(layout.keys(previous)+keep, layout.keys(previous)+keep+move, keys);
+                std::copy(layout.duplicateCounts(previous)+keep, layout.duplicateCounts(previous)+keep+move, duplicate_counts);
+                std::copy(layout.values(previous)+keep, layout.values(previous)+keep+move, values);
+                previous->count=(uint32_t)keep;
+                node->count=(uint32_t)total/2;
+                level[level.size()-2].count=_pageCount(layout, previous);
+                level.back().count=_pageCount(layout, node);
+                separators.back()=_separator(tree->compare, layout.keys(previous)[keep-1], keys[0], 0);
+                if(pwrite(fd, previousBuffer.data(), page_size, (off_t)((page_count-1)*page_size))!=(ssize_t)page_size){
+                    failed=true;
+                }
+            }
+        }
+        uint64_t left_most_page=0;
+        uint64_t right_most_page=0;
+        if(!level.empty()){
+            left_most_page=level.front().page;
+            right_most_page=level.back().page;
+            writePage();
+        }
+
+        //2. internal levels, packed as bulkLoad does
+        while(level.size()>1){
+            auto groups=_packedGroupSizes((int)level.size(), (int)layout.internal_capacity+1, ((int)layout.internal_capacity+1)/2);
+            std::vector<_PageLevelEntry> parents;
+            std::vector<K> parentSeparators;
+            size_t child=0;
+            for(size_t g=0;g<groups.size();g++){
+                node->is_leaf=0;
+                node->count=(uint32_t)groups[g]-1;
+                node->left_sibling=g>0?page_count-1:0;
+                node->right_sibling=g+1<groups.size()?page_count+1:0;
+                K* keys=(K*)(buffer.data()+layout.internal_keys);
+                uint64_t* children=(uint64_t*)(buffer.data()+layout.internal_children);
+                BPlusPageCount* counts=(BPlusPageCount*)(buffer.data()+layout.internal_counts);
+                BPlusPageCount total{0, 0};
+                for(int i=0;i<groups[g];i++,child++){
+                    children[i]=level[child].page;
+                    counts[i]=level[child].count;
+                    total.entries+=level[child].count.entries;
+                    total.keys+=level[child].count.keys;
+                    if(i>0){
+                        keys[i-1]=separators[child-1];
+                    }
+                }
+                if(child<level.size()){
+                    parentSeparators.push_back(separators[child-1]);
+                }
+                parents.push_back(_PageLevelEntry{page_count, total});
+                writePage();
+            }
+            level.swap(parents);
+            separators.swap(parentSeparators);
+        }
+
+        BPlusPageHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, BPLUS_PAGE_MAGIC, sizeof(header.magic));
+        header.format_version=BPLUS_PAGE_FORMAT_VERSION;
+        header.page_size=page_size;
+        header.key_size=sizeof(K);
+        header.value_size=sizeof(V);
+        header.leaf_capacity=layout.leaf_capacity;
+        header.internal_capacity=layout.internal_capacity;
+        header.page_count=page_count;
+        header.root_page=level.empty()?0:level.front().page;
+        header.left_most_page=left_most_page;
+        header.right_most_page=right_most_page;
+        header.size=size;
+        std::fill(buffer.begin(), buffer.end(), 0);
+        std::memcpy(buffer.data(), &header, sizeof(header));
+        if(!failed && pwrite(fd, buffer.data(), page_size, 0)!=(ssize_t)page_size){
+            failed=true;
+        }
+        if(!failed && fsync(fd)!=0){
+            failed=true;
+        }
+        if(close(fd)!=0){
+            failed=true;
+        }
+        if(failed || std::rename(temporary.c_str(), path.c_str())!=0){
+            unlink(temporary.c_str());
+            throw "${Const.BalancedTrees}: cannot write page file";
+        }
+    }
+
+    ///reads and checks the header of a page file for K and V, throwing if its not one
+    template<typename K,typename V>
+    static BPlusPageHeader _readPageHeader(int fd,size_t& length){
+        struct stat status;
+        BPlusPageHeader header;
+        if(fstat(fd, &status)!=0 || (size_t)status.st_size<sizeof(header) || pread(fd, &header, sizeof(header), 0)!=(ssize_t)sizeof(header)){
+            throw "${Const.BalancedTrees}: cannot read page file header";
+        }
+        if(std::memcmp(header.magic, BPLUS_PAGE_MAGIC, sizeof(header.magic))!=0 || header.format_version!=BPLUS_PAGE_FORMAT_VERSION){
+            throw "${Const.BalancedTrees}: not a page file";
+        }
+        BPlusPageLayout<K,V> layout(header.page_size);
+        if(header.key_size!=sizeof(K) || header.value_size!=sizeof(V) || header.page_count*header.page_size>(uint64_t)status.st_size
+            || layout.leaf_capacity!=header.leaf_capacity || layout.internal_capacity!=header.internal_capacity){
+            throw "${Const.BalancedTrees}: page file does not match the key and value types";
+        }
+        length=(size_t)status.st_size;
+        return header;
+    }
+
+    /**
+    Maps the page file at path written by BB::writePages, in O(1): only its header is read.
+    Compare must order keys as the comparator of the tree which was written did.
+    */
+    template<typename K,typename V,typename Compare=ThreeWayCompare<K>>
+    static std::shared_ptr<BPlusMappedTree<K,V,Compare>> openPages(const std::string& path,Compare compare=Compare()){
+        static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value, "page files hold keys and values by their bytes");
+        int fd=::open(path.c_str(), O_RDONLY);
+        if(fd<0){
+            throw "${Const.BalancedTrees}: cannot open page file";
+        }
+        std::shared_ptr<BPlusMappedTree<K,V,Compare>> tree;
+        try{
+            size_t length;
+            BPlusPageHeader header=_readPageHeader<K,V>(fd, length);
+            tree.reset(new BPlusMappedTree<K,V,Compare>(header.page_size, std::move(compare)));
+            tree->header=header;
+            tree->length=length;
+        }catch(...){
+            close(fd);
+            throw;
+        }
+        void* base=mmap(NULL, tree->length, PROT_READ, MAP_SHARED, fd, 0);
+        //the mapping holds on to the file by itself
+        close(fd);
+        if(base==MAP_FAILED){
+            throw "${Const.BalancedTrees}: cannot map page file";
+        }
+        tree->base=(const char*)base;
+        return tree;
+    }
+
+    /**
+    Opens the page file at path written by BB::writePages for reads and writes, caching at most frame_count pages in memory.
+    Changes reach the file as dirty pages are evicted, and all of them with BB::flush or when the tree goes away.
+    Compare must order keys as the comparator of the tree which was written did.
+    */
+    template<typename K,typename V,typename Compare=ThreeWayCompare<K>>
+    static std::shared_ptr<BPlusPagedTree<K,V,Compare>> openPagedTree(const std::string& path,size_t frame_count,BPlusEvictionPolicy policy=CLOCK_EVICTION,Compare compare=Compare()){
+        static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value, "page files hold keys and values by their bytes");
+        //a split pins the leaf, its new sibling and the next one at once
+        if(frame_count<4){
+            throw "${Const.BalancedTrees}: a buffer pool needs at least 4 frames";
+        }
+        int fd=::open(path.c_str(), O_RDWR);
+        if(fd<0){
+            throw "${Const.BalancedTrees}: cannot open page file";
+        }
+        std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree;
+        try{
+            size_t length;
+            BPlusPageHeader header=_readPageHeader<K,V>(fd, length);
+            tree.reset(new BPlusPagedTree<K,V,Compare>(header.page_size, std::move(compare)));
+            tree->header=header;
+            tree->pool.reset(new BPlusBufferPool(fd, header.page_size, frame_count, policy));
+        }catch(...){
+            close(fd);
+            throw;
+        }
+        tree->fd=fd;
+        return tree;
+    }
+
+    ///writes all changes of tree to its page file and syncs it
+    template<typename K,typename V,typename Compare>
+    static void flush(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree){
+        BPlusLatchGuard guard(tree->latch, false);
+        tree->flush();
+    }
+
+    template<typename K,typename V,typename Compare>
+    static uint64_t getSize(std::shared_ptr<BPlusMappedTree<K,V,Compare>> tree){
+        return tree->header.size;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static uint64_t getSize(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree){
+        BPlusLatchGuard guard(tree->latch, true);
+        return tree->header.size;
+    }
+
+    ///page of a mapped or paged tree, pinned until it moves to another page or goes away
+    template<typename T>
+    struct _PinnedPage{
+        T* tree;
+        uint64_t id=0;
+        const BPlusPageNode* page=NULL;
 
-        //1. Find effective parent cell
-        auto effectiveNode = source;
-        auto effective_parent_cell= BB::find_effective_parent_cell<K>(effectiveNode);
+        _PinnedPage(T* tree):tree(tree){
+
+        }
+
+        _PinnedPage(const _PinnedPage&)=delete;
+        _PinnedPage& operator=(const _PinnedPage&)=delete;
+
+        ~_PinnedPage(){
+            this->release();
+        }
+
+        const BPlusPageNode* pin(uint64_t id){
+            this->release();
+            if(id){
+                this->page=this->tree->pinPage(id);
+                this->id=id;
+            }
+            return this->page;
+        }
 
-        //2. handling first cell for target
-        if(!source->isLeaf){
-        auto right_child_node = source->left_most_child;
-        auto first_cell_for_target= createBPlusCell<K>(effective_parent_cell->key, right_child_node, target);
-        LL::insert(target->cellsList,customCompare, first_cell_for_target);
+        void release(){
+            if(this->page){
+                this->tree->unpinPage(this->id);
+                this->page=NULL;
+                this->id=0;
+            }
         }
+    };
 
-        //3. Merge source cellsList in target
-        LL::mergeSplittedRightIntoLeft(target->cellsList, source->cellsList);
-        reinforceParentShipInChildNodes(target);
+    ///same as _seek, over the pages of a mapped or paged tree, leaves the page found pinned in pinned
+    template<typename T,typename C>
+    static bool _pageSeek(T* tree,const C& compare,const typename T::key_type& key,SearchType searchType,_PinnedPage<T>& pinned,int& index){
+        const BPlusPageNode* page=pinned.pin(tree->header.root_page);
+        if(!page){
+            return false;
+        }
+        while(!page->is_leaf){
+            int child_index=LL::lowerBound(tree->layout.keys(page), (int)page->count, compare, key);
+            page=pinned.pin(tree->layout.children(page)[child_index]);
+        }
+        index=LL::search(tree->layout.keys(page), (int)page->count, compare, key, searchType);
+        switch(searchType){
+            case SearchType::EqualsTo:
+                break;
+            case SearchType::LesserThanOrEqualsTo:
+            case SearchType::LesserThan:
+                while(index<0 && page->left_sibling){
+                    page=pinned.pin(page->left_sibling);
+                    index=(int)page->count-1;
+                }
+                break;
+            case SearchType::GreaterThanOrEqualsTo:
+            case SearchType::GreaterThan:
+                while(index<0 && page->right_sibling){
+                    page=pinned.pin(page->right_sibling);
+                    index=page->count>0?0:-1;
+                }
+                break;
+        }
+        return index>=0;
+    }
 
-        //4. set up new siblings relationship, disconnect old sibling relation of source node
-        target->rightSibling=source->rightSibling;
-        if(source->rightSibling.lock()){
-        source->rightSibling.lock()->leftSibling.lock()=target;
+    ///same as _rank, over the pages of a mapped or paged tree
+    template<typename T,typename C>
+    static uint64_t _pageRank(T* tree,const C& compare,const typename T::key_type& key,bool inclusive,bool distinct){
+        uint64_t rank=0;
+        _PinnedPage<T> pinned(tree);
+        const BPlusPageNode* page=pinned.pin(tree->header.root_page);
+        if(!page){
+            return 0;
+        }
+        while(!page->is_leaf){
+            int child_index=LL::lowerBound(tree->layout.keys(page), (int)page->count, compare, key);
+            const BPlusPageCount* counts=tree->layout.childCounts(page);
+            for(int i=0;i<child_index;i++){
+                rank+=distinct?counts[i].keys:counts[i].entries;
+            }
+            page=pinned.pin(tree->layout.children(page)[child_index]);
+        }
+        const typename T::key_type* keys=tree->layout.keys(page);
+        int end=inclusive?LL::upperBound(keys, (int)page->count, compare, key):LL::lowerBound(keys, (int)page->count, compare, key);
+        rank+=end;
+        if(!distinct){
+            const int32_t* duplicate_counts=tree->layout.duplicateCounts(page);
+            for(int i=0;i<end;i++){
+                rank+=duplicate_counts[i];
+            }
         }
+        return rank;
+    }
 
-        //5. Remove parent relation of sourcenode
-        if(source->isLeftMostNode()){
-            auto replacement_key= source->parent_node.lock()->cellsList->min->key->key;
-            auto deletedN= LL::deleteNode(source->parent_node.lock()->cellsList, customCompare, createBPlusCell<K>(replacement_key, NULL,NULL));
-            if(deletedN && deletedN->key){
-                auto deletedKey=deletedN->key;
-                if(deletedKey->right_child_node)
-                setAsLeftMostChildNode(source->parent_node.lock(),deletedKey->right_child_node);   
+    ///same as _select, over the pages of a mapped or paged tree, leaves the page found pinned in pinned
+    template<typename T>
+    static bool _pageSelect(T* tree,uint64_t position,bool distinct,_PinnedPage<T>& pinned,int& index){
+        const BPlusPageNode* page=pinned.pin(tree->header.root_page);
+        if(!page){
+            return false;
+        }
+        while(!page->is_leaf){
+            const BPlusPageCount* counts=tree->layout.childCounts(page);
+            int child_index=0;
+            for(;child_index<(int)page->count;child_index++){
+                uint64_t count=distinct?counts[child_index].keys:counts[child_index].entries;
+                if(position<count){
+                    break;
+                }
+                position-=count;
+            }
+            page=pinned.pin(tree->layout.children(page)[child_index]);
+        }
+        const int32_t* duplicate_counts=tree->layout.duplicateCounts(page);
+        for(index=0;index<(int)page->count;index++){
+            uint64_t count=distinct?1:duplicate_counts[index]+1;
+            if(position<count){
+                return true;
             }
-            effective_parent_cell->key=replacement_key;
+            position-=count;
+        }
+        return false;
+    }
+
+    ///same as _scanRange, over the pages of a mapped or paged tree, yield(page, index) while page is pinned
+    template<typename T,typename C,typename Y>
+    static void _pageScanRange(T* tree,const C& compare,int offset,int limit,std::shared_ptr<typename T::key_type> startKey,std::shared_ptr<typename T::key_type> endKey,Y yield){
+        int index=0;
+        _PinnedPage<T> pinned(tree);
+        bool found;
+        if(offset>0){
+            uint64_t position=startKey?BB::_pageRank(tree, compare, *startKey, false, true):0;
+            found=BB::_pageSelect(tree, position+offset, true, pinned, index);
+        }else if(startKey){
+            found=BB::_pageSeek(tree, compare, *startKey, SearchType::GreaterThanOrEqualsTo, pinned, index);
         }else{
-            LL::deleteNode(source->parent_node.lock()->cellsList, customCompare,createBPlusCell<K>(source->parent_cell.lock()->key));
+            found=pinned.pin(tree->header.left_most_page)!=NULL;
+        }
+        const BPlusPageNode* page=found?pinned.page:NULL;
+
+        int count=0;
+        while(page && count!=limit){
+            int size=(int)page->count;
+            const typename T::key_type* keys=tree->layout.keys(page);
+            bool pageInRange= !endKey || compare(*endKey, keys[size-1])>=0;
+            for(;index<size;index++){
+                if(!pageInRange && compare(*endKey, keys[index])<0){
+                    return;
+                }
+                if(count==limit){
+                    return;
+                }
+                count++;
+                yield(page, index);
+            }
+            page=pinned.pin(page->right_sibling);
+            index=0;
+        }
+    }
+
+    template<typename T>
+    static std::shared_ptr<typename T::key_type> _pageSearchForKey(T* tree,const typename T::key_type& searchKey,SearchType searchType){
+        int index;
+        _PinnedPage<T> pinned(tree);
+        if(BB::_pageSeek(tree, tree->compare, searchKey, searchType, pinned, index)){
+            return std::make_shared<typename T::key_type>(tree->layout.keys(pinned.page)[index]);
+        }
+        return NULL;
+    }
+
+    template<typename T>
+    static bool _pageSearchForValue(T* tree,const typename T::key_type& searchKey,typename T::value_type& value,SearchType searchType){
+        int index;
+        _PinnedPage<T> pinned(tree);
+        if(BB::_pageSeek(tree, tree->compare, searchKey, searchType, pinned, index)){
+            value=tree->layout.values(pinned.page)[index];
+            return true;
+        }
+        return false;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> searchForKey(std::shared_ptr<BPlusMappedTree<K,V,Compare>> tree,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
+        return BB::_pageSearchForKey(tree.get(), *searchKey, searchType);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> searchForKey(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
+        BPlusLatchGuard guard(tree->latch, true);
+        return BB::_pageSearchForKey(tree.get(), *searchKey, searchType);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static bool searchForValue(std::shared_ptr<BPlusMappedTree<K,V,Compare>> tree,std::shared_ptr<K> searchKey,V& value,SearchType searchType = SearchType::EqualsTo){
+        return BB::_pageSearchForValue(tree.get(), *searchKey, value, searchType);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static bool searchForValue(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree,std::shared_ptr<K> searchKey,V& value,SearchType searchType = SearchType::EqualsTo){
+        BPlusLatchGuard guard(tree->latch, true);
+        return BB::_pageSearchForValue(tree.get(), *searchKey, value, searchType);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static V searchForValue(std::shared_ptr<BPlusMappedTree<K,V,Compare>> tree,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
+        V value=V();
+        BB::searchForValue(tree, searchKey, value, searchType);
+        return value;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static V searchForValue(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
+        V value=V();
+        BB::searchForValue(tree, searchKey, value, searchType);
+        return value;
+    }
+
+    template<typename T>
+    static std::shared_ptr<std::vector<std::shared_ptr<typename T::key_type>>> _pageRange(T* tree,int offset,int limit,std::shared_ptr<typename T::key_type> startKey,std::shared_ptr<typename T::key_type> endKey){
+        typedef typename T::key_type K;
+        std::shared_ptr<std::vector<std::shared_ptr<K>>> result(new std::vector<std::shared_ptr<K>>());
+        BB::_pageScanRange(tree, tree->compare, offset, limit, startKey, endKey, [&](const BPlusPageNode* page,int index){
+            result->push_back(std::make_shared<K>(tree->layout.keys(page)[index]));
+        });
+        return result;
+    }
+
+    template<typename T>
+    static std::shared_ptr<std::vector<typename T::value_type>> _pageRangeV(T* tree,int offset,int limit,std::shared_ptr<typename T::key_type> startKey,std::shared_ptr<typename T::key_type> endKey){
+        typedef typename T::value_type V;
+        std::shared_ptr<std::vector<V>> result(new std::vector<V>());
+        BB::_pageScanRange(tree, tree->compare, offset, limit, startKey, endKey, [&](const BPlusPageNode* page,int index){
+            result->push_back(tree->layout.values(page)[index]);
+        });
+        return result;
+    }
+
+    template<typename T>
+    static std::shared_ptr<std::vector<BB_KV<typename T::key_type,typename T::value_type>>> _pageRangeKV(T* tree,int offset,int limit,std::shared_ptr<typename T::key_type> startKey,std::shared_ptr<typename T::key_type> endKey){
+        typedef BB_KV<typename T::key_type,typename T::value_type> KV;
+        std::shared_ptr<std::vector<KV>> result(new std::vector<KV>());
+        BB::_pageScanRange(tree, tree->compare, offset, limit, startKey, endKey, [&](const BPlusPageNode* page,int index){
+            result->push_back(KV{tree->layout.keys(page)[index], tree->layout.values(page)[index]});
+        });
+        return result;
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> searchForRangeWithPagination(std::shared_ptr<BPlusMappedTree<K,V,Compare>> tree,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_pageRange(tree.get(), offset, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> searchForRangeWithPagination(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        BPlusLatchGuard guard(tree->latch, true);
+        return BB::_pageRange(tree.get(), offset, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<V>> searchForRangeWithPaginationV(std::shared_ptr<BPlusMappedTree<K,V,Compare>> tree,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_pageRangeV(tree.get(), offset, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<V>> searchForRangeWithPaginationV(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        BPlusLatchGuard guard(tree->latch, true);
+        return BB::_pageRangeV(tree.get(), offset, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<BB_KV<K,V>>> searchForRangeWithPaginationKV(std::shared_ptr<BPlusMappedTree<K,V,Compare>> tree,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_pageRangeKV(tree.get(), offset, limit, startKey, endKey);
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<BB_KV<K,V>>> searchForRangeWithPaginationKV(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        BPlusLatchGuard guard(tree->latch, true);
+        return BB::_pageRangeKV(tree.get(), offset, limit, startKey, endKey);
+    }
+
+    ///new page, taken from the free list before the file is grown, returned pinned and zeroed, callers unpin it dirty
+    template<typename K,typename V,typename Compare>
+    static BPlusPageNode* _pageAllocate(BPlusPagedTree<K,V,Compare>* tree,uint64_t& id){
+        BPlusBufferPool& pool=*tree->pool;
+        if(!tree->header.free_page){
+            id=tree->header.page_count++;
+            return (BPlusPageNode*)pool.pin(id, true);
+        }
+        id=tree->header.free_page;
+        BPlusPageNode* page=(BPlusPageNode*)pool.pin(id);
+        tree->header.free_page=page->right_sibling;
+        std::memset((void*)page, 0, tree->header.page_size);
+        return page;
+    }
+
+    ///puts page id, which nothing links to any more, at the head of the free list
+    template<typename K,typename V,typename Compare>
+    static void _pageFree(BPlusPagedTree<K,V,Compare>* tree,uint64_t id){
+        BPlusPageNode* page=(BPlusPageNode*)tree->pool->pin(id);
+        std::memset((void*)page, 0, tree->header.page_size);
+        page->right_sibling=tree->header.free_page;
+        tree->pool->unpin(id, true);
+        tree->header.free_page=id;
+    }
+
+    ///adds a page to the file for a split of page, linked in as its right sibling
+    template<typename K,typename V,typename Compare>
+    static BPlusPageNode* _pageSplitSibling(BPlusPagedTree<K,V,Compare>* tree,uint64_t id,BPlusPageNode* page,uint64_t& sibling_id){
+        BPlusBufferPool& pool=*tree->pool;
+        BPlusPageNode* sibling=_pageAllocate(tree, sibling_id);
+        sibling->is_leaf=page->is_leaf;
+        sibling->left_sibling=id;
+        sibling->right_sibling=page->right_sibling;
+        if(page->right_sibling){
+            BPlusPageNode* next=(BPlusPageNode*)pool.pin(page->right_sibling);
+            next->left_sibling=sibling_id;
+            pool.unpin(page->right_sibling, true);
+        }else if(page->is_leaf){
+            tree->header.right_most_page=sibling_id;
+        }
+        page->right_sibling=sibling_id;
+        return sibling;
+    }
+
+    /**
+    Puts separator and the right half of a split child into the parent at the end of path, splitting parents in turn while they are full.
+    path holds the internal pages of the descent and which child was followed in each.
+    */
+    template<typename K,typename V,typename Compare>
+    static void _pageInsertSplit(BPlusPagedTree<K,V,Compare>* tree,std::vector<std::pair<uint64_t,int>>& path,K separator,uint64_t left_id,BPlusPageCount left_count,uint64_t right_id,BPlusPageCount right_count){
+        BPlusBufferPool& pool=*tree->pool;
+        const BPlusPageLayout<K,V>& layout=tree->layout;
+        while(!path.empty()){
+            uint64_t id=path.back().first;
+            int child_index=path.back().second;
+            path.pop_back();
+            BPlusPageNode* page=(BPlusPageNode*)pool.pin(id);
+            K* keys=layout.keys(page);
+            uint64_t* children=layout.children(page);
+            BPlusPageCount* counts=layout.childCounts(page);
+            int count=(int)page->count;
+            if(count<(int)layout.internal_capacity){
+                std::copy_backward(keys+child_index, keys+count, keys+count+1);
+                std::copy_backward(children+child_index+1, children+count+1, children+count+2);
+                std::copy_backward(counts+child_index+1, counts+count+1, counts+count+2);
+                keys[child_index]=separator;
+                children[child_index+1]=right_id;
+                counts[child_index]=left_count;
+                counts[child_index+1]=right_count;
+                page->count++;
+                pool.unpin(id, true);
+                return;
+            }
+
+            //count+1 keys and count+2 children: the middle key moves up, the rest is halved
+            std::vector<K> all_keys(keys, keys+count);
+            std::vector<uint64_t> all_children(children, children+count+1);
+            std::vector<BPlusPageCount> all_counts(counts, counts+count+1);
+            all_keys.insert(all_keys.begin()+child_index, separator);
+            all_children.insert(all_children.begin()+child_index+1, right_id);
+            all_counts[child_index]=left_count;
+            all_counts.insert(all_counts.begin()+child_index+1, right_count);
+            int left=(count+1)/2;
+            int right=count-left;
+
+            uint64_t sibling_id;
+            BPlusPageNode* sibling=_pageSplitSibling(tree, id, page, sibling_id);
+            std::copy(all_keys.begin()+left+1, all_keys.end(), layout.keys(sibling));
+            std::copy(all_children.begin()+left+1, all_children.end(), layout.children(sibling));
+            std::copy(all_counts.begin()+left+1, all_counts.end(), layout.childCounts(sibling));
+            sibling->count=(uint32_t)right;
+            std::copy(all_keys.begin(), all_keys.begin()+left, keys);
+            std::copy(all_children.begin(), all_children.begin()+left+1, children);
+            std::copy(all_counts.begin(), all_counts.begin()+left+1, counts);
+            page->count=(uint32_t)left;
+
+            separator=all_keys[left];
+            left_id=id;
+            left_count=_pageCount(layout, page);
+            right_id=sibling_id;
+            right_count=_pageCount(layout, sibling);
+            pool.unpin(sibling_id, true);
+            pool.unpin(id, true);
+        }
+
+        //the root split
+        uint64_t root_id;
+        BPlusPageNode* root=_pageAllocate(tree, root_id);
+        root->is_leaf=0;
+        root->count=1;
+        layout.keys(root)[0]=separator;
+        layout.children(root)[0]=left_id;
+        layout.children(root)[1]=right_id;
+        layout.childCounts(root)[0]=left_count;
+        layout.childCounts(root)[1]=right_count;
+        pool.unpin(root_id, true);
+        tree->header.root_page=root_id;
+    }
+
+    ///descends to the leaf for key, recording the internal pages and followed children in path, and returns it pinned
+    template<typename K,typename V,typename Compare>
+    static BPlusPageNode* _pageDescend(BPlusPagedTree<K,V,Compare>* tree,const K& key,std::vector<std::pair<uint64_t,int>>& path,uint64_t& id){
+        BPlusBufferPool& pool=*tree->pool;
+        id=tree->header.root_page;
+        while(true){
+            BPlusPageNode* page=(BPlusPageNode*)pool.pin(id);
+            if(page->is_leaf){
+                return page;
+            }
+            int child_index=LL::lowerBound(tree->layout.keys(page), (int)page->count, tree->compare, key);
+            uint64_t child=tree->layout.children(page)[child_index];
+            pool.unpin(id, false);
+            path.push_back(std::make_pair(id, child_index));
+            id=child;
+        }
+    }
+
+    ///adds change to the child counts along path
+    template<typename K,typename V,typename Compare>
+    static void _pageAddCounts(BPlusPagedTree<K,V,Compare>* tree,const std::vector<std::pair<uint64_t,int>>& path,int64_t entries,int64_t keys){
+        for(auto& step : path){
+            BPlusPageNode* page=(BPlusPageNode*)tree->pool->pin(step.first);
+            BPlusPageCount& count=tree->layout.childCounts(page)[step.second];
+            count.entries+=entries;
+            count.keys+=keys;
+            tree->pool->unpin(step.first, true);
+        }
+    }
+
+    ///inserts into a paged tree, faulting in the pages of one descent and splitting full ones on the way back up
+    template<typename K,typename V,typename Compare>
+    static void insert(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree,std::shared_ptr<K> key,V value){
+        BPlusLatchGuard guard(tree->latch, false);
+        BPlusBufferPool& pool=*tree->pool;
+        const BPlusPageLayout<K,V>& layout=tree->layout;
+        BPlusPageHeader& header=tree->header;
+        if(!header.root_page){
+            uint64_t id;
+            BPlusPageNode* leaf=_pageAllocate(tree.get(), id);
+            leaf->is_leaf=1;
+            pool.unpin(id, true);
+            header.root_page=header.left_most_page=header.right_most_page=id;
         }
 
-        if(source==tree->right_most_node){
-        tree->right_most_node=target;
+        std::vector<std::pair<uint64_t,int>> path;
+        uint64_t id;
+        BPlusPageNode* leaf=_pageDescend(tree.get(), *key, path, id);
+        K* keys=layout.keys(leaf);
+        int32_t* duplicate_counts=layout.duplicateCounts(leaf);
+        V* values=layout.values(leaf);
+        int count=(int)leaf->count;
+        int index=LL::lowerBound(keys, count, tree->compare, *key);
+        header.size++;
+        if(index<count && tree->compare(*key, keys[index])==0){
+            duplicate_counts[index]++;
+            keys[index]=*key;
+            values[index]=value;
+            pool.unpin(id, true);
+            _pageAddCounts(tree.get(), path, 1, 0);
+            return;
+        }
+        _pageAddCounts(tree.get(), path, 1, 1);
+        if(count<(int)layout.leaf_capacity){
+            std::copy_backward(keys+index, keys+count, keys+count+1);
+            std::copy_backward(duplicate_counts+index, duplicate_counts+count, duplicate_counts+count+1);
+            std::copy_backward(values+index, values+count, values+count+1);
+            keys[index]=*key;
+            duplicate_counts[index]=0;
+            values[index]=value;
+            leaf->count++;
+            pool.unpin(id, true);
+            return;
         }
 
-        return source->parent_node.lock();
+        std::vector<K> all_keys(keys, keys+count);
+        std::vector<int32_t> all_duplicate_counts(duplicate_counts, duplicate_counts+count);
+        std::vector<V> all_values(values, values+count);
+        all_keys.insert(all_keys.begin()+index, *key);
+        all_duplicate_counts.insert(all_duplicate_counts.begin()+index, 0);
+        all_values.insert(all_values.begin()+index, value);
+        int left=(count+2)/2;
+
+        uint64_t sibling_id;
+        BPlusPageNode* sibling=_pageSplitSibling(tree.get(), id, leaf, sibling_id);
+        std::copy(all_keys.begin()+left, all_keys.end(), layout.keys(sibling));
+        std::copy(all_duplicate_counts.begin()+left, all_duplicate_counts.end(), layout.duplicateCounts(sibling));
+        std::copy(all_values.begin()+left, all_values.end(), layout.values(sibling));
+        sibling->count=(uint32_t)(count+1-left);
+        std::copy(all_keys.begin(), all_keys.begin()+left, keys);
+        std::copy(all_duplicate_counts.begin(), all_duplicate_counts.begin()+left, duplicate_counts);
+        std::copy(all_values.begin(), all_values.begin()+left, values);
+        leaf->count=(uint32_t)left;
+
+        K separator=_separator(tree->compare, all_keys[left-1], all_keys[left], 0);
+        BPlusPageCount left_count=_pageCount(layout, leaf);
+        BPlusPageCount right_count=_pageCount(layout, sibling);
+        pool.unpin(sibling_id, true);
+        pool.unpin(id, true);
+        _pageInsertSplit(tree.get(), path, separator, id, left_count, sibling_id, right_count);
     }
 
-    ///Source will have alays have more nodes than target and more than half capacity, no check performed here. Its must be performed at source end.
-    template <typename K>
-    static void distribute(std::shared_ptr<BPlusTree<K>> tree  ,std::shared_ptr<BPlusNode<K>>   source,std::shared_ptr<BPlusNode<K>>   target,SOURCE_IS  source_is ,ComparatorFunction<BPlusCell<K>> customCompare){
-        //1. Finding effective parent cell
-        auto effectiveNode = source_is==SOURCE_IS::LEFT_SIBLING?target:source;
-        auto effective_parent_cell= BB::find_effective_parent_cell<K>(effectiveNode);
-        
-        //2. handling first cell for target
-        if(!source->isLeaf){
-        if(target->cellsList){
-            auto right_child_node = source_is==SOURCE_IS::LEFT_SIBLING?target->left_most_child:source->left_most_child;
-            auto first_cell_for_target = createBPlusCell<K>(effective_parent_cell->key, right_child_node, target);
-            LL::insert(target->cellsList,customCompare, first_cell_for_target);
-        }
-        }
-
-        //3. Split cells from source
-        
-        std::shared_ptr<std::vector<std::shared_ptr<SortedLinkedList<BPlusCell<K>>>>>splitted_cells;
-        if(!source->isLeaf){
-            if(source_is == SOURCE_IS::RIGHT_SIBLING){
-                splitted_cells = LL::splitAt<BPlusCell<K>>(source->cellsList, source->cellsList->count-tree->half_capacity-1);
-            }else{
-                splitted_cells = LL::splitAt<BPlusCell<K>>(source->cellsList, source->cellsList->count-tree->half_capacity+1);
+    /**
+    Restores page id, which just lost an entry, and its ancestors on path: a page under half full takes entries from a sibling
+    under the same parent, or is merged with it when both fit in one page. The emptied page goes on the free list and leaves
+    the parent one key short, which is restored in turn. A root left with one child (or an empty root leaf) is freed too.
+    Child counts along path must already be up to date.
+    */
+    template<typename K,typename V,typename Compare>
+    static void _pageRebalance(BPlusPagedTree<K,V,Compare>* tree,std::vector<std::pair<uint64_t,int>>& path,uint64_t id){
+        BPlusBufferPool& pool=*tree->pool;
+        const BPlusPageLayout<K,V>& layout=tree->layout;
+        BPlusPageHeader& header=tree->header;
+        while(true){
+            const BPlusPageNode* page=(const BPlusPageNode*)pool.pin(id);
+            bool leaf=page->is_leaf!=0;
+            int count=(int)page->count;
+            uint64_t only_child=leaf?0:layout.children(page)[0];
+            pool.unpin(id, false);
+            if(path.empty()){
+                if(count==0){
+                    _pageFree(tree, id);
+                    header.root_page=only_child;
+                    if(leaf){
+                        header.left_most_page=header.right_most_page=0;
+                    }
+                }
+                return;
             }
-        }else{
-            if(source_is == SOURCE_IS::RIGHT_SIBLING){
-                splitted_cells = LL::splitAt<BPlusCell<K>>(source->cellsList, source->cellsList->count-tree->half_capacity-1);
-            }else{
-                splitted_cells = LL::splitAt<BPlusCell<K>>(source->cellsList, tree->half_capacity-1);
+            //internal pages may hold as few keys as writePages packs into them
+            if(count>=(int)(leaf?layout.leaf_capacity/2:(layout.internal_capacity-1)/2)){
+                return;
             }
 
-        }
-
-        //4. calculate effective_LMC and replacement_key
-        std::shared_ptr<BPlusNode<K>> effective_LMC;
-        std::shared_ptr<K> replacement_key;
-        switch(source_is){
-            case SOURCE_IS::LEFT_SIBLING:{
-                auto max_cell_in_source_after_split =source->cellsList->max->key;
-                effective_LMC=max_cell_in_source_after_split->right_child_node;
-                replacement_key=max_cell_in_source_after_split->key;
-                if(!source->isLeaf){
-                    LL::deleteNode(source->cellsList,customCompare,createBPlusCell<K>(max_cell_in_source_after_split->key));
+            uint64_t parent_id=path.back().first;
+            int child_index=path.back().second;
+            path.pop_back();
+            BPlusPageNode* parent=(BPlusPageNode*)pool.pin(parent_id);
+            K* parent_keys=layout.keys(parent);
+            uint64_t* parent_children=layout.children(parent);
+            BPlusPageCount* parent_counts=layout.childCounts(parent);
+            //the page and its sibling under parent, the right one is merged into the left one
+            int left_index=child_index<(int)parent->count?child_index:child_index-1;
+            uint64_t left_id=parent_children[left_index];
+            uint64_t right_id=parent_children[left_index+1];
+            BPlusPageNode* left=(BPlusPageNode*)pool.pin(left_id);
+            BPlusPageNode* right=(BPlusPageNode*)pool.pin(right_id);
+            int left_count=(int)left->count;
+            int right_count=(int)right->count;
+            bool merge;
+            K separator=parent_keys[left_index];
+            if(leaf){
+                std::vector<K> all_keys(layout.keys(left), layout.keys(left)+left_count);
+                std::vector<int32_t> all_duplicate_counts(layout.duplicateCounts(left), layout.duplicateCounts(left)+left_count);
+                std::vector<V> all_values(layout.values(left), layout.values(left)+left_count);
+                all_keys.insert(all_keys.end(), layout.keys(right), layout.keys(right)+right_count);
+                all_duplicate_counts.insert(all_duplicate_counts.end(), layout.duplicateCounts(right), layout.duplicateCounts(right)+right_count);
+                all_values.insert(all_values.end(), layout.values(right), layout.values(right)+right_count);
+                int total=left_count+right_count;
+                merge=total<=(int)layout.leaf_capacity;
+                int split=merge?total:total/2;
+                std::copy(all_keys.begin(), all_keys.begin()+split, layout.keys(left));
+                std::copy(all_duplicate_counts.begin(), all_duplicate_counts.begin()+split, layout.duplicateCounts(left));
+                std::copy(all_values.begin(), all_values.begin()+split, layout.values(left));
+                left->count=(uint32_t)split;
+                if(!merge){
+                    std::copy(all_keys.begin()+split, all_keys.end(), layout.keys(right));
+                    std::copy(all_duplicate_counts.begin()+split, all_duplicate_counts.end(), layout.duplicateCounts(right));
+                    std::copy(all_values.begin()+split, all_values.end(), layout.values(right));
+                    right->count=(uint32_t)(total-split);
+                    separator=_separator(tree->compare, all_keys[split-1], all_keys[split], 0);
                 }
-            }break;
-            case SOURCE_IS::RIGHT_SIBLING:
-                setAsCellsList(source,splitted_cells->at(1));
-                std::shared_ptr<BPlusCell<K>> max_cell_in_left_portion_after_split;
-                if(splitted_cells->at(0)->max){
-                    max_cell_in_left_portion_after_split=splitted_cells->at(0)->max->key;
-                }
-                effective_LMC=max_cell_in_left_portion_after_split->right_child_node;
-                replacement_key=max_cell_in_left_portion_after_split->key;
-                if(!source->isLeaf){
-                    LL::deleteNode(splitted_cells->at(0),customCompare,createBPlusCell<K>(max_cell_in_left_portion_after_split->key));
+            }else{
+                //the separator comes down between the keys of the two, and the middle key goes up when they are redistributed
+                std::vector<K> all_keys(layout.keys(left), layout.keys(left)+left_count);
+                std::vector<uint64_t> all_children(layout.children(left), layout.children(left)+left_count+1);
+                std::vector<BPlusPageCount> all_counts(layout.childCounts(left), layout.childCounts(left)+left_count+1);
+                all_keys.push_back(separator);
+                all_keys.insert(all_keys.end(), layout.keys(right), layout.keys(right)+right_count);
+                all_children.insert(all_children.end(), layout.children(right), layout.children(right)+right_count+1);
+                all_counts.insert(all_counts.end(), layout.childCounts(right), layout.childCounts(right)+right_count+1);
+                int total=left_count+right_count;
+                merge=total+1<=(int)layout.internal_capacity;
+                int split=merge?total+1:total/2;
+                std::copy(all_keys.begin(), all_keys.begin()+split, layout.keys(left));
+                std::copy(all_children.begin(), all_children.begin()+split+1, layout.children(left));
+                std::copy(all_counts.begin(), all_counts.begin()+split+1, layout.childCounts(left));
+                left->count=(uint32_t)split;
+                if(!merge){
+                    std::copy(all_keys.begin()+split+1, all_keys.end(), layout.keys(right));
+                    std::copy(all_children.begin()+split+1, all_children.end(), layout.children(right));
+                    std::copy(all_counts.begin()+split+1, all_counts.end(), layout.childCounts(right));
+                    right->count=(uint32_t)(total-split);
+                    separator=all_keys[split];
                 }
-                break;
-        }
-
-        //5. Merge split cells
-        switch(source_is){
-        case SOURCE_IS::LEFT_SIBLING:
-            if(splitted_cells->at(1)->count>0){
-            LL::mergeSplittedLeftIntoRight(splitted_cells->at(1), target->cellsList);
-            reinforceParentShipInChildNodes(target);
             }
-            break;
-        case SOURCE_IS::RIGHT_SIBLING:
-            if(splitted_cells->at(0)->count>0){
-            LL::mergeSplittedRightIntoLeft(target->cellsList, splitted_cells->at(0));
-            reinforceParentShipInChildNodes(target);
+            parent_counts[left_index]=_pageCount(layout, left);
+
+            if(!merge){
+                parent_keys[left_index]=separator;
+                parent_counts[left_index+1]=_pageCount(layout, right);
+                pool.unpin(right_id, true);
+                pool.unpin(left_id, true);
+                pool.unpin(parent_id, true);
+                return;
             }
-            break;
+
+            //right is unlinked from its level and from parent, then freed
+            uint64_t next_id=right->right_sibling;
+            left->right_sibling=next_id;
+            pool.unpin(right_id, false);
+            pool.unpin(left_id, true);
+            if(next_id){
+                BPlusPageNode* next=(BPlusPageNode*)pool.pin(next_id);
+                next->left_sibling=left_id;
+                pool.unpin(next_id, true);
+            }else if(leaf){
+                header.right_most_page=left_id;
+            }
+            int parent_count=(int)parent->count;
+            std::copy(parent_keys+left_index+1, parent_keys+parent_count, parent_keys+left_index);
+            std::copy(parent_children+left_index+2, parent_children+parent_count+1, parent_children+left_index+1);
+            std::copy(parent_counts+left_index+2, parent_counts+parent_count+1, parent_counts+left_index+1);
+            parent->count--;
+            pool.unpin(parent_id, true);
+            _pageFree(tree, right_id);
+            id=parent_id;
         }
+    }
 
-        //6. if source **is not leaf**
-        //handling the **right_child_node** of **max_cell_in_source_after_split**, making it as LMC:
-        if(!source->isLeaf){
-        switch(source_is){
-            case SOURCE_IS::LEFT_SIBLING:
-            setAsLeftMostChildNode(target,effective_LMC);
-            break;
-            case SOURCE_IS::RIGHT_SIBLING:
-            setAsLeftMostChildNode(source,effective_LMC);
-            break;
+    /**
+    Removes key along with its duplicates from a paged tree, as _deleteKey does for in memory trees.
+    Leaves below half full are refilled from or merged with a sibling (see _pageRebalance), so freed pages are reused by later inserts.
+    */
+    template<typename K,typename V,typename Compare>
+    static bool _deleteKey(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree,const K& key,K* deletedKey,V* deletedValue){
+        BPlusLatchGuard guard(tree->latch, false);
+        if(!tree->header.root_page){
+            return false;
+        }
+        BPlusBufferPool& pool=*tree->pool;
+        const BPlusPageLayout<K,V>& layout=tree->layout;
+        std::vector<std::pair<uint64_t,int>> path;
+        uint64_t id;
+        BPlusPageNode* leaf=_pageDescend(tree.get(), key, path, id);
+        K* keys=layout.keys(leaf);
+        int32_t* duplicate_counts=layout.duplicateCounts(leaf);
+        V* values=layout.values(leaf);
+        int count=(int)leaf->count;
+        int index=LL::search(keys, count, tree->compare, key, SearchType::EqualsTo);
+        if(index<0){
+            pool.unpin(id, false);
+            return false;
+        }
+        if(deletedKey){
+            *deletedKey=keys[index];
         }
-        //SortedLinkedListEngine.delete(source.cellsList!, customCompare, new BPlusCell(replacement_key, undefined, undefined));
+        if(deletedValue){
+            *deletedValue=values[index];
         }
+        int64_t entries=duplicate_counts[index]+1;
+        tree->header.size-=entries;
+        std::copy(keys+index+1, keys+count, keys+index);
+        std::copy(duplicate_counts+index+1, duplicate_counts+count, duplicate_counts+index);
+        std::copy(values+index+1, values+count, values+index);
+        leaf->count--;
+        pool.unpin(id, true);
+        _pageAddCounts(tree.get(), path, -entries, -1);
+        _pageRebalance(tree.get(), path, id);
+        return true;
+    }
 
-        //7. Resetting effective_parent_cell key
-        if(source_is == SOURCE_IS::RIGHT_SIBLING && source->isLeaf){
-            effective_parent_cell->key=target->cellsList->max->key->key;
-        }else{
-            effective_parent_cell->key=replacement_key;
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> deleteKey(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree,std::shared_ptr<K> key){
+        K deleted;
+        if(BB::_deleteKey(tree, *key, &deleted, (V*)NULL)){
+            return std::make_shared<K>(deleted);
         }
+        return NULL;
     }
 
-    template <typename K>
-    static void balance( std::shared_ptr<BPlusTree<K>> tree  ,std::shared_ptr<BPlusNode<K>>  effectedNode, ComparatorFunction<BPlusCell<K>> customCompare){
-        try{
-            auto balanceCase = _determineBalancingCase(tree, effectedNode);
-            switch(balanceCase){
-            case BalanceCase::DO_NOTHING:
-                break;
-            case BalanceCase::REMOVE_ROOT:
-                tree->root_node=tree->root_node->left_most_child;
-                if(tree->root_node){
-                tree->root_node->parent_node.lock()=NULL;
-                }
-                break;
-            case BalanceCase::SPLIT:
-                {
-                    auto nextnode=BB::split<K>(tree, effectedNode, customCompare);
-                    BB::balance<K>(tree, nextnode, customCompare);
-                }
-                break;
-            case BalanceCase::DISTRIBUTE_RIGHT_INTO_NODE:
-                BB::distribute<K>(tree, effectedNode->rightSibling.lock(), effectedNode, SOURCE_IS::RIGHT_SIBLING, customCompare);
-                break;
-            case BalanceCase::DISTRIBUTE_LEFT_INTO_NODE:
-                BB::distribute<K>(tree, effectedNode->leftSibling.lock(), effectedNode, SOURCE_IS::LEFT_SIBLING, customCompare);
-                break;
-            case BalanceCase::MERGE_RIGHT_INTO_NODE:
-                {
-                    auto nextnode=BB::merge<K>(tree, effectedNode->rightSibling.lock(), effectedNode, customCompare);
-                    if(nextnode)
-                        BB::balance<K>(tree, nextnode, customCompare);
-                }
-                break;
-            case BalanceCase::MERGE_NODE_INTO_LEFT:
-                {
-                    auto nextnode=BB::merge<K>(tree, effectedNode, effectedNode->leftSibling.lock(), customCompare);
-                    if(nextnode)
-                        BB::balance<K>(tree, nextnode, customCompare);
-                }
-                break;
+    template<typename K,typename V,typename Compare>
+    static V deleteKeyReturnValue(std::shared_ptr<BPlusPagedTree<K,V,Compare>> tree,std::shared_ptr<K> key){
+        V value=V();
+        BB::_deleteKey(tree, *key, (K*)NULL, &value);
+        return value;
+    }
 
-            }
-        }catch(std::exception & e){
-            throw "Failed while balancing";
+    enum BPlusLogRecordType{
+        LOG_INSERT=1,
+        LOG_DELETE=2
+    };
+
+    ///FNV-1a over a log record payload
+    inline uint32_t _logChecksum(const char* data,size_t size){
+        uint32_t hash=2166136261u;
+        for(size_t i=0;i<size;i++){
+            hash=(hash^(uint8_t)data[i])*16777619u;
         }
+        return hash;
     }
 
-    template<typename K>
-    static std::shared_ptr<BPlusNode<K>> searchForLeafNode(std::shared_ptr<BPlusTree<K>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> key,ComparatorFunction<BPlusCell<K>> queryCompare=NULL){
-        ComparatorFunction<BPlusCell<K>> effectiveComparator=queryCompare?queryCompare:compare;
-        
-        if(!tree->root_node){
-            return NULL;
-        }else{
-            std::shared_ptr<BPlusNode<K>> bpNode = tree->root_node;
-            auto searchKey=createBPlusCell<K>(key);
-            while(bpNode && !bpNode->isLeaf){
-                auto foundCell = LL::search(bpNode->cellsList, effectiveComparator, searchKey, SearchType::LesserThanOrEqualsTo);
-                if(!foundCell){
-                    bpNode=bpNode->left_most_child;
-                }else{
-                    auto c = effectiveComparator(searchKey,foundCell->key);
-                    if(c==0){
-                        if(foundCell->leftSibling){
-                        bpNode=foundCell->leftSibling->key->right_child_node;
-                        }else{
-                        bpNode=bpNode->left_most_child;
-                        }
-                    }else{
-                        //assert(c>0);//as we found node must be less than search key here
-                        bpNode=foundCell->key->right_child_node;
-                    }
-                } 
-            }
-            //bpnode is guaranteed leaf
-            return bpNode;
-        }
+    inline std::string _logFile(const std::string& base,const char* kind,uint64_t number){
+        return base+"."+kind+"."+std::to_string(number);
     }
 
+    inline std::string _logDirectory(const std::string& base){
+        size_t slash=base.rfind('/');
+        if(slash==std::string::npos){
+            return ".";
+        }
+        return slash==0?"/":base.substr(0, slash);
+    }
 
-    template<typename K>
-    static std::shared_ptr<K> searchForKey( std::shared_ptr<BPlusTree<K>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
-        auto leafNode = BB::searchForLeafNode(tree, compare, searchKey);
-        if(leafNode){
-            if(leafNode->cellsList){
-                auto foundLinkedNode = LL::search<BPlusCell<K>>(leafNode->cellsList, compare, createBPlusCell<K>(searchKey, NULL, NULL), searchType);
-                if(foundLinkedNode){
-                    return foundLinkedNode->key->key;
-                }
+    ///numbers N of the files named base.kind.N, ascending
+    inline std::vector<uint64_t> _logFiles(const std::string& base,const char* kind){
+        size_t slash=base.rfind('/');
+        std::string prefix=(slash==std::string::npos?base:base.substr(slash+1))+"."+kind+".";
+        std::vector<uint64_t> numbers;
+        DIR* directory=opendir(_logDirectory(base).c_str());
+        if(!directory){
+            throw "${Const.BalancedTrees}: cannot list log directory";
+        }
+        while(struct dirent* entry=readdir(directory)){
+            std::string name=entry->d_name;
+            if(name.size()>prefix.size() && name.compare(0, prefix.size(), prefix)==0 && name.find_first_not_of("0123456789", prefix.size())==std::string::npos){
+                numbers.push_back(std::stoull(name.substr(prefix.size())));
             }
         }
-        return NULL;
+        closedir(directory);
+        std::sort(numbers.begin(), numbers.end());
+        return numbers;
     }
 
-    template<typename K>
-    static std::shared_ptr<void> searchForValue( std::shared_ptr<BPlusTree<K>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
-        auto leafNode = BB::searchForLeafNode(tree, compare, searchKey);
-        if(leafNode){
-            if(leafNode->cellsList){
-                auto foundLinkedNode = LL::search<BPlusCell<K>>(leafNode->cellsList, compare, createBPlusCell<K>(searchKey, NULL, NULL), searchType);
-                if(foundLinkedNode){
-                    return foundLinkedNode->key->value;
-                }
-            }
+    ///makes files created or renamed next to base durable
+    inline bool _syncDirectory(const std::string& base){
+        int fd=::open(_logDirectory(base).c_str(), O_RDONLY);
+        if(fd<0){
+            return false;
         }
-        return NULL;
+        bool synced=fsync(fd)==0;
+        close(fd);
+        return synced;
     }
 
-    template<typename K, typename V>
-    static std::shared_ptr<BB_KV_P<K,V>> searchForKV( std::shared_ptr<BPlusTree<K>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> searchKey,SearchType searchType = SearchType::EqualsTo){
-        auto leafNode = BB::searchForLeafNode(tree, compare, searchKey);
-        if(leafNode){
-            auto sk = createBPlusCell<K>(searchKey, NULL, NULL);
-            if(leafNode->cellsList){
-                while(leafNode!=NULL){
-                    auto foundLinkedNode = LL::search<BPlusCell<K>>(leafNode->cellsList, compare, sk, searchType);
-
-                    if(foundLinkedNode){
-                        auto kvp = std::shared_ptr<BB_KV_P<K,V>>(new BB_KV_P<K,V>(foundLinkedNode->key->key,std::static_pointer_cast<V>(foundLinkedNode->key->value)));
-                        return kvp;
-                    }else{
-                        if(searchType == SearchType::LesserThan){
-                            //move to left node
-                            leafNode = leafNode->leftSibling.lock();
-                        }else if(searchType == SearchType::GreaterThan){
-                            //move to right node
-                            leafNode = leafNode->rightSibling.lock();
-                        }else{
-                            break;
-                        }
-                    }
+    inline bool _writeAll(int fd,const char* data,size_t size){
+        while(size>0){
+            ssize_t written=write(fd, data, size);
+            if(written<0){
+                if(errno==EINTR){
+                    continue;
                 }
-                
+                return false;
             }
+            data+=written;
+            size-=(size_t)written;
         }
-        return NULL;
+        return true;
     }
 
-    template<typename K>
-    static std::shared_ptr<std::vector<std::shared_ptr<K>>> searchForRangeWithPagination( std::shared_ptr<BPlusTree<K>> tree, ComparatorFunction<BPlusCell<K>>  compare,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
-        auto startNode= !startKey? tree->left_most_node :  BB::searchForLeafNode(tree, compare, startKey);
-        auto endNode= !endKey? tree->right_most_node: BB::searchForLeafNode(tree, compare, endKey);
-        auto currentNode = startNode;
-
-        int skip=0;
-        int count=0;
-
-        std::shared_ptr<std::vector<std::shared_ptr<K>>> result(new std::vector<std::shared_ptr<K>>());
+    /**
+    Record: payload size (uint32_t), checksum of payload (uint32_t), then payload: type (1 byte), key, and value for inserts.
+    Returns the bytes appended.
+    */
+    template<typename K,typename V>
+    static size_t _appendLogRecord(std::vector<char>& out,BPlusLogRecordType type,const K& key,const V* value){
+        uint32_t size=(uint32_t)(1+sizeof(K)+(value?sizeof(V):0));
+        size_t start=out.size();
+        out.resize(start+8+size);
+        char* payload=out.data()+start+8;
+        payload[0]=(char)type;
+        std::memcpy(payload+1, &key, sizeof(K));
+        if(value){
+            std::memcpy(payload+1+sizeof(K), value, sizeof(V));
+        }
+        uint32_t checksum=_logChecksum(payload, size);
+        std::memcpy(out.data()+start, &size, sizeof(size));
+        std::memcpy(out.data()+start+4, &checksum, sizeof(checksum));
+        return 8+size;
+    }
 
-        if(startNode!=endNode){
-            while(currentNode!=endNode){
-                auto sk = !startKey?NULL: createBPlusCell<K>(startKey, NULL, NULL);
-                auto ek = !endKey? NULL: createBPlusCell<K>(endKey, NULL, NULL);
-                if(currentNode && currentNode->cellsList){
-                    std::shared_ptr<std::vector<std::shared_ptr<BPlusCell<K>>>>  st1 = LL::searchTillStream<BPlusCell<K>>(currentNode->cellsList, compare, sk, ek);
-                    for(std::shared_ptr<BPlusCell<K>> &n1 : *st1){
-                        if(skip>=offset){
-                            if(count==limit){
-                                break;
-                            }
-                            count++;
-                            result->push_back(n1->key);
-                        }else{
-                            skip++;
-                        }
-                    }
-                    currentNode = currentNode->rightSibling.lock();;
-                }
+    ///applies the records of a log segment to tree, up to its end or a torn record, returns the bytes of the records applied
+    template<typename K,typename V,typename Compare>
+    static uint64_t _replayLogSegment(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const std::string& file){
+        int fd=::open(file.c_str(), O_RDONLY);
+        struct stat status;
+        if(fd<0 || fstat(fd, &status)!=0){
+            if(fd>=0){
+                close(fd);
             }
+            throw "${Const.BalancedTrees}: cannot read log segment";
         }
-        if(currentNode && currentNode==endNode){
-            auto sk = !startKey?NULL: createBPlusCell<K>(startKey, NULL, NULL);
-            auto ek = !endKey? NULL: createBPlusCell<K>(endKey, NULL, NULL);
-            if(currentNode && currentNode->cellsList){
-                auto st1 = LL::searchTillStream<BPlusCell<K>>(currentNode->cellsList, compare, sk, ek);
-                for(auto n1 : *st1){
-                    if(skip>=offset) {
-                        if (count == limit) {
-                            break;
-                        }
-                        count++;
-                        result->push_back(n1->key);
-                    }else{
-                        skip++;
-                    }
+        std::vector<char> data((size_t)status.st_size);
+        size_t read=0;
+        while(read<data.size()){
+            ssize_t got=pread(fd, data.data()+read, data.size()-read, (off_t)read);
+            if(got<=0){
+                if(got<0 && errno==EINTR){
+                    continue;
                 }
+                break;
             }
+            read+=(size_t)got;
         }
-
-        return result;
+        close(fd);
+        data.resize(read);
+
+        size_t offset=0;
+        while(offset+8<=data.size()){
+            uint32_t size;
+            uint32_t checksum;
+            std::memcpy(&size, data.data()+offset, sizeof(size));
+            std::memcpy(&checksum, data.data()+offset+4, sizeof(checksum));
+            const char* payload=data.data()+offset+8;
+            if(size<1+sizeof(K) || offset+8+size>data.size() || _logChecksum(payload, size)!=checksum){
+                break;
+            }
+            K key;
+            std::memcpy(&key, payload+1, sizeof(K));
+            if(payload[0]==LOG_INSERT && size==1+sizeof(K)+sizeof(V)){
+                V value;
+                std::memcpy(&value, payload+1+sizeof(K), sizeof(V));
+                BB::_insert(tree, tree->compare, std::make_shared<K>(key), value);
+            }else if(payload[0]==LOG_DELETE && size==1+sizeof(K)){
+                BB::_deleteKey(tree, tree->compare, key, (K*)NULL, (V*)NULL);
+            }else{
+                break;
+            }
+            offset+=8+size;
+        }
+        return offset;
     }
 
-    template<typename K>
-    static std::shared_ptr<std::vector<std::shared_ptr<void>>> searchForRangeWithPaginationV( std::shared_ptr<BPlusTree<K>> tree, ComparatorFunction<BPlusCell<K>>  compare,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
-        auto startNode= !startKey? tree->left_most_node :  BB::searchForLeafNode(tree, compare, startKey);
-        auto endNode= !endKey? tree->right_most_node: BB::searchForLeafNode(tree, compare, endKey);
-        auto currentNode = startNode;
-
-        int skip=0;
-        int count=0;
-
-        std::shared_ptr<std::vector<std::shared_ptr<void>>> result(new std::vector<std::shared_ptr<void>>());
-
-        if(startNode!=endNode){
-            while(currentNode!=endNode){
-                auto sk = !startKey?NULL: createBPlusCell<K>(startKey, NULL, NULL);
-                auto ek = !endKey? NULL: createBPlusCell<K>(endKey, NULL, NULL);
-                if(currentNode && currentNode->cellsList){
-                    std::shared_ptr<std::vector<std::shared_ptr<BPlusCell<K>>>>  st1 = LL::searchTillStream<BPlusCell<K>>(currentNode->cellsList, compare, sk, ek);
-                    for(std::shared_ptr<BPlusCell<K>> &n1 : *st1){
-                        if(skip>=offset){
-                            if(count==limit){
-                                break;
-                            }
-                            count++;
-                            result->push_back(n1->value);
-                        }else{
-                            skip++;
-                        }
-                    }
-                    currentNode = currentNode->rightSibling.lock();
-                }
+    template<typename K,typename V,typename Compare>
+    static void _openLogSegment(BPlusLog<K,V,Compare>& log,uint64_t segment){
+        int fd=::open(_logFile(log.base, "log", segment).c_str(), O_WRONLY|O_CREAT|O_APPEND, 0644);
+        if(fd<0 || !_syncDirectory(log.base)){
+            if(fd>=0){
+                close(fd);
             }
+            throw "${Const.BalancedTrees}: cannot create log segment";
         }
-        if(currentNode && currentNode==endNode){
-            auto sk = !startKey?NULL: createBPlusCell<K>(startKey, NULL, NULL);
-            auto ek = !endKey? NULL: createBPlusCell<K>(endKey, NULL, NULL);
-            if(currentNode && currentNode->cellsList){
-                auto st1 = LL::searchTillStream<BPlusCell<K>>(currentNode->cellsList, compare, sk, ek);
-                for(auto n1 : *st1){
-                    if(skip>=offset) {
-                        if (count == limit) {
-                            break;
-                        }
-                        count++;
-                        result->push_back(n1->value);
-                    }else{
-                        skip++;
-                    }
-                }
-            }
+        if(log.fd>=0){
+            close(log.fd);
         }
-
-        return result;
+        log.fd=fd;
+        log.segment=segment;
+        log.segment_bytes=0;
     }
 
-
-    template<typename K>
-    static std::shared_ptr<std::vector<std::shared_ptr<K>>> find( std::shared_ptr<BPlusTree<K>> tree,  ComparatorFunction<BPlusCell<K>>  compare ,  ComparatorFunction<BPlusCell<K>> queryComparator,std::shared_ptr<K> bookmark_key=NULL, bool yieldIndividualDuplicates=false){
-        std::shared_ptr<std::vector<std::shared_ptr<K>>> result(new std::vector<std::shared_ptr<K>>());
-
-        //will find leaf node with the same comparator as tree.
-        std::shared_ptr<BPlusNode<K>> found_leaf_node;
-        if(bookmark_key){
-            found_leaf_node=BB::searchForLeafNode(tree, compare, bookmark_key, queryComparator);
+    /**
+    Writes and syncs the pending records of log, letting go of lock while doing so. Caller must check that no flush is running.
+    When group commit is asked for, the flush first waits for other writers to append their records.
+    */
+    template<typename K,typename V,typename Compare>
+    static void _flushLog(BPlusLog<K,V,Compare>& log,std::unique_lock<std::mutex>& lock,bool groupCommit){
+        log.flushing=true;
+        if(groupCommit && log.options.group_commit_delay_us>0){
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::microseconds(log.options.group_commit_delay_us));
+            lock.lock();
+        }
+        std::vector<char> batch;
+        batch.swap(log.pending);
+        uint64_t upto=log.appended;
+        int fd=log.fd;
+        lock.unlock();
+        bool written=_writeAll(fd, batch.data(), batch.size()) && fdatasync(fd)==0;
+        lock.lock();
+        //buffer goes back to be appended into, unless records came in meanwhile
+        batch.clear();
+        if(log.pending.empty()){
+            log.pending.swap(batch);
+        }
+        log.flushing=false;
+        if(written){
+            log.durable=upto;
         }else{
-            if(tree->left_most_node && tree->left_most_node->cellsList && tree->left_most_node->cellsList->count>0){
-                found_leaf_node=BB::searchForLeafNode(tree, compare, tree->left_most_node->cellsList->min->key->key, queryComparator);
-            }
+            log.failed=true;
         }
+        log.flushed.notify_all();
+    }
 
-        auto findingMatches = true;
-        while(findingMatches){
-            if(!found_leaf_node){
-                findingMatches = false;
-                break;
+    ///waits till record number lsn is durable, flushing on behalf of all waiting writers when no flush is running
+    template<typename K,typename V,typename Compare>
+    static void _commitLog(BPlusLog<K,V,Compare>& log,std::unique_lock<std::mutex>& lock,uint64_t lsn){
+        while(log.durable<lsn){
+            if(log.failed){
+                throw "${Const.BalancedTrees}: log write failed";
             }
+            if(log.flushing){
+                log.flushed.wait(lock);
+                continue;
+            }
+            _flushLog(log, lock, true);
+        }
+    }
 
-            std::shared_ptr<BPlusCell<K>> startKey;//= bookmark_key? std::shared_ptr<BPlusCell<K>>(new BPlusCell(bookmark_key, NULL, found_leaf_node)) : found_leaf_node?->cellsList?->min?->key;
-            if(bookmark_key){
-                startKey = createBPlusCell<K>(bookmark_key, NULL, found_leaf_node);
+    template<typename K,typename V,typename Compare>
+    static void _checkpoint(BPlusLog<K,V,Compare>& log,std::unique_lock<std::mutex>& lock){
+        while(log.checkpointing){
+            log.flushed.wait(lock);
+        }
+        //the current segment is completed before a new one is started
+        while(log.flushing || !log.pending.empty()){
+            if(log.failed){
+                throw "${Const.BalancedTrees}: log write failed";
+            }
+            if(log.flushing){
+                log.flushed.wait(lock);
             }else{
-                if(found_leaf_node && found_leaf_node->cellsList && found_leaf_node->cellsList->min){
-                    startKey=found_leaf_node->cellsList->min->key;
-                }
+                _flushLog(log, lock, false);
             }
+        }
+        if(log.failed){
+            throw "${Const.BalancedTrees}: log write failed";
+        }
 
-            if(found_leaf_node && found_leaf_node->cellsList){
-                auto avlStr = LL::find<BPlusCell<K>>(found_leaf_node->cellsList, queryComparator);//LL::searchTillStream<BPlusCell<K>>(found_leaf_node->cellsList, compare, startKey, NULL, yieldIndividualDuplicates);
-
-                for (auto &avlnode :  *avlStr){
-                    if(bookmark_key){
-                        bookmark_key=NULL;
-                        continue;
-                    }
-                    auto searchKeyCurrentNode = queryComparator(createBPlusCell(avlnode->key),createBPlusCell(avlnode->key));
-                    if(searchKeyCurrentNode==0){
-                        result->push_back(avlnode->key);
-                    }
+        //snapshot holds exactly the records of the segments before next
+        auto snapshot=BB::snapshot(log.tree);
+        uint64_t next=log.segment+1;
+        _openLogSegment(log, next);
+        log.checkpointing=true;
+        lock.unlock();
+        try{
+            BB::writePages(snapshot, _logFile(log.base, "ckpt", next));
+            if(!_syncDirectory(log.base)){
+                throw "${Const.BalancedTrees}: cannot write checkpoint";
+            }
+            for(uint64_t number : _logFiles(log.base, "log")){
+                if(number<next){
+                    unlink(_logFile(log.base, "log", number).c_str());
                 }
-                found_leaf_node = found_leaf_node->rightSibling;
             }
+            for(uint64_t number : _logFiles(log.base, "ckpt")){
+                if(number<next){
+                    unlink(_logFile(log.base, "ckpt", number).c_str());
+                }
+            }
+        }catch(...){
+            lock.lock();
+            log.checkpointing=false;
+            log.flushed.notify_all();
+            throw;
         }
-
-        return result;
+        lock.lock();
+        log.checkpointing=false;
+        log.flushed.notify_all();
     }
 
-    template<typename K>
-    static std::shared_ptr<std::vector<std::shared_ptr<void>>> findV( std::shared_ptr<BPlusTree<K>> tree,  ComparatorFunction<BPlusCell<K>>  compare ,  ComparatorFunction<K> queryComparator,std::shared_ptr<K> bookmark_key=NULL, bool yieldIndividualDuplicates=false,uint limit=0){
-        std::shared_ptr<std::vector<std::shared_ptr<void>>> result(new std::vector<std::shared_ptr<void>>());
-        ComparatorFunction<BPlusCell<K>> ec = [queryComparator](std::shared_ptr<BPlusCell<K>> c1,std::shared_ptr<BPlusCell<K>> c2){
-            return queryComparator(c1->key,c2->key);
-        };
-
-        //will find leaf node with the same comparator as tree.
-        std::shared_ptr<BPlusNode<K>> found_leaf_node;
-        if(bookmark_key){
-            found_leaf_node=BB::searchForLeafNode(tree, compare, bookmark_key,ec);
-        }else{
-            if(tree->left_most_node && tree->left_most_node->cellsList && tree->left_most_node->cellsList->count>0){
-                found_leaf_node=BB::searchForLeafNode(tree, compare, tree->left_most_node->cellsList->min->key->key, ec);
-            }
+    ///hands the checkpoint to the checkpointer of log once the segment has grown past checkpoint_bytes, the caller does not wait for it
+    template<typename K,typename V,typename Compare>
+    static void _checkpointIfDue(BPlusLog<K,V,Compare>& log){
+        if(log.options.checkpoint_bytes>0 && log.segment_bytes>=log.options.checkpoint_bytes && !log.checkpointing && !log.checkpoint_due){
+            log.checkpoint_due=true;
+            log.checkpoint_wake.notify_one();
         }
+    }
 
-        auto findingMatches = true;
-        while(findingMatches){
-            if(!found_leaf_node){
-                findingMatches = false;
-                break;
+    template<typename K,typename V,typename Compare>
+    static void _runCheckpointer(BPlusLog<K,V,Compare>& log){
+        std::unique_lock<std::mutex> lock(log.mutex);
+        while(true){
+            log.checkpoint_wake.wait(lock, [&log]{
+                return log.stopping || log.checkpoint_due;
+            });
+            if(log.stopping){
+                return;
             }
-
-            std::shared_ptr<BPlusCell<K>> startKey;//= bookmark_key? std::shared_ptr<BPlusCell<K>>(new BPlusCell(bookmark_key, NULL, found_leaf_node)) : found_leaf_node?->cellsList?->min?->key;
-            if(bookmark_key){
-                startKey = createBPlusCell<K>(bookmark_key, NULL, found_leaf_node);
-            }else{
-                if(found_leaf_node && found_leaf_node->cellsList && found_leaf_node->cellsList->min){
-                    startKey=found_leaf_node->cellsList->min->key;
-                }
+            log.checkpoint_due=false;
+            try{
+                _checkpoint(log, lock);
+            }catch(...){
+                log.checkpoint_error=std::current_exception();
             }
+        }
+    }
 
-            if(found_leaf_node && found_leaf_node->cellsList){
-                auto avlStr = LL::find<BPlusCell<K>>(found_leaf_node->cellsList, ec);//LL::searchTillStream<BPlusCell<K>>(found_leaf_node->cellsList, compare, startKey, NULL, yieldIndividualDuplicates);
+    /**
+    Recovers tree, which must be empty, from the log files at base: loads the latest checkpoint and replays the segments after it,
+    a record torn by a crash ends its segment. Then starts a new segment which the returned log appends to.
+    From then on writes must go through the log, reads can still be done on tree.
+    K and V are logged by their bytes, so they must be trivially copyable.
+    */
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<BPlusLog<K,V,Compare>> openLog(std::shared_ptr<BPlusTree<K,V,Compare>> tree,const std::string& base,BPlusLogOptions options=BPlusLogOptions()){
+        static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value, "log records hold keys and values by their bytes");
+        BB::_checkWritable(tree);
+        if(tree->root_node){
+            throw "${Const.BalancedTrees}: openLog needs an empty tree";
+        }
 
-                for (auto &avlnode :  *avlStr){
-                    if(bookmark_key){
-                        bookmark_key=NULL;
-                        continue;
-                    }
-                    auto searchKeyCurrentNode = queryComparator(avlnode->key,avlnode->key);//queryComparator(createBPlusCell(avlnode->key),createBPlusCell(avlnode->key));
-                    if(searchKeyCurrentNode==0){
-                        result->push_back(avlnode->value);
-                        if(result->size()==limit){
-                            break;
-                        }
-                    }
+        uint64_t next=0;
+        auto checkpoints=_logFiles(base, "ckpt");
+        if(!checkpoints.empty()){
+            next=checkpoints.back();
+            auto pages=BB::openPages<K,V,Compare>(_logFile(base, "ckpt", next), tree->compare);
+            std::vector<BB_KV<K,V>> entries;
+            BB::_pageScanRange(pages.get(), pages->compare, 0, -1, std::shared_ptr<K>(), std::shared_ptr<K>(), [&](const BPlusPageNode* page,int index){
+                //bulkLoad collapses the repeats back into duplicates
+                for(int32_t d=0;d<=pages->layout.duplicateCounts(page)[index];d++){
+                    entries.push_back(BB_KV<K,V>{pages->layout.keys(page)[index], pages->layout.values(page)[index]});
                 }
-                found_leaf_node = found_leaf_node->rightSibling.lock();
+            });
+            BB::bulkLoad(tree, entries.begin(), entries.end());
+        }
+        for(uint64_t number : _logFiles(base, "log")){
+            if(number<next){
+                continue;
             }
+            std::string file=_logFile(base, "log", number);
+            uint64_t bytes=_replayLogSegment(tree, file);
+            if(truncate(file.c_str(), (off_t)bytes)!=0){
+                throw "${Const.BalancedTrees}: cannot truncate torn log segment";
+            }
+            next=number+1;
         }
 
-        return result;
+        std::shared_ptr<BPlusLog<K,V,Compare>> log(new BPlusLog<K,V,Compare>());
+        log->tree=tree;
+        log->base=base;
+        log->options=options;
+        _openLogSegment(*log, next);
+        if(options.checkpoint_bytes>0){
+            //the thread only borrows the log, whose destructor stops and joins it
+            BPlusLog<K,V,Compare>* borrowed=log.get();
+            log->checkpointer=std::thread([borrowed]{
+                BB::_runCheckpointer(*borrowed);
+            });
+        }
+        return log;
     }
 
-    //returns NULL if found no applicable leaf node
-    template<typename K>
-    static std::shared_ptr<K> insert( std::shared_ptr<BPlusTree<K>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> key,std::shared_ptr<void> value=NULL){
-        if(!tree->root_node){
-            tree->root_node=createBPlusNode(tree, true);
-            tree->left_most_node=tree->root_node;
-            tree->right_most_node=tree->root_node;
-            tree->size++;
-            auto j = LL::insert<BPlusCell<K>>(tree->root_node->cellsList, compare, createBPlusCell<K>(key,NULL,tree->root_node));
-            j->key->value=value;
-            return key;
+    ///inserts into the tree of log, returns once the insert is durable
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> insert(std::shared_ptr<BPlusLog<K,V,Compare>> log,std::shared_ptr<K> key,V value=V()){
+        std::unique_lock<std::mutex> lock(log->mutex);
+        if(log->failed){
+            throw "${Const.BalancedTrees}: log write failed";
         }
+        auto inserted=BB::_insert(log->tree, log->tree->compare, key, value);
+        log->segment_bytes+=_appendLogRecord(log->pending, LOG_INSERT, *key, &value);
+        BB::_commitLog(*log, lock, ++log->appended);
+        BB::_checkpointIfDue(*log);
+        return inserted;
+    }
 
-        auto leafNode = BB::searchForLeafNode(tree, compare, key);
-        if(leafNode){
-            auto insertedNode =  LL::insert<BPlusCell<K>>(leafNode->cellsList, compare, createBPlusCell<K>(key,NULL,leafNode));
-            insertedNode->key->value=value;
-            BB::balance<K>(tree, leafNode, compare);
-            tree->size++;
-            return key;
+    ///deletes key, moving the deleted key and value out when asked for, returns once the delete is durable
+    template<typename K,typename V,typename Compare>
+    static bool _deleteKey(std::shared_ptr<BPlusLog<K,V,Compare>> log,const K& key,K* deletedKey,V* deletedValue){
+        std::unique_lock<std::mutex> lock(log->mutex);
+        if(log->failed){
+            throw "${Const.BalancedTrees}: log write failed";
+        }
+        if(!BB::_deleteKey(log->tree, log->tree->compare, key, deletedKey, deletedValue)){
+            return false;
         }
+        log->segment_bytes+=_appendLogRecord(log->pending, LOG_DELETE, key, (const V*)NULL);
+        BB::_commitLog(*log, lock, ++log->appended);
+        BB::_checkpointIfDue(*log);
+        return true;
+    }
 
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> deleteKey(std::shared_ptr<BPlusLog<K,V,Compare>> log,std::shared_ptr<K> key){
+        K deletedKey;
+        if(BB::_deleteKey(log, *key, &deletedKey, (V*)NULL)){
+            return std::make_shared<K>(deletedKey);
+        }
         return NULL;
     }
 
-    template<typename K>
-    static std::shared_ptr<K> deleteKey(std::shared_ptr<BPlusTree<K>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> key) {
-        if(!tree->root_node){
-        tree->size=0;
-        return NULL;
-        }else{
-        auto leafNode = BB::searchForLeafNode(tree, compare, key);
-        auto deletedNode =  LL::deleteNode(leafNode->cellsList, compare, createBPlusCell<K>(key,NULL,NULL));
-        if(deletedNode){
-            tree->size=tree->size-(1+deletedNode->duplicate_count);
-            BB::balance(tree, leafNode, compare);
-            return deletedNode->key->key;
+    template<typename K,typename V,typename Compare>
+    static V deleteKeyReturnValue(std::shared_ptr<BPlusLog<K,V,Compare>> log,std::shared_ptr<K> key){
+        V deletedValue=V();
+        BB::_deleteKey(log, *key, (K*)NULL, &deletedValue);
+        return deletedValue;
+    }
+
+    /**
+    Writes a checkpoint of the tree of log and drops the segments and older checkpoint it makes obsolete.
+    Writers only wait while the current segment is synced and a new one is started, the checkpoint itself is written from a snapshot.
+    First throws the error of a failed background checkpoint, if there was one since the last call.
+    */
+    template<typename K,typename V,typename Compare>
+    static void checkpoint(std::shared_ptr<BPlusLog<K,V,Compare>> log){
+        std::unique_lock<std::mutex> lock(log->mutex);
+        if(log->checkpoint_error){
+            std::exception_ptr error=log->checkpoint_error;
+            log->checkpoint_error=NULL;
+            std::rethrow_exception(error);
         }
+        BB::_checkpoint(*log, lock);
+    }
+
+    ///index of the shard owning key, caller must hold the latch of sharded
+    template<typename K,typename V,typename Compare>
+    static size_t _shardIndex(ShardedBPlusTree<K,V,Compare>& sharded,const K& key){
+        return (size_t)LL::upperBound(sharded.bounds, sharded.compare, key);
+    }
+
+    ///splits shard at its middle key if its still over split_entries, unless all of it is a single key
+    template<typename K,typename V,typename Compare>
+    static void _splitShard(std::shared_ptr<ShardedBPlusTree<K,V,Compare>> sharded,std::shared_ptr<BPlusTree<K,V,Compare>> shard){
+        BPlusLatchGuard guard(sharded->latch, false);
+        auto position=std::find(sharded->shards.begin(), sharded->shards.end(), shard);
+        if(position==sharded->shards.end() || shard->size.load()<=sharded->options.split_entries){
+            return;
         }
-        return NULL;
+        auto splitKey=BB::getMiddleKey(shard);
+        //everything lesser than splitKey stays, so it must not be the first key
+        if(sharded->compare(*splitKey, shard->left_most_node->keys.front())==0){
+            splitKey=BB::searchForKey(shard, splitKey, SearchType::GreaterThan);
+            if(!splitKey){
+                return;
+            }
+        }
+        BPlusLatchGuard shardGuard(shard->latch, false);
+        //a shard with an open snapshot can not be split, it stays whole till a later insert finds it closed
+        if(shard->open_snapshots.load()>0){
+            return;
+        }
+        auto right=BB::_splitLatched(shard, shard->compare, *splitKey);
+        shardGuard.unlock();
+        size_t index=position-sharded->shards.begin();
+        sharded->shards.insert(sharded->shards.begin()+index+1, right);
+        sharded->bounds.insert(sharded->bounds.begin()+index, *splitKey);
     }
 
-    template<typename K>
-    static std::shared_ptr<void> deleteKeyReturnValue(std::shared_ptr<BPlusTree<K>> tree, ComparatorFunction<BPlusCell<K>>  compare,std::shared_ptr<K> key) {
-        if(!tree->root_node){
-        tree->size=0;
-        return NULL;
-        }else{
-        auto leafNode = BB::searchForLeafNode(tree, compare, key);
-        auto deletedNode =  LL::deleteNode(leafNode->cellsList, compare, createBPlusCell<K>(key,NULL,NULL));
-        if(deletedNode){
-            tree->size=tree->size-(1+deletedNode->duplicate_count);
-            BB::balance(tree, leafNode, compare);
-            return deletedNode->key->value;
+    ///joins shard with its smaller neighbour if its still under merge_entries and the two fit in split_entries
+    template<typename K,typename V,typename Compare>
+    static void _mergeShard(std::shared_ptr<ShardedBPlusTree<K,V,Compare>> sharded,std::shared_ptr<BPlusTree<K,V,Compare>> shard){
+        BPlusLatchGuard guard(sharded->latch, false);
+        auto position=std::find(sharded->shards.begin(), sharded->shards.end(), shard);
+        if(position==sharded->shards.end() || sharded->shards.size()<2 || shard->size.load()>=sharded->options.merge_entries){
+            return;
         }
+        size_t index=position-sharded->shards.begin();
+        size_t left=index;
+        if(index+1==sharded->shards.size() || (index>0 && sharded->shards[index-1]->size.load()<sharded->shards[index+1]->size.load())){
+            left=index-1;
         }
-        return NULL;
+        auto& target=sharded->shards[left];
+        auto& source=sharded->shards[left+1];
+        if(target->size.load()+source->size.load()>sharded->options.split_entries){
+            return;
+        }
+        {
+            BPlusLatchGuard firstGuard;
+            BPlusLatchGuard secondGuard;
+            BB::_latchPair(target, source, firstGuard, secondGuard);
+            //shards with an open snapshot can not be joined, they stay apart till a later delete finds them closed
+            if(target->open_snapshots.load()>0 || source->open_snapshots.load()>0){
+                return;
+            }
+            BB::_joinLatched(target, source);
+        }
+        sharded->shards.erase(sharded->shards.begin()+left+1);
+        sharded->bounds.erase(sharded->bounds.begin()+left);
     }
 
-    template<typename K>
-    static uint64_t getSize(std::shared_ptr<BPlusTree<K>> tree){
-        return tree->size;
+    ///inserts into the shard owning key, which is split once it grows past split_entries
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> insert(std::shared_ptr<ShardedBPlusTree<K,V,Compare>> sharded,std::shared_ptr<K> key,typename ShardedBPlusTree<K,V,Compare>::value_type value=V()){
+        std::shared_ptr<BPlusTree<K,V,Compare>> shard;
+        std::shared_ptr<K> inserted;
+        {
+            BPlusLatchGuard guard(sharded->latch, true);
+            shard=sharded->shards[BB::_shardIndex(*sharded, *key)];
+            inserted=BB::insert(shard, key, value);
+        }
+        if(shard->size.load()>sharded->options.split_entries){
+            BB::_splitShard(sharded, shard);
+        }
+        return inserted;
     }
 
-    template<typename K>
-    static std::shared_ptr<K> getMiddleKey(std::shared_ptr<BPlusTree<K>> tree){
-        auto found_leaf_node = tree->left_most_node;
-        auto hs = getSize(tree)/2;
-        uint64_t c=0;
-        
-        if(!found_leaf_node){
-            goto RETURN_NULL;
-        }else{
-            while(c<hs){
-                auto t = c+found_leaf_node->cellsList->count;
-                if(t<hs){
-                    found_leaf_node=found_leaf_node->rightSibling.lock();
-                }else{
-                    return found_leaf_node->cellsList->min->key->key;
-                }
-                c=t;
-            }
+    ///deletes from the shard owning key, which is joined with a neighbour once it shrinks below merge_entries
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> deleteKey(std::shared_ptr<ShardedBPlusTree<K,V,Compare>> sharded,std::shared_ptr<K> key){
+        std::shared_ptr<BPlusTree<K,V,Compare>> shard;
+        std::shared_ptr<K> deleted;
+        {
+            BPlusLatchGuard guard(sharded->latch, true);
+            shard=sharded->shards[BB::_shardIndex(*sharded, *key)];
+            deleted=BB::deleteKey(shard, key);
         }
+        if(deleted && shard->size.load()<sharded->options.merge_entries){
+            BB::_mergeShard(sharded, shard);
+        }
+        return deleted;
+    }
 
-        RETURN_NULL:
+    ///same as searchForKey on a tree, an entry which is not in the shard owning searchKey is looked for in the shards next to it
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<K> searchForKey(std::shared_ptr<ShardedBPlusTree<K,V,Compare>> sharded,std::shared_ptr<K> searchKey,SearchType searchType=SearchType::EqualsTo){
+        BPlusLatchGuard guard(sharded->latch, true);
+        int count=(int)sharded->shards.size();
+        int step=searchType==SearchType::GreaterThan || searchType==SearchType::GreaterThanOrEqualsTo?1:-1;
+        for(int i=(int)BB::_shardIndex(*sharded, *searchKey);i>=0 && i<count;i+=step){
+            auto found=BB::searchForKey(sharded->shards[i], searchKey, searchType);
+            if(found || searchType==SearchType::EqualsTo){
+                return found;
+            }
+        }
         return NULL;
     }
 
+    template<typename K,typename V,typename Compare>
+    static uint64_t getSize(std::shared_ptr<ShardedBPlusTree<K,V,Compare>> sharded){
+        BPlusLatchGuard guard(sharded->latch, true);
+        uint64_t size=0;
+        for(auto& shard : sharded->shards){
+            size+=shard->size.load();
+        }
+        return size;
+    }
 
-    template<typename K,typename V>
-    static std::shared_ptr<std::vector<std::shared_ptr<BB_KV_P<K,V>>>> searchForRangeWithPaginationKVP( std::shared_ptr<BPlusTree<K>> tree, ComparatorFunction<BPlusCell<K>>  compare,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
-        auto startNode= !startKey? tree->left_most_node :  BB::searchForLeafNode(tree, compare, startKey);
-        auto endNode= !endKey? tree->right_most_node: BB::searchForLeafNode(tree, compare, endKey);
-        auto currentNode = startNode;
-
-        int skip=0;
-        int count=0;
-
-        std::shared_ptr<std::vector<std::shared_ptr<BB_KV_P<K,V>>>> result(new std::vector<std::shared_ptr<BB_KV_P<K,V>>>());
-
-        if(startNode!=endNode){
-            while(currentNode!=endNode){
-                auto sk = !startKey?NULL: createBPlusCell<K>(startKey, NULL, NULL);
-                auto ek = !endKey? NULL: createBPlusCell<K>(endKey, NULL, NULL);
-                if(currentNode && currentNode->cellsList){
-                    std::shared_ptr<std::vector<std::shared_ptr<BPlusCell<K>>>>  st1 = LL::searchTillStream<BPlusCell<K>>(currentNode->cellsList, compare, sk, ek);
-                    for(std::shared_ptr<BPlusCell<K>> &n1 : *st1){
-                        if(skip>=offset){
-                            if(count==limit){
-                                break;
-                            }
-                            count++;
-                            auto kvp = std::shared_ptr<BB_KV_P<K,V>>(new BB_KV_P<K,V>(n1->key,std::static_pointer_cast<V>(n1->value)));
-                            result->push_back(kvp);
-                        }else{
-                            skip++;
-                        }
-                    }
-                    currentNode = currentNode->rightSibling.lock();
+    /**
+    Pages through startKey <= key <= endKey across the shards holding that range, in key order: shards before offset is reached are
+    skipped by counting their keys in range, then scan(shard, offset, limit) is called on shard after shard until limit is reached.
+    Every shard is read consistently on its own, there is no point in time across shards.
+    */
+    template<typename R,typename K,typename V,typename Compare,typename S>
+    static std::shared_ptr<std::vector<R>> _shardedRange(std::shared_ptr<ShardedBPlusTree<K,V,Compare>> sharded,int offset,int limit,std::shared_ptr<K> startKey,std::shared_ptr<K> endKey,S scan){
+        std::shared_ptr<std::vector<R>> result(new std::vector<R>());
+        BPlusLatchGuard guard(sharded->latch, true);
+        size_t first=startKey?BB::_shardIndex(*sharded, *startKey):0;
+        size_t last=endKey?BB::_shardIndex(*sharded, *endKey):sharded->shards.size()-1;
+        for(size_t i=first;i<=last && limit!=0;i++){
+            auto& shard=sharded->shards[i];
+            if(offset>0){
+                BPlusLatchGuard treeGuard(shard->latch, true);
+                uint64_t end=endKey?BB::_rank(shard, shard->compare, *endKey, true, true):BB::_treeCount(shard).keys.load();
+                uint64_t start=startKey?BB::_rank(shard, shard->compare, *startKey, false, true):0;
+                uint64_t keys=end>start?end-start:0;
+                if(keys<=(uint64_t)offset){
+                    offset-=(int)keys;
+                    continue;
                 }
             }
-        }
-        if(currentNode && currentNode==endNode){
-            auto sk = !startKey?NULL: createBPlusCell<K>(startKey, NULL, NULL);
-            auto ek = !endKey? NULL: createBPlusCell<K>(endKey, NULL, NULL);
-            if(currentNode && currentNode->cellsList){
-                auto st1 = LL::searchTillStream<BPlusCell<K>>(currentNode->cellsList, compare, sk, ek);
-                for(auto n1 : *st1){
-                    if(skip>=offset) {
-                        if (count == limit) {
-                            break;
-                        }
-                        count++;
-                        auto kvp = std::shared_ptr<BB_KV_P<K,V>>(new BB_KV_P<K,V>(n1->key,std::static_pointer_cast<V>(n1->value)));
-                        result->push_back(kvp);
-                    }else{
-                        skip++;
-                    }
-                }
+            auto page=scan(shard, offset, limit);
+            offset=0;
+            if(limit>0){
+                limit-=(int)page->size();
             }
+            result->insert(result->end(), std::make_move_iterator(page->begin()), std::make_move_iterator(page->end()));
         }
-
         return result;
     }
 
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<std::shared_ptr<K>>> searchForRangeWithPagination(std::shared_ptr<ShardedBPlusTree<K,V,Compare>> sharded,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_shardedRange<std::shared_ptr<K>>(sharded, offset, limit, startKey, endKey, [&](std::shared_ptr<BPlusTree<K,V,Compare>>& shard,int offset,int limit){
+            return BB::searchForRangeWithPagination(shard, offset, limit, startKey, endKey);
+        });
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<V>> searchForRangeWithPaginationV(std::shared_ptr<ShardedBPlusTree<K,V,Compare>> sharded,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_shardedRange<V>(sharded, offset, limit, startKey, endKey, [&](std::shared_ptr<BPlusTree<K,V,Compare>>& shard,int offset,int limit){
+            return BB::searchForRangeWithPaginationV(shard, offset, limit, startKey, endKey);
+        });
+    }
+
+    template<typename K,typename V,typename Compare>
+    static std::shared_ptr<std::vector<BB_KV<K,V>>> searchForRangeWithPaginationKV(std::shared_ptr<ShardedBPlusTree<K,V,Compare>> sharded,int offset=0,int limit=-1,std::shared_ptr<K> startKey=NULL,std::shared_ptr<K> endKey=NULL){
+        return BB::_shardedRange<BB_KV<K,V>>(sharded, offset, limit, startKey, endKey, [&](std::shared_ptr<BPlusTree<K,V,Compare>>& shard,int offset,int limit){
+            return BB::searchForRangeWithPaginationKV(shard, offset, limit, startKey, endKey);
+        });
+    }
+
 }
 #endif // !BTREE
-
@@ -0,0 +1,1248 @@
+/**
+Differential tests of the BB:: operations against std::multimap.
+
+Trees keep one entry per distinct key with a count of its duplicates and the value inserted last, so the model is read that way:
+sizes count every entry of the multimap, ranges list its distinct keys, a key's value is the last of its equal range,
+and deleteKey removes a key along with its duplicates as multimap::erase(key) does.
+Exits non zero when any check fails.
+*/
+#include "btree.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <limits>
+#include <map>
+#include <random>
+#include <set>
+#include <sys/stat.h>
+
+typedef std::multimap<int64_t,int64_t> Model;
+
+static int failures=0;
+
+#define CHECK(condition) do{ \
+    if(!(condition)){ \
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+}while(0)
+
+///directory for the files of one test, removed with everything in it when the test is done
+struct TempDirectory{
+    std::string path;
+
+    TempDirectory(){
+        char name[]="/tmp/btree_test.XXXXXX";
+        if(!mkdtemp(name)){
+            throw "cannot create temporary directory";
+        }
+        this->path=name;
+    }
+
+    ~TempDirectory(){
+        DIR* dir=opendir(this->path.c_str());
+        if(dir){
+            while(struct dirent* entry=readdir(dir)){
+                std::string name=entry->d_name;
+                if(name!="." && name!=".."){
+                    unlink((this->path+"/"+name).c_str());
+                }
+            }
+            closedir(dir);
+        }
+        rmdir(this->path.c_str());
+    }
+};
+
+///distinct keys of model in [startKey, endKey], either bound may be left out
+static std::vector<int64_t> modelRange(const Model& model,const int64_t* startKey,const int64_t* endKey){
+    std::vector<int64_t> keys;
+    auto it=startKey?model.lower_bound(*startKey):model.begin();
+    auto end=endKey?model.upper_bound(*endKey):model.end();
+    for(;it!=end;it=model.upper_bound(it->first)){
+        keys.push_back(it->first);
+    }
+    return keys;
+}
+
+static std::vector<int64_t> keysOf(const std::shared_ptr<std::vector<std::shared_ptr<int64_t>>>& result){
+    std::vector<int64_t> keys;
+    for(auto& key : *result){
+        keys.push_back(*key);
+    }
+    return keys;
+}
+
+typedef BB::BB_KV<int64_t,int64_t> KV;
+
+///distinct keys of model in [startKey, endKey] with the value inserted last for each, from offset on and at most limit (-1 for all) of them
+static std::vector<std::pair<int64_t,int64_t>> modelEntries(const Model& model,const int64_t* startKey,const int64_t* endKey,int offset=0,int limit=-1){
+    std::vector<std::pair<int64_t,int64_t>> entries;
+    for(int64_t key : modelRange(model, startKey, endKey)){
+        if(offset>0){
+            offset--;
+            continue;
+        }
+        if(limit>=0 && (int)entries.size()>=limit){
+            break;
+        }
+        entries.push_back(std::make_pair(key, std::prev(model.upper_bound(key))->second));
+    }
+    return entries;
+}
+
+static std::vector<std::pair<int64_t,int64_t>> entriesOf(const std::shared_ptr<std::vector<KV>>& result){
+    std::vector<std::pair<int64_t,int64_t>> entries;
+    for(const KV& kv : *result){
+        entries.push_back(std::make_pair(kv.key, kv.value));
+    }
+    return entries;
+}
+
+///compares a random page of a random range of tree with the model, for trees of every kind
+template<typename T>
+static void checkRandomRange(const std::shared_ptr<T>& tree,const Model& model,std::mt19937_64& random){
+    int64_t low=(int64_t)(random()%1000);
+    int64_t high=low+(int64_t)(random()%400);
+    int offset=(int)(random()%4==0?random()%20:0);
+    int limit=random()%3==0?(int)(random()%50):-1;
+    CHECK(entriesOf(BB::searchForRangeWithPaginationKV(tree, offset, limit, std::make_shared<int64_t>(low), std::make_shared<int64_t>(high)))==modelEntries(model, &low, &high, offset, limit));
+    CHECK(entriesOf(BB::searchForRangeWithPaginationKV(tree))==modelEntries(model, NULL, NULL));
+    CHECK(BB::getSize(tree)==model.size());
+}
+
+///inserts, deletes, batches of both and ranges with offsets on an in memory tree, for small and larger nodes
+static void testTree(){
+    std::mt19937_64 random(1);
+    std::uniform_int_distribution<int64_t> keys(0, 999);
+    for(int max_node_size : {4, 6, 16}){
+        auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(max_node_size);
+        Model model;
+        for(int i=0;i<6000;i++){
+            uint64_t operation=random()%20;
+            if(operation<10){
+                int64_t key=keys(random);
+                BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i);
+                model.insert(std::make_pair(key, (int64_t)i));
+            }else if(operation<16){
+                int64_t key=keys(random);
+                bool found=model.count(key)>0;
+                CHECK(BB::deleteKeyReturnValue(tree, std::make_shared<int64_t>(key))==(found?std::prev(model.upper_bound(key))->second:0));
+                model.erase(key);
+            }else if(operation<18){
+                //unsorted, with repeats, applied as if inserted one by one in order
+                std::vector<std::pair<int64_t,int64_t>> batch;
+                for(int b=(int)(random()%60);b>0;b--){
+                    batch.push_back(std::make_pair(keys(random), (int64_t)(i*100+b)));
+                }
+                BB::insertBatch(tree, batch.begin(), batch.end());
+                for(auto& entry : batch){
+                    model.insert(entry);
+                }
+            }else{
+                std::vector<int64_t> batch;
+                for(int b=(int)(random()%60);b>0;b--){
+                    batch.push_back(keys(random));
+                }
+                uint64_t expected=0;
+                for(int64_t key : batch){
+                    expected+=model.erase(key)>0;
+                }
+                CHECK(BB::deleteBatch(tree, batch.begin(), batch.end())==expected);
+            }
+            if(i%50==0){
+                checkRandomRange(tree, model, random);
+                int64_t low=keys(random);
+                int64_t high=low+keys(random)/2;
+                CHECK(BB::countRange(tree, std::make_shared<int64_t>(low), std::make_shared<int64_t>(high))==(uint64_t)std::distance(model.lower_bound(low), model.upper_bound(high)));
+            }
+        }
+        checkRandomRange(tree, model, random);
+    }
+}
+
+///a snapshot keeps reading the entries it was taken with while the tree goes on changing
+static void testSnapshot(){
+    std::mt19937_64 random(10);
+    std::uniform_int_distribution<int64_t> keys(0, 999);
+    auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(4);
+    Model model;
+    for(int i=0;i<2000;i++){
+        int64_t key=keys(random);
+        BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i);
+        model.insert(std::make_pair(key, (int64_t)i));
+    }
+    auto snapshot=BB::snapshot(tree);
+    Model frozen=model;
+    for(int i=0;i<3000;i++){
+        int64_t key=keys(random);
+        if(random()%2){
+            BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i);
+            model.insert(std::make_pair(key, (int64_t)i));
+        }else{
+            BB::deleteKey(tree, std::make_shared<int64_t>(key));
+            model.erase(key);
+        }
+    }
+    checkRandomRange(tree, model, random);
+    checkRandomRange(snapshot, frozen, random);
+}
+
+///splitTree and joinTrees move exactly the entries on either side of the key
+static void testSplitJoin(){
+    std::mt19937_64 random(23);
+    std::uniform_int_distribution<int64_t> keys(0, 999);
+    auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(4);
+    Model model;
+    for(int i=0;i<3000;i++){
+        int64_t key=keys(random);
+        BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i);
+        model.insert(std::make_pair(key, (int64_t)i));
+    }
+    for(int round=0;round<20;round++){
+        int64_t key=keys(random);
+        auto right=BB::splitTree(tree, key);
+        Model leftModel(model.begin(), model.lower_bound(key));
+        Model rightModel(model.lower_bound(key), model.end());
+        checkRandomRange(tree, leftModel, random);
+        checkRandomRange(right, rightModel, random);
+        //both halves stay writable on their own
+        int64_t extra=key-1;
+        BB::insert(tree, std::make_shared<int64_t>(extra), (int64_t)-round);
+        model.insert(std::make_pair(extra, (int64_t)-round));
+        BB::joinTrees(tree, right);
+        CHECK(BB::getSize(right)==0);
+        checkRandomRange(tree, model, random);
+    }
+}
+
+///shards split and merge as they grow and shrink, reads stitched across them match the model
+static void testShardedTree(){
+    std::mt19937_64 random(24);
+    std::uniform_int_distribution<int64_t> keys(0, 999);
+    BPlusShardOptions options;
+    options.split_entries=200;
+    options.merge_entries=50;
+    auto sharded=std::make_shared<ShardedBPlusTree<int64_t,int64_t>>(8, options);
+    Model model;
+    size_t most=0;
+    for(int i=0;i<8000;i++){
+        int64_t key=keys(random);
+        //grows first, then shrinks, so shards are both split and merged
+        if(random()%10<(i<4000?7u:3u)){
+            BB::insert(sharded, std::make_shared<int64_t>(key), (int64_t)i);
+            model.insert(std::make_pair(key, (int64_t)i));
+        }else{
+            CHECK((BB::deleteKey(sharded, std::make_shared<int64_t>(key))!=NULL)==(model.count(key)>0));
+            model.erase(key);
+        }
+        most=std::max(most, sharded->shards.size());
+        if(i%100==0){
+            checkRandomRange(sharded, model, random);
+            std::shared_ptr<int64_t> found=BB::searchForKey(sharded, std::make_shared<int64_t>(key), SearchType::GreaterThanOrEqualsTo);
+            auto expected=model.lower_bound(key);
+            CHECK(found?expected!=model.end() && *found==expected->first:expected==model.end());
+        }
+    }
+    CHECK(most>1);
+    CHECK(sharded->shards.size()<most);
+    checkRandomRange(sharded, model, random);
+}
+
+///recovers a tree from the files of log into a new tree, and checks it against the model
+static std::shared_ptr<BPlusLog<int64_t,int64_t,ThreeWayCompare<int64_t>>> recoverAndCheck(const std::string& base,const Model& model,std::mt19937_64& random,BPlusLogOptions options){
+    auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(8);
+    auto log=BB::openLog(tree, base, options);
+    checkRandomRange(tree, model, random);
+    return log;
+}
+
+static void appendToFile(const std::string& file,const std::vector<char>& bytes){
+    FILE* out=std::fopen(file.c_str(), "ab");
+    CHECK(out!=NULL);
+    if(out){
+        std::fwrite(bytes.data(), 1, bytes.size(), out);
+        std::fclose(out);
+    }
+}
+
+static long fileSize(const std::string& file){
+    struct stat status;
+    return stat(file.c_str(), &status)==0?(long)status.st_size:-1;
+}
+
+///waits up to ten seconds for the checkpointer of the log at base to write a checkpoint numbered after after
+static bool waitForCheckpoint(const std::string& base,uint64_t after){
+    for(int i=0;i<1000;i++){
+        auto checkpoints=BB::_logFiles(base, "ckpt");
+        if(!checkpoints.empty() && checkpoints.back()>after){
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+///writes through a log with checkpoints, drops it as a crash would and replays it, then again with torn and corrupt records at the end
+static void testLogRecovery(){
+    TempDirectory dir;
+    std::string base=dir.path+"/tree";
+    std::mt19937_64 random(14);
+    std::uniform_int_distribution<int64_t> keys(0, 499);
+    BPlusLogOptions options;
+    options.checkpoint_bytes=4096;
+    Model model;
+
+    auto log=recoverAndCheck(base, model, random, options);
+    for(int round=0;round<3;round++){
+        for(int i=0;i<1500;i++){
+            int64_t key=keys(random);
+            if(random()%3){
+                BB::insert(log, std::make_shared<int64_t>(key), (int64_t)(round*10000+i));
+                model.insert(std::make_pair(key, (int64_t)(round*10000+i)));
+            }else{
+                BB::deleteKey(log, std::make_shared<int64_t>(key));
+                model.erase(key);
+            }
+        }
+        //every write returned durable, so all of them must come back
+        CHECK(waitForCheckpoint(base, 0));
+        log.reset();
+        log=recoverAndCheck(base, model, random, options);
+    }
+
+    //a record cut short by the crash is dropped and its segment truncated to the records before it
+    int64_t key=7;
+    BB::insert(log, std::make_shared<int64_t>(key), (int64_t)-1);
+    model.insert(std::make_pair(key, (int64_t)-1));
+    log.reset();
+    std::string segment=BB::_logFile(base, "log", BB::_logFiles(base, "log").back());
+    long intact=fileSize(segment);
+    std::vector<char> torn;
+    int64_t lost=1000;
+    BB::_appendLogRecord(torn, BB::LOG_INSERT, lost, &lost);
+    torn.resize(torn.size()-3);
+    appendToFile(segment, torn);
+    log=recoverAndCheck(base, model, random, options);
+    CHECK(fileSize(segment)==intact);
+    CHECK(BB::searchForKey(log->tree, std::make_shared<int64_t>(lost))==NULL);
+
+    //so is a whole record whose checksum does not match
+    log.reset();
+    segment=BB::_logFile(base, "log", BB::_logFiles(base, "log").back());
+    intact=fileSize(segment);
+    std::vector<char> corrupt;
+    BB::_appendLogRecord(corrupt, BB::LOG_DELETE, key, (const int64_t*)NULL);
+    corrupt.back()^=1;
+    appendToFile(segment, corrupt);
+    log=recoverAndCheck(base, model, random, options);
+    CHECK(fileSize(segment)==intact);
+    CHECK(BB::searchForKey(log->tree, std::make_shared<int64_t>(key))!=NULL);
+
+    //the write which grows the segment past checkpoint_bytes returns without taking the checkpoint, which is written after it with no more writes
+    uint64_t last=BB::_logFiles(base, "ckpt").back();
+    uint64_t segmentNumber=log->segment;
+    for(int64_t i=0;;i++){
+        BB::insert(log, std::make_shared<int64_t>(i), i);
+        model.insert(std::make_pair(i, i));
+        std::lock_guard<std::mutex> lock(log->mutex);
+        if(log->checkpoint_due || log->checkpointing || log->segment!=segmentNumber){
+            break;
+        }
+    }
+    CHECK(waitForCheckpoint(base, last));
+    log.reset();
+    log=recoverAndCheck(base, model, random, options);
+}
+
+
+typedef BPlusPagedTree<int64_t,int64_t> PagedTree;
+
+///walks the pages under id, checking their fill (but the root's), the child counts and that leaves are all as deep, and lists the leaves in order
+static BPlusPageCount checkPageSubtree(PagedTree* tree,uint64_t id,bool root,int depth,int& leafDepth,std::vector<uint64_t>& leaves,uint64_t& pages){
+    pages++;
+    const BPlusPageNode* page=tree->pinPage(id);
+    BPlusPageCount total=BB::_pageCount(tree->layout, page);
+    if(page->is_leaf){
+        CHECK(root?page->count>0:page->count>=tree->layout.leaf_capacity/2);
+        CHECK(leafDepth<0 || leafDepth==depth);
+        leafDepth=depth;
+        leaves.push_back(id);
+    }else{
+        CHECK(root?page->count>0:page->count>=(tree->layout.internal_capacity-1)/2);
+        std::vector<uint64_t> children(tree->layout.children(page), tree->layout.children(page)+page->count+1);
+        std::vector<BPlusPageCount> counts(tree->layout.childCounts(page), tree->layout.childCounts(page)+page->count+1);
+        tree->unpinPage(id);
+        for(size_t i=0;i<children.size();i++){
+            BPlusPageCount child=checkPageSubtree(tree, children[i], false, depth+1, leafDepth, leaves, pages);
+            CHECK(child.entries==counts[i].entries && child.keys==counts[i].keys);
+        }
+        return total;
+    }
+    tree->unpinPage(id);
+    return total;
+}
+
+///structure of a paged tree: see checkPageSubtree, the leaf chain runs through the leaves in order both ways, and every page is either in the tree or free
+static void checkPages(const std::shared_ptr<PagedTree>& tree){
+    int leafDepth=-1;
+    std::vector<uint64_t> leaves;
+    uint64_t pages=0;
+    if(tree->header.root_page){
+        CHECK(checkPageSubtree(tree.get(), tree->header.root_page, true, 0, leafDepth, leaves, pages).entries==tree->header.size);
+    }
+    std::vector<uint64_t> chain;
+    for(uint64_t id=tree->header.left_most_page,previous=0;id;){
+        const BPlusPageNode* page=tree->pinPage(id);
+        CHECK(page->left_sibling==previous);
+        chain.push_back(id);
+        previous=id;
+        uint64_t next=page->right_sibling;
+        tree->unpinPage(id);
+        id=next;
+    }
+    CHECK(chain==leaves);
+    CHECK(tree->header.right_most_page==(leaves.empty()?0:leaves.back()));
+    for(uint64_t id=tree->header.free_page;id;){
+        pages++;
+        uint64_t next=tree->pinPage(id)->right_sibling;
+        tree->unpinPage(id);
+        id=next;
+    }
+    CHECK(pages+1==tree->header.page_count);
+}
+
+///the tree and the paged file written from it take the same inserts and deletes, both are checked against the model,
+///and the pages deletes free are reused
+static void testPagedTree(){
+    TempDirectory dir;
+    std::mt19937_64 random(15);
+    std::uniform_int_distribution<int64_t> keys(0, 999);
+
+    auto memory=std::make_shared<BPlusTree<int64_t,int64_t>>(8);
+    Model model;
+    for(int i=0;i<3000;i++){
+        int64_t key=keys(random);
+        BB::insert(memory, std::make_shared<int64_t>(key), (int64_t)i);
+        model.insert(std::make_pair(key, (int64_t)i));
+    }
+    std::string file=dir.path+"/tree.pages";
+    BB::writePages(memory, file, 256);
+    auto paged=BB::openPagedTree<int64_t,int64_t>(file, 8);
+    CHECK(BB::getSize(paged)==model.size());
+    CHECK(keysOf(BB::searchForRangeWithPagination(paged))==modelRange(model, NULL, NULL));
+
+    for(int i=0;i<4000;i++){
+        int64_t key=keys(random);
+        if(random()%5<3){
+            BB::insert(memory, std::make_shared<int64_t>(key), (int64_t)i);
+            BB::insert(paged, std::make_shared<int64_t>(key), (int64_t)i);
+            model.insert(std::make_pair(key, (int64_t)i));
+        }else{
+            bool found=model.count(key)>0;
+            CHECK((BB::deleteKey(memory, std::make_shared<int64_t>(key))!=NULL)==found);
+            CHECK((BB::deleteKey(paged, std::make_shared<int64_t>(key))!=NULL)==found);
+            model.erase(key);
+        }
+        if(i%100==0){
+            int64_t low=keys(random);
+            int64_t high=low+keys(random)/4;
+            std::vector<int64_t> expected=modelRange(model, &low, &high);
+            auto start=std::make_shared<int64_t>(low);
+            auto end=std::make_shared<int64_t>(high);
+            CHECK(keysOf(BB::searchForRangeWithPagination(memory, 0, -1, start, end))==expected);
+            CHECK(keysOf(BB::searchForRangeWithPagination(paged, 0, -1, start, end))==expected);
+            CHECK(BB::getSize(memory)==model.size());
+            CHECK(BB::getSize(paged)==model.size());
+            checkPages(paged);
+        }
+    }
+    for(auto it=model.begin();it!=model.end();it=model.upper_bound(it->first)){
+        int64_t value=0;
+        CHECK(BB::searchForValue(paged, std::make_shared<int64_t>(it->first), value));
+        CHECK(value==std::prev(model.upper_bound(it->first))->second);
+    }
+
+    //empties whole leaves in the middle, ranges ending past them must still reach the keys after
+    for(int64_t key=200;key<400;key++){
+        BB::deleteKey(paged, std::make_shared<int64_t>(key));
+        model.erase(key);
+    }
+    int64_t low=100;
+    int64_t high=600;
+    CHECK(keysOf(BB::searchForRangeWithPagination(paged, 0, -1, std::make_shared<int64_t>(low), std::make_shared<int64_t>(high)))==modelRange(model, &low, &high));
+    int64_t inside=250;
+    CHECK(keysOf(BB::searchForRangeWithPagination(paged, 0, -1, std::make_shared<int64_t>(inside), std::make_shared<int64_t>(high)))==modelRange(model, &inside, &high));
+    CHECK(BB::getSize(paged)==model.size());
+    checkPages(paged);
+
+    //emptied down to nothing, the file does not grow when filled up again
+    uint64_t pageCount=paged->header.page_count;
+    for(int64_t key=0;key<1000;key++){
+        BB::deleteKey(paged, std::make_shared<int64_t>(key));
+    }
+    CHECK(BB::getSize(paged)==0 && paged->header.root_page==0);
+    checkPages(paged);
+    for(auto& entry : model){
+        BB::insert(paged, std::make_shared<int64_t>(entry.first), entry.second);
+    }
+    CHECK(paged->header.page_count==pageCount);
+    checkPages(paged);
+
+    //the file holds the same entries once it is reopened
+    BB::flush(paged);
+    paged.reset();
+    auto reopened=BB::openPagedTree<int64_t,int64_t>(file, 8);
+    CHECK(BB::getSize(reopened)==model.size());
+    CHECK(keysOf(BB::searchForRangeWithPagination(reopened))==modelRange(model, NULL, NULL));
+}
+
+///a BB operation called from a callback of another on the same tree throws instead of deadlocking, and leaves the tree usable
+static void testNestedOperations(){
+#ifndef NDEBUG
+    auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(8);
+    for(int64_t key=0;key<100;key++){
+        BB::insert(tree, std::make_shared<int64_t>(key), key);
+    }
+    bool threw=false;
+    try{
+        BB::find(tree, [&](const int64_t& k1,const int64_t&){
+            BB::insert(tree, std::make_shared<int64_t>(k1+1000), k1);
+            return 0;
+        });
+    }catch(const char*){
+        threw=true;
+    }
+    CHECK(threw);
+    BB::insert(tree, std::make_shared<int64_t>(1000), (int64_t)0);
+    CHECK(BB::getSize(tree)==101);
+#endif
+}
+
+///a shard with an open snapshot is not split, but the writes to it still succeed, and it is split once the snapshot is gone
+static void testShardSnapshot(){
+    BPlusShardOptions options;
+    options.split_entries=50;
+    options.merge_entries=10;
+    auto sharded=std::make_shared<ShardedBPlusTree<int64_t,int64_t>>(8, options);
+    auto snapshot=BB::snapshot(sharded->shards[0]);
+    bool threw=false;
+    try{
+        for(int64_t key=0;key<100;key++){
+            BB::insert(sharded, std::make_shared<int64_t>(key), key);
+        }
+    }catch(const char*){
+        threw=true;
+    }
+    CHECK(!threw);
+    CHECK(sharded->shards.size()==1);
+    CHECK(BB::getSize(sharded)==100);
+    CHECK(BB::getSize(snapshot)==0);
+    //outside of a sharded tree, restructuring a tree with an open snapshot is still an error
+    threw=false;
+    try{
+        BB::splitTree(sharded->shards[0], (int64_t)50);
+    }catch(const char*){
+        threw=true;
+    }
+    CHECK(threw);
+    CHECK(BB::getSize(sharded)==100);
+
+    snapshot.reset();
+    BB::insert(sharded, std::make_shared<int64_t>(100), (int64_t)100);
+    CHECK(sharded->shards.size()==2);
+    CHECK(BB::getSize(sharded)==101);
+}
+
+///appends pack leaves full whether or not a snapshot is open, which makes the writes copy the rightmost path
+static void testAppendPacking(){
+    auto plain=std::make_shared<BPlusTree<int64_t,int64_t>>(16);
+    auto shared=std::make_shared<BPlusTree<int64_t,int64_t>>(16);
+    BB::insert(shared, std::make_shared<int64_t>(0), (int64_t)0);
+    auto snapshot=BB::snapshot(shared);
+    BB::insert(plain, std::make_shared<int64_t>(0), (int64_t)0);
+    for(int64_t key=1;key<2000;key++){
+        BB::insert(plain, std::make_shared<int64_t>(key), key);
+        BB::insert(shared, std::make_shared<int64_t>(key), key);
+        //snapshots taken while the rightmost leaf is short make the next append find it shared
+        if(key%7==0){
+            snapshot=BB::snapshot(shared);
+        }
+    }
+    CHECK(BB::stats(shared).leaf_chain_length==BB::stats(plain).leaf_chain_length);
+    CHECK(BB::stats(plain).leaf_chain_length<=2000/16+1);
+    CHECK(BB::getSize(snapshot)==1996);
+}
+
+///parallel scans return what the sequential ones do, in key order and cut at limit, and stop scanning subtrees past the limit
+static void testParallelFind(){
+    std::mt19937_64 random(7);
+    auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(8);
+    for(int i=0;i<5000;i++){
+        BB::insert(tree, std::make_shared<int64_t>((int64_t)(random()%3000)), (int64_t)i);
+    }
+    BPlusThreadPool pool(3);
+    auto everyThird=[](const int64_t& k1,const int64_t&){
+        return k1%3==0?0:1;
+    };
+    for(int round=0;round<20;round++){
+        std::shared_ptr<int64_t> bookmark=round%2==0?NULL:std::make_shared<int64_t>((int64_t)(random()%3000));
+        CHECK(keysOf(BB::parallelFind(tree, pool, everyThird, bookmark))==keysOf(BB::find(tree, everyThird, bookmark)));
+        CHECK(keysOf(BB::parallelFind(tree, pool, everyThird, bookmark, true))==keysOf(BB::find(tree, everyThird, bookmark, true)));
+        for(uint64_t limit : {0, 1, 7, 100, 100000}){
+            CHECK(*BB::parallelFindV(tree, pool, everyThird, bookmark, limit)==*BB::findV(tree, everyThird, bookmark, false, (uint)limit));
+        }
+    }
+
+    //without workers the subtrees are scanned one after another, so none after the first is read once it has matched limit entries
+    BPlusThreadPool callerOnly(0);
+    int calls=0;
+    auto result=BB::parallelFindV(tree, callerOnly, [&calls](const int64_t&,const int64_t&){
+        calls++;
+        return 0;
+    }, std::shared_ptr<int64_t>(), 5);
+    CHECK(result->size()==5);
+    CHECK(calls==5);
+
+    //a task may not run more tasks on its own pool, it throws instead of waiting on itself
+    auto other=std::make_shared<BPlusTree<int64_t,int64_t>>(8);
+    BB::insert(other, std::make_shared<int64_t>(1), (int64_t)1);
+    bool threw=false;
+    try{
+        BB::parallelFind(tree, pool, [&](const int64_t&,const int64_t&){
+            BB::parallelFind(other, pool, everyThird);
+            return 0;
+        });
+    }catch(const char*){
+        threw=true;
+    }
+    CHECK(threw);
+    BPlusThreadPool inner(1);
+    threw=false;
+    try{
+        BB::parallelFind(tree, pool, [&](const int64_t&,const int64_t&){
+            BB::parallelFind(other, inner, everyThird);
+            return 0;
+        });
+    }catch(const char*){
+        threw=true;
+    }
+    CHECK(!threw);
+}
+
+///three way compare the vector kernels are not picked for, so LL searches with it take the scalar binary search
+template<typename K>
+struct ScalarCompare{
+    int operator()(const K& k1,const K& k2) const{
+        return k1<k2?-1:(k2<k1?1:0);
+    }
+};
+
+/**
+Checks the vector kernels against the scalar search for the keys of one type: _countLesser on unsorted arrays of every size
+up to a few vectors (so the scalar tails are run too), and LL::search of every SearchType on sorted ones.
+value(random) draws keys which are mostly taken from edges, searchKeys lists keys to look up besides the ones in the arrays.
+*/
+template<typename K,typename D>
+static void checkSimdSearch(std::mt19937_64& random,D value,const std::vector<K>& searchKeys){
+    ThreeWayCompare<K> simd;
+    ScalarCompare<K> scalar;
+    for(int size=0;size<=300;size+=size<40?1:37){
+        std::vector<K> keys;
+        for(int i=0;i<size;i++){
+            keys.push_back(value(random));
+        }
+        std::vector<K> probes=searchKeys;
+        probes.insert(probes.end(), keys.begin(), keys.end());
+        for(const K& searchKey : probes){
+            int lesser=0;
+            int lesserOrEqual=0;
+            for(const K& key : keys){
+                lesser+=scalar(searchKey, key)>0;
+                lesserOrEqual+=scalar(searchKey, key)>=0;
+            }
+            CHECK(LL::_countLesser<false>(keys.data(), size, searchKey)==lesser);
+            CHECK(LL::_countLesser<true>(keys.data(), size, searchKey)==lesserOrEqual);
+        }
+        //NaN keys have no place in a sorted array, they are only looked up
+        keys.erase(std::remove_if(keys.begin(), keys.end(), [](const K& key){
+            return key!=key;
+        }), keys.end());
+        std::sort(keys.begin(), keys.end());
+        for(const K& searchKey : probes){
+            for(SearchType type : {SearchType::LesserThanOrEqualsTo, SearchType::EqualsTo, SearchType::GreaterThanOrEqualsTo, SearchType::LesserThan, SearchType::GreaterThan}){
+                CHECK(LL::search(keys, simd, searchKey, type)==LL::search(keys, scalar, searchKey, type));
+            }
+        }
+    }
+}
+
+///the kernels for int32, int64, uint64 and double keys find what the scalar search finds, at the edges of each type too
+static void testSimdSearch(){
+    std::mt19937_64 random(11);
+    checkSimdSearch<int32_t>(random, [](std::mt19937_64& random){
+        static const int32_t edges[]={INT32_MIN, INT32_MIN+1, -1, 0, 1, INT32_MAX-1, INT32_MAX};
+        return random()%4==0?edges[random()%7]:(int32_t)(random()%64)-32;
+    }, {INT32_MIN, -33, 0, 33, INT32_MAX});
+    checkSimdSearch<int64_t>(random, [](std::mt19937_64& random){
+        static const int64_t edges[]={INT64_MIN, INT64_MIN+1, -1, 0, 1, INT64_MAX-1, INT64_MAX};
+        return random()%4==0?edges[random()%7]:(int64_t)(random()%64)-32;
+    }, {INT64_MIN, -33, 0, 33, INT64_MAX});
+    //keys past INT64_MAX are where a signed compare without the sign bias goes wrong
+    checkSimdSearch<uint64_t>(random, [](std::mt19937_64& random){
+        static const uint64_t edges[]={0, 1, (uint64_t)INT64_MAX, (uint64_t)INT64_MAX+1, UINT64_MAX-1, UINT64_MAX};
+        return random()%4==0?edges[random()%6]:(random()%2==0?0:(uint64_t)INT64_MAX-31)+random()%64;
+    }, {0, (uint64_t)INT64_MAX, (uint64_t)INT64_MAX+1, (uint64_t)INT64_MAX+40, UINT64_MAX});
+    const double nan=std::numeric_limits<double>::quiet_NaN();
+    const double infinity=std::numeric_limits<double>::infinity();
+    checkSimdSearch<double>(random, [nan,infinity](std::mt19937_64& random){
+        const double edges[]={-infinity, -1.5, -0.0, 0.0, 1.5, infinity, nan};
+        return random()%4==0?edges[random()%7]:(double)((int)(random()%64)-32)/4;
+    }, {-infinity, -0.0, 0.0, infinity, nan});
+}
+
+///distinct key of model which satisfies searchType for key, as LL::search picks it, false if there is none
+static bool modelSeek(const Model& model,int64_t key,SearchType searchType,int64_t& found){
+    Model::const_iterator it;
+    switch(searchType){
+        case SearchType::EqualsTo: it=model.find(key); break;
+        case SearchType::GreaterThanOrEqualsTo: it=model.lower_bound(key); break;
+        case SearchType::GreaterThan: it=model.upper_bound(key); break;
+        case SearchType::LesserThanOrEqualsTo:
+        case SearchType::LesserThan:{
+            it=searchType==SearchType::LesserThan?model.lower_bound(key):model.upper_bound(key);
+            if(it==model.begin()){
+                return false;
+            }
+            it--;
+            break;
+        }
+    }
+    if(it==model.end()){
+        return false;
+    }
+    found=it->first;
+    return true;
+}
+
+///cursors seek as the model does for every SearchType, and walk the whole tree both ways reading keys, values and duplicate counts in place
+static void testCursor(){
+    std::mt19937_64 random(12);
+    for(int max_node_size : {4, 16}){
+        auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(max_node_size);
+        Model model;
+        auto cursor=BB::createCursor(tree);
+        CHECK(!cursor.seekToFirst() && !cursor.seekToLast() && !cursor.seek(0));
+        for(int i=0;i<3000;i++){
+            int64_t key=(int64_t)(random()%1000);
+            if(random()%4==0){
+                BB::deleteKey(tree, std::make_shared<int64_t>(key));
+                model.erase(key);
+            }else{
+                BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i);
+                model.insert(std::make_pair(key, (int64_t)i));
+            }
+        }
+        for(int i=0;i<500;i++){
+            int64_t key=(int64_t)(random()%1100)-50;
+            SearchType searchType=(SearchType)(random()%5);
+            int64_t expected=0;
+            bool found=modelSeek(model, key, searchType, expected);
+            CHECK(cursor.seek(key, searchType)==found);
+            CHECK(cursor.isValid()==found);
+            if(found && cursor.isValid()){
+                CHECK(cursor.key()==expected);
+            }
+        }
+
+        std::vector<std::pair<int64_t,int64_t>> forward;
+        for(bool valid=cursor.seekToFirst();valid;valid=cursor.next()){
+            CHECK(cursor.duplicateCount()==(int)model.count(cursor.key())-1);
+            forward.push_back(std::make_pair(cursor.key(), cursor.value()));
+        }
+        CHECK(!cursor.isValid() && !cursor.next());
+        CHECK(forward==modelEntries(model, NULL, NULL));
+        std::vector<std::pair<int64_t,int64_t>> backward;
+        for(bool valid=cursor.seekToLast();valid;valid=cursor.prev()){
+            backward.push_back(std::make_pair(cursor.key(), cursor.value()));
+        }
+        std::reverse(backward.begin(), backward.end());
+        CHECK(backward==forward);
+
+        //a cursor over a snapshot stays valid while the tree is written to
+        {
+            auto snapshotCursor=BB::createCursor(BB::snapshot(tree));
+            std::vector<std::pair<int64_t,int64_t>> snapshotted;
+            for(bool valid=snapshotCursor.seekToFirst();valid;valid=snapshotCursor.next()){
+                snapshotted.push_back(std::make_pair(snapshotCursor.key(), snapshotCursor.value()));
+                BB::insert(tree, std::make_shared<int64_t>((int64_t)(random()%1000)), (int64_t)-2);
+            }
+            CHECK(snapshotted==forward);
+        }
+
+        //values are read in place, so writing through a cursor changes the entry
+        if(cursor.seekToFirst()){
+            int64_t key=cursor.key();
+            cursor.value()=-1;
+            CHECK(BB::findV(tree, [key](const int64_t& k1,const int64_t&){
+                return k1==key?0:1;
+            })->front()==-1);
+        }
+    }
+}
+
+///range queries match what the model has between their bounds, and their filter is only called on keys within the bounds
+static void testRangeQuery(){
+    std::mt19937_64 random(13);
+    auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(6);
+    Model model;
+    for(int i=0;i<4000;i++){
+        int64_t key=(int64_t)(random()%1000);
+        BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i);
+        model.insert(std::make_pair(key, (int64_t)i));
+    }
+    for(int round=0;round<300;round++){
+        std::shared_ptr<int64_t> lower=random()%5==0?NULL:std::make_shared<int64_t>((int64_t)(random()%1000));
+        std::shared_ptr<int64_t> upper=random()%5==0?NULL:std::make_shared<int64_t>((lower?*lower:0)+(int64_t)(random()%200));
+        bool lowerInclusive=random()%2==0;
+        bool upperInclusive=random()%2==0;
+        std::shared_ptr<int64_t> bookmark=random()%3==0?std::make_shared<int64_t>((int64_t)(random()%1000)):NULL;
+        uint limit=random()%3==0?(uint)(random()%20):0;
+        int calls=0;
+        auto query=BB::rangeQuery(lower, upper, [&calls](const int64_t& key){
+            calls++;
+            return key%3!=0;
+        }, lowerInclusive, upperInclusive);
+
+        std::vector<int64_t> inRange;
+        std::vector<int64_t> expectedKeys;
+        std::vector<int64_t> expectedDuplicates;
+        std::vector<int64_t> expectedValues;
+        for(int64_t key : modelRange(model, NULL, NULL)){
+            if((lower && (key<*lower || (!lowerInclusive && key==*lower))) || (upper && (key>*upper || (!upperInclusive && key==*upper)))){
+                continue;
+            }
+            if(bookmark && key<=*bookmark){
+                continue;
+            }
+            inRange.push_back(key);
+            if(key%3==0){
+                continue;
+            }
+            expectedKeys.push_back(key);
+            expectedDuplicates.insert(expectedDuplicates.end(), model.count(key), key);
+            if(limit==0 || expectedValues.size()<limit){
+                expectedValues.push_back(std::prev(model.upper_bound(key))->second);
+            }
+        }
+        CHECK(keysOf(BB::find(tree, query, bookmark))==expectedKeys);
+        CHECK(calls==(int)inRange.size());
+        CHECK(keysOf(BB::find(tree, query, bookmark, true))==expectedDuplicates);
+        CHECK(*BB::findV(tree, query, bookmark, limit)==expectedValues);
+    }
+}
+
+///columnar exports in batches of any size add up to the model's range, and stay in order when the tree changes between batches
+static void testExportRange(){
+    std::mt19937_64 random(14);
+    auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(8);
+    Model model;
+    for(int i=0;i<3000;i++){
+        int64_t key=(int64_t)(random()%1000);
+        BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i);
+        model.insert(std::make_pair(key, (int64_t)i));
+    }
+    for(int round=0;round<50;round++){
+        int64_t low=(int64_t)(random()%1000);
+        int64_t high=low+(int64_t)(random()%500);
+        bool bounded=round%5!=0;
+        size_t capacity=1+random()%50;
+        std::vector<int64_t> keys(capacity);
+        std::vector<int64_t> values(capacity);
+        std::vector<int> duplicates(capacity);
+        BB::BB_ExportCursor<int64_t> cursor;
+        CHECK(BB::exportRange(tree, cursor, 0, keys.data(), values.data())==0 && !cursor.done);
+        std::vector<std::pair<int64_t,int64_t>> exported;
+        std::vector<int> exportedDuplicates;
+        while(size_t count=BB::exportRange(tree, cursor, capacity, keys.data(), values.data(), duplicates.data(), bounded?std::make_shared<int64_t>(low):NULL, bounded?std::make_shared<int64_t>(high):NULL)){
+            CHECK(count<=capacity);
+            for(size_t i=0;i<count;i++){
+                exported.push_back(std::make_pair(keys[i], values[i]));
+                exportedDuplicates.push_back(duplicates[i]);
+            }
+        }
+        CHECK(cursor.done);
+        CHECK(exported==modelEntries(model, bounded?&low:NULL, bounded?&high:NULL));
+        for(size_t i=0;i<exported.size();i++){
+            CHECK(exportedDuplicates[i]==(int)model.count(exported[i].first)-1);
+        }
+    }
+
+    //keys only, while every batch is followed by inserts and deletes: batches go on after the last key exported,
+    //so keys come out in order, once each, and every key which is there all along comes out
+    std::set<int64_t> touched;
+    std::vector<int64_t> untouched=modelRange(model, NULL, NULL);
+    std::vector<int64_t> keys(16);
+    std::vector<int64_t> exported;
+    BB::BB_ExportCursor<int64_t> cursor;
+    while(size_t count=BB::exportRange(tree, cursor, keys.size(), keys.data(), (int64_t*)NULL)){
+        exported.insert(exported.end(), keys.begin(), keys.begin()+count);
+        for(int i=0;i<8;i++){
+            int64_t key=(int64_t)(random()%1100);
+            touched.insert(key);
+            if(random()%2==0){
+                BB::deleteKey(tree, std::make_shared<int64_t>(key));
+            }else{
+                BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i);
+            }
+        }
+    }
+    for(size_t i=1;i<exported.size();i++){
+        CHECK(exported[i-1]<exported[i]);
+    }
+    for(int64_t key : untouched){
+        if(!touched.count(key)){
+            CHECK(std::binary_search(exported.begin(), exported.end(), key));
+        }
+    }
+}
+
+///pages of a token add up to the range however they split the duplicates of a key, and keep their place when keys are deleted under them
+static void testPageToken(){
+    std::mt19937_64 random(15);
+    auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(6);
+    Model model;
+    for(int i=0;i<3000;i++){
+        //few keys, so most have a run of duplicates which pages end in the middle of
+        int64_t key=(int64_t)(random()%300);
+        BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i);
+        model.insert(std::make_pair(key, (int64_t)i));
+    }
+    for(int round=0;round<40;round++){
+        int64_t low=(int64_t)(random()%300);
+        int64_t high=low+(int64_t)(random()%150);
+        int limit=1+(int)(random()%12);
+        auto query=BB::rangeQuery(std::make_shared<int64_t>(low), std::make_shared<int64_t>(high));
+
+        std::vector<int64_t> expected;
+        for(auto it=model.lower_bound(low);it!=model.upper_bound(high);it++){
+            expected.push_back(it->first);
+        }
+        std::vector<int64_t> paged;
+        BB::BB_PageToken<int64_t> token;
+        while(!token.done){
+            auto page=keysOf(BB::find(tree, query, token, limit, true));
+            CHECK((int)page.size()<=limit);
+            CHECK(token.done || (int)page.size()==limit);
+            paged.insert(paged.end(), page.begin(), page.end());
+        }
+        CHECK(paged==expected);
+
+        std::vector<std::pair<int64_t,int64_t>> entries;
+        BB::BB_PageToken<int64_t> entriesToken;
+        while(!entriesToken.done){
+            auto page=entriesOf(BB::searchForRangeWithPaginationKV(tree, entriesToken, limit, std::make_shared<int64_t>(low), std::make_shared<int64_t>(high)));
+            entries.insert(entries.end(), page.begin(), page.end());
+        }
+        CHECK(entries==modelEntries(model, &low, &high));
+    }
+
+    //deletes between pages, of the last key handed out too, neither repeat nor skip the keys which stay
+    std::set<int64_t> deleted;
+    std::vector<int64_t> paged;
+    BB::BB_PageToken<int64_t> token;
+    while(!token.done){
+        auto page=keysOf(BB::searchForRangeWithPagination(tree, token, 5));
+        paged.insert(paged.end(), page.begin(), page.end());
+        if(!page.empty()){
+            deleted.insert(page.back());
+            BB::deleteKey(tree, std::make_shared<int64_t>(page.back()));
+        }
+        for(int i=0;i<3;i++){
+            int64_t key=(int64_t)(random()%300);
+            deleted.insert(key);
+            BB::deleteKey(tree, std::make_shared<int64_t>(key));
+        }
+    }
+    for(size_t i=1;i<paged.size();i++){
+        CHECK(paged[i-1]<paged[i]);
+    }
+    for(int64_t key : modelRange(model, NULL, NULL)){
+        if(!deleted.count(key)){
+            CHECK(std::binary_search(paged.begin(), paged.end(), key));
+        }
+    }
+
+    //the same with another thread deleting the odd keys while the pages are read
+    auto concurrent=std::make_shared<BPlusTree<int64_t,int64_t>>(6);
+    for(int64_t key=0;key<4000;key++){
+        BB::insert(concurrent, std::make_shared<int64_t>(key), key);
+    }
+    std::thread deleter([&concurrent]{
+        for(int64_t key=3999;key>0;key-=2){
+            BB::deleteKey(concurrent, std::make_shared<int64_t>(key));
+        }
+    });
+    std::vector<int64_t> read;
+    BB::BB_PageToken<int64_t> concurrentToken;
+    while(!concurrentToken.done){
+        auto page=keysOf(BB::searchForRangeWithPagination(concurrent, concurrentToken, 7));
+        read.insert(read.end(), page.begin(), page.end());
+    }
+    deleter.join();
+    std::vector<int64_t> even;
+    for(int64_t key : read){
+        if(key%2==0){
+            even.push_back(key);
+        }
+    }
+    for(size_t i=1;i<read.size();i++){
+        CHECK(read[i-1]<read[i]);
+    }
+    CHECK(even.size()==2000);
+}
+
+static std::string urlKey(int64_t number){
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "https://example.com/shop/%02d/item/%06d", (int)(number/500), (int)number);
+    return buffer;
+}
+
+///keys of each leaf share one copy of their common prefix, while the tree still reads as the model through every kind of change
+static void testPrefixCompression(){
+    typedef BPlusTree<BPlusPrefixedString,int64_t,PrefixCompressingCompare> PrefixTree;
+    std::mt19937_64 random(12);
+    auto tree=std::make_shared<PrefixTree>(16);
+    std::map<std::string,int64_t> model;
+    auto checkLeaves=[&](){
+        int shared=0;
+        for(auto leaf=tree->left_most_node;leaf;leaf=leaf->rightSibling.lock()){
+            if(leaf->size()<2){
+                continue;
+            }
+            auto prefix=leaf->keys[0].prefix;
+            shared+=prefix?1:0;
+            for(auto& key : leaf->keys){
+                CHECK(key.prefix==prefix);
+                CHECK(!prefix || key.str().compare(0, prefix->size(), *prefix)==0);
+            }
+        }
+        CHECK(model.size()<16 || shared>0);
+    };
+    auto checkRange=[&](){
+        int64_t low=(int64_t)(random()%4000);
+        int64_t high=low+(int64_t)(random()%800);
+        std::vector<std::pair<std::string,int64_t>> expected(model.lower_bound(urlKey(low)), model.upper_bound(urlKey(high)));
+        std::vector<std::pair<std::string,int64_t>> actual;
+        auto result=BB::searchForRangeWithPaginationKV(tree, 0, -1, std::make_shared<BPlusPrefixedString>(urlKey(low)), std::make_shared<BPlusPrefixedString>(urlKey(high)));
+        for(auto& kv : *result){
+            actual.push_back(std::make_pair(kv.key.str(), kv.value));
+        }
+        CHECK(actual==expected);
+    };
+    for(int i=0;i<6000;i++){
+        uint64_t operation=random()%20;
+        if(operation<10){
+            std::string key=urlKey((int64_t)(random()%4000));
+            BB::insert(tree, std::make_shared<BPlusPrefixedString>(key), (int64_t)i);
+            model[key]=i;
+        }else if(operation<15){
+            std::string key=urlKey((int64_t)(random()%4000));
+            BB::deleteKey(tree, std::make_shared<BPlusPrefixedString>(key));
+            model.erase(key);
+        }else if(operation<18){
+            std::vector<std::pair<BPlusPrefixedString,int64_t>> batch;
+            for(int b=(int)(random()%60);b>0;b--){
+                std::string key=urlKey((int64_t)(random()%4000));
+                batch.push_back(std::make_pair(BPlusPrefixedString(key), (int64_t)(i*100+b)));
+                model[key]=i*100+b;
+            }
+            BB::insertBatch(tree, batch.begin(), batch.end());
+        }else{
+            std::vector<BPlusPrefixedString> batch;
+            for(int b=(int)(random()%60);b>0;b--){
+                std::string key=urlKey((int64_t)(random()%4000));
+                batch.push_back(key);
+                model.erase(key);
+            }
+            BB::deleteBatch(tree, batch.begin(), batch.end());
+        }
+        if(i%200==0){
+            checkRange();
+            checkLeaves();
+        }
+    }
+    checkRange();
+    checkLeaves();
+
+    //a bulk loaded tree holds the same keys in less memory than one of whole strings
+    std::vector<std::pair<BPlusPrefixedString,int64_t>> prefixed;
+    std::vector<std::pair<std::string,int64_t>> plain;
+    for(auto& entry : model){
+        prefixed.push_back(std::make_pair(BPlusPrefixedString(entry.first), entry.second));
+        plain.push_back(entry);
+    }
+    auto loaded=std::make_shared<PrefixTree>(16);
+    BB::bulkLoad(loaded, prefixed.begin(), prefixed.end());
+    auto whole=std::make_shared<BPlusTree<std::string,int64_t,SuffixTruncatingCompare>>(16);
+    BB::bulkLoad(whole, plain.begin(), plain.end());
+    CHECK(BB::getSize(loaded)==model.size());
+    CHECK(BB::stats(loaded).key_heap_bytes*2<BB::stats(whole).key_heap_bytes);
+    tree=loaded;
+    checkLeaves();
+    checkRange();
+}
+
+/**
+Readers and writers on one tree at once, with nodes small enough that writes keep splitting and merging them.
+Keys divisible by 10 are never written after the start, so readers check their searches, ranks, ranges and parallel scans against those.
+Writers own disjoint keys with a model each (one also takes snapshots, whose writes copy nodes instead), the tree must read as the models joined at the end.
+*/
+static void testConcurrentReadersWriters(){
+    const int64_t KEYS=3000;
+    auto tree=std::make_shared<BPlusTree<int64_t,int64_t>>(4);
+    std::vector<int64_t> stable;
+    for(int64_t key=0;key<KEYS;key+=10){
+        BB::insert(tree, std::make_shared<int64_t>(key), key);
+        stable.push_back(key);
+    }
+
+    const int WRITERS=3;
+    std::vector<Model> models(WRITERS);
+    std::atomic<int> writing{WRITERS};
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for(int w=0;w<WRITERS;w++){
+        threads.emplace_back([&,w]{
+            std::mt19937_64 random(40+w);
+            Model& model=models[w];
+            BB::BB_InsertHint<int64_t,int64_t> hint;
+            for(int i=0;i<4000;i++){
+                //writer w owns the keys ending in 3w+1 to 3w+3
+                int64_t key=(int64_t)(random()%(KEYS/10))*10+3*w+1+(int64_t)(random()%3);
+                if(random()%5<3){
+                    if(random()%2){
+                        BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i, hint);
+                    }else{
+                        BB::insert(tree, std::make_shared<int64_t>(key), (int64_t)i);
+                    }
+                    model.insert(std::make_pair(key, (int64_t)i));
+                }else{
+                    BB::deleteKey(tree, std::make_shared<int64_t>(key));
+                    model.erase(key);
+                }
+                if(w==0 && i%1000==999){
+                    auto snapshot=BB::snapshot(tree);
+                    for(int k=0;k<50;k++){
+                        int64_t probe=(int64_t)(random()%stable.size())*10;
+                        int64_t value=-1;
+                        mismatches+=BB::searchForValue(snapshot, std::make_shared<int64_t>(probe), value) && value==probe?0:1;
+                    }
+                }
+            }
+            writing--;
+        });
+    }
+    for(int r=0;r<2;r++){
+        threads.emplace_back([&,r]{
+            std::mt19937_64 random(50+r);
+            BPlusThreadPool pool(2);
+            auto stableOnly=[](const int64_t& k1,const int64_t&){
+                return k1%10==0?0:1;
+            };
+            while(writing.load()>0){
+                int64_t key=(int64_t)(random()%stable.size())*10;
+                int64_t value=-1;
+                mismatches+=BB::searchForValue(tree, std::make_shared<int64_t>(key), value) && value==key?0:1;
+                auto found=BB::searchForKey(tree, std::make_shared<int64_t>(key-5), SearchType::GreaterThan);
+                mismatches+=found && *found>key-5 && *found<=key?0:1;
+                found=BB::searchForKey(tree, std::make_shared<int64_t>(key+5), SearchType::LesserThanOrEqualsTo);
+                mismatches+=found && *found>=key && *found<=key+5?0:1;
+                mismatches+=BB::rank(tree, std::make_shared<int64_t>(key))>=(uint64_t)key/10?0:1;
+
+                int64_t high=key+(int64_t)(random()%400);
+                auto range=keysOf(BB::searchForRangeWithPagination(tree, 0, -1, std::make_shared<int64_t>(key), std::make_shared<int64_t>(high)));
+                std::vector<int64_t> stableInRange;
+                for(size_t i=0;i<range.size();i++){
+                    mismatches+=range[i]>=key && range[i]<=high && (i==0 || range[i-1]<range[i])?0:1;
+                    if(range[i]%10==0){
+                        stableInRange.push_back(range[i]);
+                    }
+                }
+                mismatches+=stableInRange==std::vector<int64_t>(std::lower_bound(stable.begin(), stable.end(), key), std::upper_bound(stable.begin(), stable.end(), high))?0:1;
+                if(r==1 && random()%8==0){
+                    mismatches+=keysOf(BB::parallelFind(tree, pool, stableOnly))==stable?0:1;
+                }
+            }
+        });
+    }
+    for(auto& thread : threads){
+        thread.join();
+    }
+    CHECK(mismatches.load()==0);
+
+    Model model;
+    for(int64_t key : stable){
+        model.insert(std::make_pair(key, key));
+    }
+    for(auto& writerModel : models){
+        model.insert(writerModel.begin(), writerModel.end());
+    }
+    CHECK(entriesOf(BB::searchForRangeWithPaginationKV(tree))==modelEntries(model, NULL, NULL));
+    CHECK(BB::getSize(tree)==model.size());
+    CHECK(BB::rank(tree, std::make_shared<int64_t>(KEYS))==model.size());
+    BPlusTreeStats stats=BB::stats(tree);
+    CHECK(stats.entries==model.size());
+    CHECK(stats.leaf_chain_length==stats.levels.back().nodes);
+}
+
+int main(){
+#if defined(__GNUC__) && defined(__x86_64__)
+    //builds for wider search kernels are skipped (ctest SKIP_RETURN_CODE) on CPUs which can not run them
+#if defined(__AVX2__)
+    if(!__builtin_cpu_supports("avx2")){
+        return 77;
+    }
+#elif defined(__SSE4_2__)
+    if(!__builtin_cpu_supports("sse4.2")){
+        return 77;
+    }
+#endif
+#endif
+    struct Test{
+        const char* name;
+        void (*run)();
+    };
+    Test tests[]={
+        {"tree", testTree},
+        {"snapshot", testSnapshot},
+        {"split and join", testSplitJoin},
+        {"append packing", testAppendPacking},
+        {"sharded tree", testShardedTree},
+        {"log recovery", testLogRecovery},
+        {"paged tree", testPagedTree},
+        {"nested operations", testNestedOperations},
+        {"shard snapshot", testShardSnapshot},
+        {"parallel find", testParallelFind},
+        {"simd search", testSimdSearch},
+        {"cursor", testCursor},
+        {"range query", testRangeQuery},
+        {"export range", testExportRange},
+        {"page token", testPageToken},
+        {"prefix compression", testPrefixCompression},
+        {"concurrent readers and writers", testConcurrentReadersWriters},
+    };
+    for(const Test& test : tests){
+        int before=failures;
+        try{
+            test.run();
+        }catch(const char* error){
+            std::fprintf(stderr, "%s: threw %s\n", test.name, error);
+            failures++;
+        }
+        std::printf("%s: %s\n", test.name, failures==before?"ok":"FAILED");
+    }
+    return failures==0?0:1;
+}